@@ -0,0 +1,81 @@
+#pragma once
+#include <atomic>
+#include <future>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "body.h"
+
+struct AnalysisResult
+{
+    unsigned long long step = 0;
+    PVector3 center = {0.0f, 0.0f, 0.0f};
+    std::vector<float> radii;              // Outer edge of every shell
+    std::vector<float> density;            // Shell mass / shell volume
+    std::vector<float> radialVelocity;     // Mean radial velocity per shell
+    std::vector<float> tangentialVelocity; // Mean tangential speed per shell
+    std::vector<float> enclosedMass;       // Mass within each radius
+    PVector3 meanVelocity = {0.0f, 0.0f, 0.0f};
+    float velocityDispersion = 0.0f;       // 1D, from the 3D velocity variance
+    PVector3 angularMomentum = {0.0f, 0.0f, 0.0f};
+    float totalMass = 0.0f;
+};
+
+// Radial profiles and global reductions computed every few steps on the thread pool
+// The caller only pays for a copy of the state (split over the pool), it never waits for a result
+// Every job recomputes from scratch: all bodies move every step, so per-bin sums kept between jobs would be rebuilt anyway
+class AnalysisPipeline
+{
+public:
+    enum class CenterMode : int
+    {
+        ORIGIN,
+        CENTER_OF_MASS,
+        BODY
+    };
+
+    AnalysisPipeline() = default;
+    AnalysisPipeline(const AnalysisPipeline&) = delete;
+    AnalysisPipeline(AnalysisPipeline&&) = delete;
+    ~AnalysisPipeline();
+
+    // Starts a new job if enabled, due and the previous one is done
+    void submit(const std::vector<Body>* bodies, unsigned long long step);
+
+    // Blocks until the job in flight (if any) is done
+    void wait();
+
+    AnalysisResult getLatest() const;
+    bool hasResult() const;
+
+    // Time series of the global reductions, one entry per finished job
+    void getHistory(std::vector<float>& dispersion, std::vector<float>& angularMomentum) const;
+
+    bool exportCSV(const std::string& path) const;
+
+    bool enabled = false;
+    int every = 10;
+    int bins = 32;
+    float maxRadius = 1000.0f;
+    CenterMode centerMode = CenterMode::CENTER_OF_MASS;
+    int centerBody = 0;
+
+private:
+    void run(unsigned long long step, CenterMode mode, int body, int binCount, float radius);
+
+private:
+    std::vector<PVector3> positions;
+    std::vector<PVector3> velocities;
+    std::vector<float> masses;
+    std::atomic<bool> busy = false;
+    std::future<void> job;
+
+    mutable std::mutex resultMutex;
+    AnalysisResult latest;
+    bool resultReady = false;
+    std::vector<unsigned long long> historySteps;
+    std::vector<float> historyDispersion;
+    std::vector<float> historyAngularMomentum;
+    static constexpr std::size_t ANALYSIS_HISTORY_SIZE = 512;
+};
@@ -1,21 +1,31 @@
 #pragma once
 #include <array>
+#include <vector>
 
 #include "body.h"
+#include "forcelaw.h"
+#include "threadpool.h"
 
 struct BHNode
 {
     std::array<BHNode*, 8> children = { nullptr };
     std::vector<const Body*> bodies;
     PVector3 centerOfMassNorm = {0.0f, 0.0f, 0.0f};
-    PVector3 centerOfMassWeighted = {0.0f, 0.0f, 0.0f};
+    StateVector3 centerOfMassWeighted = {0.0f, 0.0f, 0.0f}; // Sums over many bodies, double in mixed precision builds
     PVector3 geometricCenter = {0.0f, 0.0f, 0.0f};
     float mass = 0.0f;
     PVector3 nodeCenter = {0.0f, 0.0f, 0.0f};
     float nodeSize = 1E12f;
+    PVector3 boundsMin = {0.0f, 0.0f, 0.0f}; // Tight box around the bodies below this node
+    PVector3 boundsMax = {0.0f, 0.0f, 0.0f};
     static constexpr float BHNODE_SIZE = 1.0f;
     static constexpr float BHNODE_FIELD_EPSILON_THR = 1E-8f;
+    static constexpr float BHNODE_FIELD_CONSTANT = 10.0f;
     static constexpr int BHNODE_MAX_DEPTH = 10000;
+    static constexpr std::size_t BHNODE_GROUP_SIZE = 32;
+    static constexpr int BHNODE_PARALLEL_DEPTH = 2;
+    static constexpr float BHNODE_ROOT_PADDING = 1E-3f;  // Relative margin of a fitted root, so bodies on its faces stay inside
+    static constexpr float BHNODE_MIN_ROOT_SIZE = 1E-6f; // Fitted roots around a single point still get a size
 
     // static BHPool<BHNode> MemoryPool;
     
@@ -30,6 +40,85 @@ struct BHNode
     // }
 };
 
+struct BHNeighbour
+{
+    const Body* body;
+    float distanceSqr;
+};
+
+// Cost of field walks, summed over every point walked with it
+struct BHWalkStats
+{
+    unsigned long long nodeVisits = 0;
+    unsigned long long interactions = 0;
+};
+
+// A tree cell and the walk cost of every body inside it
+struct BHCostCell
+{
+    PVector3 boundsMin;
+    PVector3 boundsMax;
+    double cost;
+    int level; // Number of splitting ancestors, the root is level 0
+};
+
+// What a camera sees, for level of detail selection
+struct BHView
+{
+    std::array<PVector4, 6> planes; // A point p is inside when dot(plane.xyz, p) + plane.w >= 0 for every plane
+    PVector3 eye;
+    float pixelsPerUnit; // On screen size in pixels of a unit length at unit distance
+    float margin;        // Sprite radius, cells are culled only once their sprites are fully outside
+};
+
+// One sprite of a level of detail selection, a single body or a whole cell at its center of mass
+struct BHSprite
+{
+    PVector3 position;
+    const Body* body;  // The body itself, or a representative of the cell
+    std::size_t count; // Bodies it stands for
+};
+
+struct BHLODStats
+{
+    unsigned long long visited = 0;
+    unsigned long long culled = 0;        // Cells outside the frustum
+    unsigned long long aggregated = 0;    // Sprites standing for more than one body
+    unsigned long long budgetLimited = 0; // Cells big enough to refine whose children did not fit the budget
+};
+
+// Shape and memory of a tree, kept current by insertion so reading it costs nothing
+// Nodes split on their second body, so leaves hold one body except at BHNODE_MAX_DEPTH where coincident bodies share one
+// Occupancy is counted over every node since inner nodes list all the bodies below them, leaves alone would be all ones
+struct BHTreeStats
+{
+    static constexpr std::size_t BHTREE_DEPTH_BINS = 64;     // The last bin also holds anything deeper
+    static constexpr std::size_t BHTREE_OCCUPANCY_BINS = 32; // Bin k holds nodes with [2^k, 2^(k+1)) bodies
+
+    unsigned long long nodes = 0;
+    unsigned long long leaves = 0;
+    unsigned long long bodies = 0; // Inserted into this tree, leaves can hold several
+    unsigned long long bodyReferences = 0; // Every node lists all the bodies below it
+    unsigned long long leafDepthSum = 0;
+    int maxDepth = 0;
+    std::size_t listBytes = 0; // Capacity of the node body lists
+    std::array<unsigned long long, BHTREE_DEPTH_BINS> leafDepths = {};
+    std::array<unsigned long long, BHTREE_OCCUPANCY_BINS> occupancy = {};
+
+    // Largest tree since the BHTree was created, reset keeps these
+    unsigned long long peakNodes = 0;
+    std::size_t peakBytes = 0;
+
+    float rootSize = 0.0f; // Edge of the root cell, the default size unless the tree was fitted
+
+    // Filled by the simulation, bodies its escaper policy kept out of this tree and removed so far
+    unsigned long long escapers = 0;
+    unsigned long long removedBodies = 0;
+
+    double getMeanLeafDepth() const;
+    std::size_t getBytes() const;
+};
+
 class BHTree
 {
 public:
@@ -38,21 +127,79 @@ public:
 
 
     void reset();
+    // Shrinks the empty root to a cube around bodies, those flagged in skip (by position in bodies) are left out
+    // Call between reset and the first insertion, the tree then starts splitting where the bodies are
+    void fitRoot(const std::vector<Body>& bodies, const std::vector<unsigned char>* skip = nullptr, ThreadPool* pool = &ThreadPool::Global());
     void insertBody(const Body* body);
-    PVector3 calculateFieldOnPoint(const PVector3& point, const float thr);
+
+    // Recompute mass, center of mass and bounds of every node bottom up from the bodies in the leaves
+    // Insertion already keeps them current, this is the refit pass for bodies that moved inside their cells
+    // The top levels are split over pool, nullptr runs serially
+    void computeMoments(ThreadPool* pool = &ThreadPool::Global());
+    // Optionally accumulates the potential at point in the same walk, and the walk cost into stats
+    // Law is a policy from forcelaw.h compiled into the walk, the overload without one uses LogLaw
+    template<typename Law>
+    PVector3 calculateFieldOnPoint(const Law& law, const PVector3& point, const float thr, float* potential = nullptr, BHWalkStats* stats = nullptr);
+    PVector3 calculateFieldOnPoint(const PVector3& point, const float thr, float* potential = nullptr, BHWalkStats* stats = nullptr);
+    // The whole tree as a single mass at its center of mass, for points far outside it
+    template<typename Law>
+    PVector3 calculateMonopoleField(const Law& law, const PVector3& point, float* potential = nullptr) const;
+    float getMass() const;
+    PVector3 getCenterOfMass() const;
     void printNodes() const;
     unsigned long long computeNodeNumber() const;
+    BHTreeStats getStats() const;
+    const std::vector<const Body*>& getBodies() const;
+
+    // Batched spatial queries, parallel over the query points
+    // The tree must be built (i.e. between insertion and reset)
+    std::vector<std::vector<const Body*>> queryRange(const std::vector<PVector3>& points, float radius) const;
+    void queryRange(const PVector3& point, float radius, std::vector<const Body*>& result) const;
+    std::vector<std::vector<BHNeighbour>> queryNearest(const std::vector<PVector3>& points, std::size_t k) const;
+
+    // Field (and optionally potential) on many sample points at once
+    // Samples are sorted in Morton order and walked in small groups sharing one interaction list
+    template<typename Law>
+    void calculateFieldOnPoints(const Law& law, const std::vector<PVector3>& points, const float thr, std::vector<PVector3>& field, std::vector<float>* potential = nullptr) const;
+    void calculateFieldOnPoints(const std::vector<PVector3>& points, const float thr, std::vector<PVector3>& field, std::vector<float>* potential = nullptr) const;
+
+    // Closest body to origin whose center lies within radius of the ray, nullptr if none
+    const Body* pickRay(const PVector3& origin, const PVector3& direction, float radius) const;
+
+    // Sums bodyCost (indexed by Body::getIndex()) over every node and emits cells down to maxLevel
+    // Only nodes with two or more children count as a level, a pass through node has the bounds of its only child
+    void collectCostCells(const std::vector<float>& bodyCost, int maxLevel, std::vector<BHCostCell>& cells) const;
+
+    // Refines the visible cells largest on screen first, a cell stays a single sprite once it is under minPixels
+    // or its visible children would take more than budget sprites in total
+    void selectLOD(const BHView& view, float minPixels, std::size_t budget, std::vector<BHSprite>& sprites, BHLODStats* stats = nullptr) const;
+
+    // Mass density from the k nearest neighbours of every body in the tree, indexed by Body::getIndex()
+    std::vector<float> calculateLocalDensity(std::size_t k) const;
+
+    // Field (and optionally potential) of a single mass at point
+    template<typename Law>
+    static PVector3 CalculatePointField(const Law& law, const PVector3& point, const PVector3& source, float mass, float* potential = nullptr);
 
 private:
-    unsigned long long countChildrenRecursive(BHNode* node) const;
+    void collectInteractions(const PVector3& groupMin, const PVector3& groupMax, const float thr, const BHNode* node, std::vector<const BHNode*>& interactions) const;
+    void queryRangeDFS(const PVector3& point, float radiusSqr, const BHNode* node, std::vector<const Body*>& result) const;
+    void queryNearestDFS(const PVector3& point, std::size_t k, const BHNode* node, const Body* exclude, std::vector<BHNeighbour>& heap) const;
+    void computeNodeMoments(BHNode* node, int depth, ThreadPool* pool);
+    double collectCostCellsDFS(const BHNode* node, int level, const std::vector<float>& bodyCost, int maxLevel, std::vector<BHCostCell>& cells) const;
+    void pickRayDFS(const PVector3& origin, const PVector3& direction, const PVector3& inverse, float radius, const BHNode* node, const Body*& best, float& bestT) const;
     void printNode(const BHNode* node, int depth) const;
     void deleteNodes(BHNode* node);
-    PVector3 calculateFieldOnPointDFS(const PVector3& point, const float thr, const BHNode* node);
+    template<typename Law>
+    PVector3 calculateFieldOnPointDFS(const Law& law, const PVector3& point, const float thr, const BHNode* node, float* potential, BHWalkStats* stats);
     void calculateNodeInsertion(const Body* body, BHNode* node, unsigned long long depth);
     PVector3 calculateNodeCenter(const std::size_t nodeIndex, const BHNode* parent);
     std::size_t calculateNodeIndex(const PVector3& position, const BHNode* node);
     void spawnChildren(BHNode* parent, int depth);
+    void addNodeBody(BHNode* node, const Body* body);
+    void resetStats();
 
 private:
     BHNode* root;
+    BHTreeStats stats;
 };
@@ -1,5 +1,6 @@
 #pragma once
 #include "math.h"
+#include "precision.h"
 #include <vector>
 
 class Body
@@ -10,29 +11,55 @@ public:
 
     Body(const Body& body) = default;
     Body(Body&& body) = default;
+    Body& operator=(const Body& body) = default;
+    Body& operator=(Body&& body) = default;
     ~Body() = default;
 
     void move(const PVector3& field);
+    // move for every body, field[i] acting on (*bodies)[i]
+    // When bodies own the whole pool the update runs over the pools as flat arrays the compiler vectorizes
+    static void MoveAll(std::vector<Body>* bodies, const std::vector<PVector3>& field);
 
     float getMass() const;
     PVector3 getPosition() const;
+    StateVector3 getStatePosition() const; // The position the integrator works on, double in mixed precision builds
+    PVector3 getVelocity() const;
+    std::size_t getIndex() const;
 
 
     static std::vector<PVector3>* GetLinearPositionPool();
     static std::vector<PVector3>* GetLinearVelocityPool();
     static std::vector<PVector3>* GetLinearForcePool();
     static std::vector<UVector4>* GetColorPool();
+    // The float pool everything else reads is rounded from this one after every move (mixed precision builds only)
+    static std::vector<StateVector3>* GetStatePositionPool();
     static void ResetPools();
+    // Raise the pool capacity before creating more bodies than the default reservation
+    static void ReservePools(std::size_t count);
+    // Drops the bodies flagged in remove (by position in bodies) and compacts the pools, the rest keep their order
+    // bodies must hold every body of the pools in pool order, returns how many were removed
+    static std::size_t RemoveBodies(std::vector<Body>* bodies, const std::vector<unsigned char>& remove);
+
+    // Integrator constants, a = BODY_FIELD_GAIN * m * field (see move)
+    static constexpr float BODY_TIMESTEP = 0.01f;
+    static constexpr float BODY_FIELD_GAIN = 2.0f;
 
 
 private:
-    static inline std::vector<PVector3> PositionPool;
-    static inline std::vector<PVector3> VelocityPool;
-    static inline std::vector<PVector3> ForcePool;
-    static inline std::vector<UVector4> ColorPool;
+    // Pools are per thread so independent simulations (see EnsembleRunner) can live in one process
+    // Bodies must be created on the thread that owns the simulation, they can be read from any thread
+    static inline thread_local std::vector<PVector3> PositionPool;
+    static inline thread_local std::vector<PVector3> VelocityPool;
+    static inline thread_local std::vector<PVector3> ForcePool;
+    static inline thread_local std::vector<UVector4> ColorPool;
+#ifdef STARWELL_MIXED_PRECISION
+    static inline thread_local std::vector<StateVector3> StatePositionPool;
+    StateVector3* statePosition;
+#endif
     PVector3* force;
     PVector3* position;
     PVector3* velocity;
     UVector4* color;
+    std::size_t index;
     float mass;
 };
@@ -33,6 +33,10 @@ public:
     PVector3 getPosition() const;
     PVector3 getCenterOrRotation() const;
     PVector3 getHeading() const;
+    float getFov() const;
+
+    // World space ray through a point in normalized device coordinates ([-1, 1], y up)
+    void getRay(float ndcX, float ndcY, PVector3& origin, PVector3& direction) const;
     
     float getScrollSensitivity() const;
 
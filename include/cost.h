@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+
+#include "bhtree.h"
+
+// Walk cost of every body and of the tree cells holding them, to find where the opening criterion costs throughput
+// Simulation::integrate fills it on tree steps while enabled, the colours and cells are rebuilt on every such step
+class CostMap
+{
+public:
+    enum class Metric
+    {
+        INTERACTIONS,
+        NODE_VISITS
+    };
+
+    CostMap() = default;
+    CostMap(const CostMap&) = delete;
+    CostMap(CostMap&&) = delete;
+    ~CostMap() = default;
+
+    // Zeroed stats for count bodies, indexed by Body::getIndex()
+    BHWalkStats* begin(std::size_t count);
+
+    // Must run on the same tree the costs were measured with, before it is reset
+    void finish(const BHTree& tree);
+
+    bool hasResult() const;
+    unsigned long long getVersion() const; // Bumped by every finish
+    const std::vector<UVector4>& getColors() const;
+    const std::vector<BHCostCell>& getCells() const;
+    float getMeanCost() const;
+    float getMaxCost() const;
+    float getPercentileCost() const; // 99th percentile, the top of the colour scale
+
+    // Blue (cheap) to red (expensive), t in [0, 1]
+    static UVector4 HeatColor(float t, unsigned char alpha = 255);
+
+    bool enabled = false;
+    bool colorBodies = true;
+    bool showCells = false;
+    int maxCellLevel = 6;
+    Metric metric = Metric::INTERACTIONS;
+
+private:
+    std::vector<BHWalkStats> bodyStats;
+    std::vector<float> bodyCost;
+    std::vector<UVector4> colors;
+    std::vector<BHCostCell> cells;
+    bool ready = false;
+    unsigned long long version = 0;
+    float meanCost = 0.0f;
+    float maxCost = 0.0f;
+    float percentileCost = 0.0f;
+};
@@ -0,0 +1,97 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Runtime instruction set dispatch for the hot kernels
+// The build stays generic (-O3, no -march), each kernel is compiled once per path and the best one the CPU supports
+// is looked up in its table at the call, so one binary runs AVX-512 code where it can and SSE elsewhere
+enum class CpuPath
+{
+    SCALAR, // Whatever the build targets, SSE2 on x86-64
+    SSE4,
+    AVX2,   // With FMA
+    AVX512  // F, VL, DQ and BW
+};
+
+inline constexpr int CPU_PATH_COUNT = 4;
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define STARWELL_CPU_DISPATCH
+#define STARWELL_TARGET_SSE4 __attribute__((target("sse4.2")))
+#define STARWELL_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#if defined(__clang__)
+#define STARWELL_TARGET_AVX512 __attribute__((target("avx512f,avx512vl,avx512dq,avx512bw,avx2,fma")))
+#else
+// GCC sticks to 256 bit vectors for AVX-512 unless told otherwise
+#define STARWELL_TARGET_AVX512 __attribute__((target("avx512f,avx512vl,avx512dq,avx512bw,avx2,fma,prefer-vector-width=512")))
+#endif
+#endif
+
+// Defines Name##Scalar, Name##Sse4, Name##Avx2 and Name##Avx512, each compiling the always inline Name##Body for its path
+// Params is the parenthesized parameter list and Args the matching arguments, Template is empty or a template header
+#ifdef STARWELL_CPU_DISPATCH
+#define STARWELL_KERNEL_VARIANTS(Template, Name, Params, Args)                           \
+    Template static void Name##Scalar Params { Name##Body Args; }                        \
+    Template STARWELL_TARGET_SSE4 static void Name##Sse4 Params { Name##Body Args; }     \
+    Template STARWELL_TARGET_AVX2 static void Name##Avx2 Params { Name##Body Args; }     \
+    Template STARWELL_TARGET_AVX512 static void Name##Avx512 Params { Name##Body Args; }
+// Table indexed by CpuPath, the optional argument is a template argument list
+#define STARWELL_KERNEL_TABLE(Name, ...) { &Name##Scalar __VA_ARGS__, &Name##Sse4 __VA_ARGS__, &Name##Avx2 __VA_ARGS__, &Name##Avx512 __VA_ARGS__ }
+#else
+#define STARWELL_KERNEL_VARIANTS(Template, Name, Params, Args) \
+    Template static void Name##Scalar Params { Name##Body Args; }
+#define STARWELL_KERNEL_TABLE(Name, ...) { &Name##Scalar __VA_ARGS__, &Name##Scalar __VA_ARGS__, &Name##Scalar __VA_ARGS__, &Name##Scalar __VA_ARGS__ }
+#endif
+
+// Marks a kernel body so it inlines into every variant and gets compiled for that variant's instruction set
+#define STARWELL_KERNEL_INLINE [[gnu::always_inline]] static inline
+
+class CpuDispatch
+{
+public:
+    // Best path this CPU and OS support, SCALAR where the build has no dispatch
+    static CpuPath Detect();
+    // Caps every kernel, e.g. to reproduce another node's results bit for bit, clamped to what Detect allows
+    static void SetLimit(CpuPath limit);
+    static CpuPath GetLimit();
+    // The path every kernel runs
+    static CpuPath GetPath();
+
+    static const char* GetPathName(CpuPath path);
+    static bool ParsePath(const std::string& name, CpuPath& path);
+    // "<path> (detected <path>)" followed by every kernel and the path it runs
+    static std::string Describe();
+
+private:
+    static inline std::atomic<int> limit = CPU_PATH_COUNT - 1;
+};
+
+// One dispatched kernel, the name is what gets reported
+// Declared at namespace scope next to the kernel's table, it registers itself for Describe
+class CpuKernel
+{
+public:
+    explicit CpuKernel(const char* name);
+    CpuKernel(const CpuKernel&) = delete;
+    CpuKernel(CpuKernel&&) = delete;
+    ~CpuKernel() = default;
+
+    const char* getName() const;
+    CpuPath getPath() const;
+
+    // The variant of a STARWELL_KERNEL_TABLE to run
+    template<typename Function>
+    Function* pick(Function* const (&variants)[CPU_PATH_COUNT]) const
+    {
+        return variants[static_cast<int>(getPath())];
+    }
+
+    static const std::vector<const CpuKernel*>& GetKernels();
+
+private:
+    static std::vector<const CpuKernel*>& Registry();
+
+private:
+    const char* name;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <vector>
+
+#include "body.h"
+
+struct ConservationSample
+{
+    unsigned long long step = 0;
+    double kinetic = 0.0;
+    double potential = 0.0;
+    PVector3 momentum = {0.0f, 0.0f, 0.0f};
+    PVector3 angularMomentum = {0.0f, 0.0f, 0.0f};
+    double momentumScale = 0.0; // Sum of m |v|, what |momentum| is compared against
+
+    double getEnergy() const;
+};
+
+// Tracks energy, momentum and angular momentum against the first sample
+// Samples are produced by Simulation::integrate, the potential comes out of the same tree walk as the field
+class ConservationMonitor
+{
+public:
+    ConservationMonitor() = default;
+    ConservationMonitor(const ConservationMonitor&) = delete;
+    ConservationMonitor(ConservationMonitor&&) = delete;
+    ~ConservationMonitor() = default;
+
+    bool due(unsigned long long step) const;
+    void record(const ConservationSample& sample);
+    void reset();
+
+    bool hasSample() const;
+    const ConservationSample& getInitial() const;
+    const ConservationSample& getLatest() const;
+
+    // Relative to the initial values, energy is measured against the initial kinetic energy
+    double getEnergyDrift() const;
+    double getMomentumDrift() const;
+    double getAngularMomentumDrift() const;
+
+    const std::vector<float>& getEnergyHistory() const;
+    const std::vector<float>& getMomentumHistory() const;
+    const std::vector<float>& getAngularMomentumHistory() const;
+
+    // Reduce kinetic energy, momentum and angular momentum over bodies on the global pool
+    static void Reduce(const std::vector<Body>* bodies, ConservationSample& sample);
+
+    bool enabled = false;
+    int every = 1;
+
+private:
+    bool initialized = false;
+    ConservationSample initial;
+    ConservationSample latest;
+    std::vector<float> energyHistory;
+    std::vector<float> momentumHistory;
+    std::vector<float> angularMomentumHistory;
+    static constexpr std::size_t CONSERVATION_HISTORY_SIZE = 512;
+};
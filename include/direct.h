@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+
+#include "body.h"
+#include "forcelaw.h"
+
+// Exact O(N^2) field with the same laws as the tree walks
+// Sources are kept as separate x/y/z/m arrays so the inner loop vectorizes, targets are split over the thread pool
+// Faster than building a tree for small N, and the reference the tree is measured against
+class DirectSummation
+{
+public:
+    DirectSummation() = default;
+    DirectSummation(const DirectSummation&) = delete;
+    DirectSummation(DirectSummation&&) = delete;
+    ~DirectSummation() = default;
+
+    void setSources(const std::vector<Body>* bodies);
+    void setSources(const std::vector<PVector3>& positions, const std::vector<float>& masses);
+    std::size_t getSourceCount() const;
+
+    // Same contract as BHTree::calculateFieldOnPoints, without a law it uses LogLaw
+    template<typename Law>
+    void calculateFieldOnPoints(const Law& law, const std::vector<PVector3>& points, std::vector<PVector3>& field, std::vector<float>* potential = nullptr) const;
+    void calculateFieldOnPoints(const std::vector<PVector3>& points, std::vector<PVector3>& field, std::vector<float>* potential = nullptr) const;
+
+    // A tile of sources (4 arrays of this many floats) stays in L1 while a block of targets runs over it
+    static constexpr std::size_t DIRECT_TILE_SIZE = 1024;
+    static constexpr std::size_t DIRECT_TARGET_BLOCK = 64;
+
+private:
+    template<typename Law>
+    void calculateBlock(const Law& law, const PVector3* points, std::size_t count, PVector3* field, float* potential) const;
+
+private:
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> m;
+};
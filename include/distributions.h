@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "body.h"
+
+// Synthetic, seeded body distributions for tools that must not depend on Python scenes
+// Scales roughly match scenes/galaxies.py so thresholds carry over
+enum class DistributionType
+{
+    UNIFORM,  // Uniform sphere
+    PLUMMER,  // Plummer sphere, strongly clustered core
+    TWO_DISK  // Two thin exponential disks on a collision course
+};
+
+struct Distribution
+{
+    DistributionType type;
+    std::vector<PVector3> positions;
+    std::vector<PVector3> velocities;
+};
+
+Distribution GenerateDistribution(DistributionType type, std::size_t count, unsigned int seed);
+
+// Creates bodies in the calling thread's pools
+std::vector<Body> CreateBodies(const Distribution& distribution);
+
+const char* GetDistributionName(DistributionType type);
+bool ParseDistribution(const std::string& name, DistributionType& type);
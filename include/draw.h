@@ -1,4 +1,6 @@
 #pragma once
+#include <array>
+#include <string>
 #include <unordered_map>
 #include <vector>
 #include <iostream>
@@ -14,6 +16,7 @@ public:
     ~GenShader();
 
     bool swap(const std::string& name) const;
+    const std::string& getActive() const;
     void setRenderTarget();
 
     template<typename T>
@@ -65,28 +68,118 @@ private:
 private:
     std::unordered_map<std::string, GLuint> shaderCache;
     mutable GLuint activeProgram;
+    mutable std::string activeName;
 };
 
+// Instanced particles, positions stream through a persistently mapped ring of INSTANCE_RING_SIZE regions
+// Buffers are sized to the particle count and only grow, colours are static and only uploaded when they change
+// Positions are copied (or encoded) into the ring on the render thread: the sources (body pools, replay, stream, LOD)
+// are read elsewhere too and outlive a frame, so they can't live in GL memory that is recycled every third frame
 class InstanceState
 {
 public:
+    enum class PositionFormat
+    {
+        FLOAT32, // 12 bytes, as simulated
+        UNORM16, // 6 bytes, quantized over the bounds of the uploaded positions
+        HALF16   // 6 bytes, half floats relative to the center of those bounds
+    };
+
     InstanceState();
     InstanceState(const InstanceState& s) = delete;
     InstanceState(InstanceState&& s) = delete;
     ~InstanceState();
-    
+
+    // Copies into the region the next frame draws from, only waits if the GPU is still reading it from
+    // INSTANCE_RING_SIZE frames ago. Upload positions before colours, they size the buffers
     void updatePositions(const std::vector<PVector3>* p);
+    void updatePositions(const PVector3* p, std::size_t count);
+
+    // Skipped unless the source, the count or markColorsDirty changed since the last upload
     void updateColors(const std::vector<UVector4>* c);
-    void draw() const;
+    void updateColors(const UVector4* c, std::size_t count);
+    void markColorsDirty();
+
+    void setPositionFormat(PositionFormat format);
+    PositionFormat getPositionFormat() const;
+    static const char* GetPositionFormatName(PositionFormat format);
+    static bool ParsePositionFormat(const std::string& name, PositionFormat& format);
+
+    // The classic shader dequantizes with world = origin + scale * attribute, identity for FLOAT32
+    const PVector3& getPositionOrigin() const;
+    const PVector3& getPositionScale() const;
+    std::size_t getPositionBytes() const;
+
+    void draw();
 
 private:
-    void setAttribute(int location, GLuint buffer, int size, GLenum type, bool perInstance) const;
+    unsigned char* mapRegion(std::size_t count);
+    std::size_t getPositionStride() const;
+    void reserve(std::size_t count);
+    void waitRegion(std::size_t region);
+    void setAttribute(int location, GLuint buffer, int size, GLenum type, bool perInstance, std::size_t offset = 0) const;
 
 private:
+    static constexpr std::size_t INSTANCE_RING_SIZE = 3;
     GLuint vao;
     GLuint billboard;
-    GLuint position;
-    GLuint color;
+    GLuint position = 0;
+    GLuint color = 0;
+    unsigned char* mappedPositions = nullptr;
+    PositionFormat positionFormat = PositionFormat::FLOAT32;
+    std::size_t positionStride = 0; // Of the current storage, a new format needs new storage
+    PVector3 positionOrigin = {0.0f, 0.0f, 0.0f};
+    PVector3 positionScale = {1.0f, 1.0f, 1.0f};
+    std::array<GLsync, INSTANCE_RING_SIZE> fences = {};
+    std::size_t region = 0;
+    std::size_t capacity = 0;
+    const UVector4* colorSource = nullptr;
+    std::size_t colorCount = 0;
+    bool colorsDirty = true;
     unsigned long long particleCount = 0;
     static inline constexpr unsigned long long MAX_INSTANCE_PARTICLES = 100'000'000;
 };
+
+struct LineVertex
+{
+    PVector3 position;
+    UVector4 color;
+};
+
+// Line list with a colour per vertex, for overlays drawn with the wire shader
+class LineState
+{
+public:
+    LineState();
+    LineState(const LineState& s) = delete;
+    LineState(LineState&& s) = delete;
+    ~LineState();
+
+    void update(const std::vector<LineVertex>& vertices);
+    void draw() const;
+
+private:
+    GLuint vao;
+    GLuint buffer;
+    std::size_t vertexCount = 0;
+};
+
+// Screen filling image, for frames rendered on the CPU and drawn with the image shader
+class ImageState
+{
+public:
+    ImageState();
+    ImageState(const ImageState& s) = delete;
+    ImageState(ImageState&& s) = delete;
+    ~ImageState();
+
+    // Rows bottom up, the texture is only reallocated when the size changes
+    void update(const UVector4* rgba, int width, int height);
+    void draw() const;
+
+private:
+    GLuint vao;
+    GLuint texture;
+    int width = 0;
+    int height = 0;
+};
@@ -0,0 +1,37 @@
+#pragma once
+#include <map>
+#include <string>
+#include <vector>
+
+#include "threadpool.h"
+
+struct EnsembleRun
+{
+    std::string scene;
+    unsigned long long steps = 1000;
+    float thr = 0.5f;
+    std::map<std::string, double> parameters;
+};
+
+class EnsembleRunner
+{
+public:
+    EnsembleRunner(ThreadPool& pool, const std::string& outputDir, unsigned long long snapshotEvery = 1);
+
+    // One run per line: <scene> <steps> [thr=<value>] [<parameter>=<value> ...]
+    // Empty lines and lines starting with '#' are skipped
+    bool load(const std::string& path);
+    void add(const EnsembleRun& run);
+
+    // Runs every simulation to completion, returns the number of runs that failed
+    std::size_t run();
+
+private:
+    bool runOne(std::size_t index);
+
+private:
+    ThreadPool& pool;
+    std::string outputDir;
+    unsigned long long snapshotEvery;
+    std::vector<EnsembleRun> runs;
+};
@@ -0,0 +1,127 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "math.h"
+
+// Interaction kernels, passed by value into the templated tree walks and the direct sum so they inline into the loops
+// A law gives, for a source of unit mass at squared distance r2 > 0:
+//   scale(r2)     the field is K m scale(r2) d, with d the vector from the point to the source
+//   potential(r2) phi per K m, with field = -grad(phi)
+// A new law is a struct like these, a ForceLaw::Type, a case in DispatchForceLaw and an entry in STARWELL_FORCE_LAWS
+
+// |F| = K m / r, the law the simulation has always used (phi = K m ln r)
+struct LogLaw
+{
+    float scale(float r2) const
+    {
+        return 1.0f / r2;
+    }
+
+    float potential(float r2) const
+    {
+        return 0.5f * std::log(r2);
+    }
+};
+
+// Newtonian 1/r^2 softened as if every source were a Plummer sphere of radius epsilon
+struct PlummerLaw
+{
+    float epsilonSqr;
+
+    float scale(float r2) const
+    {
+        const float s = Rsqrt(r2 + epsilonSqr);
+        return s * s * s;
+    }
+
+    float potential(float r2) const
+    {
+        return -Rsqrt(r2 + epsilonSqr);
+    }
+};
+
+// Newtonian 1/r^2 softened with the cubic spline kernel (Monaghan & Lattanzio), exact beyond the length h
+struct SplineLaw
+{
+    float h;
+
+    float scale(float r2) const
+    {
+        const float r = std::sqrt(r2);
+        const float u = r / h;
+        const float inverseH3 = 1.0f / (h * h * h);
+        if(u >= 1.0f) return 1.0f / (r2 * r);
+        if(u < 0.5f)  return inverseH3 * (10.666667f + u * u * (32.0f * u - 38.4f));
+        return inverseH3 * (21.333333f - 48.0f * u + 38.4f * u * u - 10.666667f * u * u * u - 0.0666667f / (u * u * u));
+    }
+
+    float potential(float r2) const
+    {
+        const float r = std::sqrt(r2);
+        const float u = r / h;
+        if(u >= 1.0f) return -1.0f / r;
+        if(u < 0.5f)  return (-2.8f + u * u * (5.333333f + u * u * (6.4f * u - 9.6f))) / h;
+        return (-3.2f + 0.0666667f / u + u * u * (10.666667f + u * (-16.0f + u * (9.6f - 2.133333f * u)))) / h;
+    }
+};
+
+// |F| = K m / r^p for any exponent, for trying out laws without a rebuild (pow is slower than the fixed laws)
+struct PowerLaw
+{
+    float exponent;
+
+    float scale(float r2) const
+    {
+        return std::pow(r2, -0.5f * (exponent + 1.0f));
+    }
+
+    float potential(float r2) const
+    {
+        if(std::abs(exponent - 1.0f) < 1E-6f) return 0.5f * std::log(r2);
+        return std::pow(r2, 0.5f * (1.0f - exponent)) / (1.0f - exponent);
+    }
+};
+
+// Every law the walks are compiled for
+#define STARWELL_FORCE_LAWS(X) \
+    X(LogLaw)                  \
+    X(PlummerLaw)              \
+    X(SplineLaw)               \
+    X(PowerLaw)
+
+// Law picked at runtime, turned into one of the policies above once per step
+struct ForceLaw
+{
+    enum class Type
+    {
+        LOG,
+        PLUMMER,
+        SPLINE,
+        POWER
+    };
+
+    Type type = Type::LOG;
+    float softening = FORCELAW_DEFAULT_SOFTENING; // Plummer radius or spline length
+    float exponent = 2.0f;                        // Of the power law
+
+    static const char* GetTypeName(Type type);
+    static bool ParseType(const std::string& name, Type& type);
+
+    static constexpr float FORCELAW_DEFAULT_SOFTENING = 1.0f;
+};
+
+// Calls function with the policy for law, so everything it calls is compiled for that law
+template<typename Function>
+decltype(auto) DispatchForceLaw(const ForceLaw& law, Function&& function)
+{
+    switch(law.type)
+    {
+        case ForceLaw::Type::PLUMMER: return function(PlummerLaw{ law.softening * law.softening });
+        case ForceLaw::Type::SPLINE:  return function(SplineLaw{ std::max(law.softening, 1E-6f) });
+        case ForceLaw::Type::POWER:   return function(PowerLaw{ law.exponent });
+        case ForceLaw::Type::LOG:
+        default:                      return function(LogLaw{});
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "bhtree.h"
+
+struct BodyGroup
+{
+    std::size_t members;
+    float mass;
+    PVector3 centerOfMass;
+    PVector3 velocity; // Mass weighted mean velocity
+};
+
+// Friends-of-friends: bodies closer than the linking length belong to the same group
+class GroupFinder
+{
+public:
+    explicit GroupFinder(float linkingLength, std::size_t minMembers = 8);
+
+    // The tree must be built, groups are ordered by decreasing member count
+    const std::vector<BodyGroup>& find(const BHTree& tree);
+
+    const std::vector<BodyGroup>& getGroups() const;
+    // Group of every body by Body::getIndex(), -1 when it is in no group
+    const std::vector<int>& getGroupIds() const;
+
+    // Appends the current catalogue to a CSV file (one row per group, tagged with step)
+    bool writeCatalogue(const std::string& path, unsigned long long step) const;
+
+    float linkingLength;
+    std::size_t minMembers;
+
+private:
+    unsigned int findRoot(unsigned int i);
+    void unite(unsigned int a, unsigned int b);
+
+private:
+    std::vector<std::atomic<unsigned int>> parents;
+    std::vector<BodyGroup> groups;
+    std::vector<int> groupIds;
+};
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+struct HeapSnapshot
+{
+    unsigned long long allocations = 0;
+    unsigned long long frees = 0;
+    std::size_t liveBytes = 0;
+    std::size_t peakBytes = 0;
+};
+
+// Process wide heap counters fed by a replacement global operator new/delete
+// Only built with STARWELL_HEAP_STATS, otherwise every count stays zero
+class HeapStats
+{
+public:
+    static HeapSnapshot Get();
+    static void ResetPeak();
+
+    // Closes a frame, allocations since the previous call go into the history
+    static void EndFrame();
+    static unsigned long long GetFrameAllocations();
+    static const std::vector<float>& GetFrameAllocationHistory();
+
+#ifdef STARWELL_HEAP_STATS
+    static constexpr bool HEAPSTATS_ENABLED = true;
+#else
+    static constexpr bool HEAPSTATS_ENABLED = false;
+#endif
+    static constexpr std::size_t HEAPSTATS_HISTORY_SIZE = 240;
+};
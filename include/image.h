@@ -0,0 +1,11 @@
+#pragma once
+#include <string>
+
+// 8 bit RGB image files from tightly packed RGBA rows, alpha is dropped
+// flipRows writes the last row first (OpenGL reads images bottom up)
+
+// PNG with adaptive row filters and a fixed Huffman LZ77 deflate stream, no external dependency
+bool WritePNG(const std::string& path, int width, int height, const unsigned char* rgba, bool flipRows);
+
+// Headerless rgb24, e.g. for ffmpeg -f rawvideo -pix_fmt rgb24 -s WxH
+bool WriteRaw(const std::string& path, int width, int height, const unsigned char* rgba, bool flipRows);
@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+
+#include "bhtree.h"
+#include "camera.h"
+
+// Frustum culled, budgeted level of detail over the BH tree, replaces drawing every body
+// Far away cells under minPixels on screen are drawn as one sprite at their center of mass
+class LevelOfDetail
+{
+public:
+    LevelOfDetail() = default;
+    LevelOfDetail(const LevelOfDetail&) = delete;
+    LevelOfDetail(LevelOfDetail&&) = delete;
+    ~LevelOfDetail() = default;
+
+    // The tree must be built from the bodies in the color pool of this thread
+    void select(const BHTree& tree, const Camera& camera, int viewportHeight, float spriteRadius);
+    static BHView MakeView(const Camera& camera, int viewportHeight, float spriteRadius);
+
+    bool hasResult() const;
+    unsigned long long getVersion() const; // Bumped by every select
+    const std::vector<PVector3>& getPositions() const;
+    const std::vector<UVector4>& getColors() const;
+    const BHLODStats& getStats() const;
+    std::size_t getRepresentedBodies() const;
+
+    bool enabled = false;
+    float minPixels = 2.0f;
+    int budget = LOD_DEFAULT_BUDGET;
+
+    static constexpr int LOD_DEFAULT_BUDGET = 1'000'000;
+    static constexpr int LOD_MAX_BUDGET = 16'000'000;
+
+private:
+    std::vector<BHSprite> sprites;
+    std::vector<PVector3> positions;
+    std::vector<UVector4> colors;
+    BHLODStats stats;
+    std::size_t representedBodies = 0;
+    bool ready = false;
+    unsigned long long version = 0;
+};
@@ -1,6 +1,14 @@
 #pragma once
 #include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+// The small operators are defined here so they inline into the loops that use them (the walks, the integrator)
+// Only the matrix builders and the stream operators live in math.cpp
 
 struct PVector3
 {
@@ -14,26 +22,184 @@ struct PVector3
         };
         float data[3];
     };
-    
-    static float DistanceSqr(const PVector3& a, const PVector3& b);
+
+    static constexpr float DistanceSqr(const PVector3& a, const PVector3& b);
     static float Distance(const PVector3& a, const PVector3& b);
-    static float InnerProduct(const PVector3& a, const PVector3& b);
+    static constexpr float InnerProduct(const PVector3& a, const PVector3& b);
     static float Magnitude(const PVector3& v);
     static PVector3 Normalize(const PVector3& v);
+    static constexpr PVector3 Min(const PVector3& a, const PVector3& b);
+    static constexpr PVector3 Max(const PVector3& a, const PVector3& b);
 
-    PVector3& operator+=(const PVector3& a);
+    constexpr PVector3& operator+=(const PVector3& a);
 };
 
-PVector3 operator*(float s, const PVector3& v);
-PVector3 operator*(const PVector3& a, const PVector3& b);
-PVector3 operator/(const PVector3& v, float s);
-PVector3 operator+(const PVector3& a, const PVector3& b);
-PVector3 operator-(const PVector3& a, const PVector3& b);
+// Pools of PVector3 are also walked as flat float arrays (see the batch operations below)
+static_assert(sizeof(PVector3) == 3 * sizeof(float));
+
+// 1 / sqrt(x), plain enough that the compiler vectorizes it in a loop
+inline float Rsqrt(float x)
+{
+    return 1.0f / std::sqrt(x);
+}
+
+// 1 / sqrt(x) to about 1E-7 relative, for scalar code like the tree walks
+// The hardware estimate with one Newton step, a bit trick with two where there is no SSE
+inline float FastRsqrt(float x)
+{
+#if defined(__SSE__) || defined(_M_X64)
+    const float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+    return y * (1.5f - 0.5f * x * y * y);
+#else
+    unsigned int bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    bits = 0x5F375A86u - (bits >> 1);
+    float y;
+    std::memcpy(&y, &bits, sizeof(y));
+    y = y * (1.5f - 0.5f * x * y * y);
+    return y * (1.5f - 0.5f * x * y * y);
+#endif
+}
+
+constexpr PVector3 operator*(float s, const PVector3& v)
+{
+    return PVector3 { s * v.x, s * v.y, s * v.z };
+}
+
+// Cross product
+constexpr PVector3 operator*(const PVector3& a, const PVector3& b)
+{
+    return PVector3 {
+        a.y * b.z - a.z * b.y,
+        a.z * b.x - a.x * b.z,
+        a.x * b.y - a.y * b.x
+    };
+}
+
+constexpr PVector3 operator/(const PVector3& v, float s)
+{
+    return PVector3 { v.x / s, v.y / s, v.z / s };
+}
+
+constexpr PVector3 operator+(const PVector3& a, const PVector3& b)
+{
+    return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+constexpr PVector3 operator-(const PVector3& a, const PVector3& b)
+{
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+constexpr PVector3& PVector3::operator+=(const PVector3& a)
+{
+    x += a.x;
+    y += a.y;
+    z += a.z;
+    return *this;
+}
+
+constexpr float PVector3::DistanceSqr(const PVector3& a, const PVector3& b)
+{
+    return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z);
+}
+
+inline float PVector3::Distance(const PVector3& a, const PVector3& b)
+{
+    return std::sqrt(DistanceSqr(a, b));
+}
+
+constexpr float PVector3::InnerProduct(const PVector3& a, const PVector3& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline float PVector3::Magnitude(const PVector3& v)
+{
+    return std::sqrt(InnerProduct(v, v));
+}
+
+inline PVector3 PVector3::Normalize(const PVector3& v)
+{
+    return Rsqrt(InnerProduct(v, v)) * v;
+}
+
+constexpr PVector3 PVector3::Min(const PVector3& a, const PVector3& b)
+{
+    return { (b.x < a.x) ? b.x : a.x, (b.y < a.y) ? b.y : a.y, (b.z < a.z) ? b.z : a.z };
+}
+
+constexpr PVector3 PVector3::Max(const PVector3& a, const PVector3& b)
+{
+    return { (a.x < b.x) ? b.x : a.x, (a.y < b.y) ? b.y : a.y, (a.z < b.z) ? b.z : a.z };
+}
 
 std::ostream& operator<<(std::ostream& cout, const PVector3& v);
 
+// Double precision counterpart of PVector3, for state that takes many small increments (see precision.h)
+struct DVector3
+{
+    union
+    {
+        struct
+        {
+            double x;
+            double y;
+            double z;
+        };
+        double data[3];
+    };
+
+    static constexpr DVector3 FromFloat(const PVector3& v);
+    constexpr PVector3 toFloat() const;
 
-struct PVector4
+    constexpr DVector3& operator+=(const DVector3& a);
+};
+
+static_assert(sizeof(DVector3) == 3 * sizeof(double));
+
+constexpr DVector3 DVector3::FromFloat(const PVector3& v)
+{
+    return { static_cast<double>(v.x), static_cast<double>(v.y), static_cast<double>(v.z) };
+}
+
+constexpr PVector3 DVector3::toFloat() const
+{
+    return { static_cast<float>(x), static_cast<float>(y), static_cast<float>(z) };
+}
+
+constexpr DVector3& DVector3::operator+=(const DVector3& a)
+{
+    x += a.x;
+    y += a.y;
+    z += a.z;
+    return *this;
+}
+
+constexpr DVector3 operator*(double s, const DVector3& v)
+{
+    return DVector3 { s * v.x, s * v.y, s * v.z };
+}
+
+constexpr DVector3 operator/(const DVector3& v, double s)
+{
+    return DVector3 { v.x / s, v.y / s, v.z / s };
+}
+
+constexpr DVector3 operator+(const DVector3& a, const DVector3& b)
+{
+    return {a.x + b.x, a.y + b.y, a.z + b.z};
+}
+
+constexpr DVector3 operator-(const DVector3& a, const DVector3& b)
+{
+    return {a.x - b.x, a.y - b.y, a.z - b.z};
+}
+
+std::ostream& operator<<(std::ostream& cout, const DVector3& v);
+
+// Aligned so a load is one SSE register, also the rows of PMatrix4 and the view planes
+struct alignas(16) PVector4
 {
     union
     {
@@ -46,20 +212,71 @@ struct PVector4
         };
         float data[4];
     };
-    
-    static float DistanceSqr(const PVector4& a, const PVector4& b);
+
+    static constexpr float DistanceSqr(const PVector4& a, const PVector4& b);
     static float Distance(const PVector4& a, const PVector4& b);
-    static float InnerProduct(const PVector4& a, const PVector4& b);
+    static constexpr float InnerProduct(const PVector4& a, const PVector4& b);
     static float Magnitude(const PVector4& v);
     static PVector4 Normalize(const PVector4& v);
 
-    PVector4& operator+=(const PVector4& a);
+    constexpr PVector4& operator+=(const PVector4& a);
 };
 
-PVector4 operator*(float s, const PVector4& v);
-PVector4 operator/(const PVector4& v, float s);
-PVector4 operator+(const PVector4& a, const PVector4& b);
-PVector4 operator-(const PVector4& a, const PVector4& b);
+static_assert(sizeof(PVector4) == 4 * sizeof(float));
+
+constexpr PVector4 operator*(float s, const PVector4& v)
+{
+    return PVector4 { s * v.x, s * v.y, s * v.z, s * v.w };
+}
+
+constexpr PVector4 operator/(const PVector4& v, float s)
+{
+    return PVector4 { v.x / s, v.y / s, v.z / s, v.w / s };
+}
+
+constexpr PVector4 operator+(const PVector4& a, const PVector4& b)
+{
+    return {a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w};
+}
+
+constexpr PVector4 operator-(const PVector4& a, const PVector4& b)
+{
+    return {a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w};
+}
+
+constexpr PVector4& PVector4::operator+=(const PVector4& a)
+{
+    x += a.x;
+    y += a.y;
+    z += a.z;
+    w += a.w;
+    return *this;
+}
+
+constexpr float PVector4::DistanceSqr(const PVector4& a, const PVector4& b)
+{
+    return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z) + (a.w - b.w) * (a.w - b.w);
+}
+
+inline float PVector4::Distance(const PVector4& a, const PVector4& b)
+{
+    return std::sqrt(DistanceSqr(a, b));
+}
+
+constexpr float PVector4::InnerProduct(const PVector4& a, const PVector4& b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
+}
+
+inline float PVector4::Magnitude(const PVector4& v)
+{
+    return std::sqrt(InnerProduct(v, v));
+}
+
+inline PVector4 PVector4::Normalize(const PVector4& v)
+{
+    return Rsqrt(InnerProduct(v, v)) * v;
+}
 
 std::ostream& operator<<(std::ostream& cout, const PVector4& v);
 
@@ -84,12 +301,63 @@ struct PMatrix4
     static PMatrix4 Rotate(float angle, const PVector3& axis);
     static PMatrix4 Perspective(float fovRad, float aspect, float near, float far);
     static PMatrix4 LookAt(const PVector3& eye, const PVector3& center, const PVector3& up = PVector3{0.0f, 1.0f, 0.0f});
+    static PMatrix4 Inverse(const PMatrix4& m);
 
 };
 
-PMatrix4 operator*(float s, const PMatrix4& v);
-PMatrix4 operator*(const PMatrix4& a, const PMatrix4& b);
-PVector4 operator*(const PMatrix4& a, const PVector4& b);
+inline PVector4 PMatrix4::getRow(int i) const
+{
+    return PVector4 { data[0][i], data[1][i], data[2][i], data[3][i] };
+}
+
+inline PMatrix4 PMatrix4::Identity()
+{
+    PMatrix4 mat;
+    for(int i = 0; i < 4; i++)
+    {
+        for(int j = 0; j < 4; j++)
+        {
+            mat.data[i][j] = (i == j) ? 1.0f : 0.0f;
+        }
+    }
+    return mat;
+}
+
+inline PMatrix4 operator*(float s, const PMatrix4& v)
+{
+    return PMatrix4 { s * v.r0, s * v.r1, s * v.r2, s * v.r3 };
+}
+
+inline PMatrix4 operator*(const PMatrix4& a, const PMatrix4& b)
+{
+    PMatrix4 result;
+    for(int i = 0; i < 4; i++)
+    {
+        for(int j = 0; j < 4; j++)
+        {
+            result.data[i][j] = 0.0f;
+            for(int k = 0; k < 4; k++)
+            {
+                result.data[i][j] += a.data[k][j] * b.data[i][k];
+            }
+        }
+    }
+    return result;
+}
+
+inline PVector4 operator*(const PMatrix4& a, const PVector4& b)
+{
+    PVector4 result;
+    for(int i = 0; i < 4; i++)
+    {
+        result.data[i] = 0.0f;
+        for(int j = 0; j < 4; j++)
+        {
+            result.data[i] += a.data[j][i] * b.data[j];
+        }
+    }
+    return result;
+}
 
 std::ostream& operator<<(std::ostream& cout, const PMatrix4& v);
 
@@ -108,4 +376,47 @@ struct UVector4
     };
 };
 
-float PRadians(float degrees);
+constexpr float PRadians(float degrees)
+{
+    constexpr float A2R = 3.141592654f / 180;
+    return degrees * A2R;
+}
+
+// Batch operations over flat arrays, written as plain loops so the compiler vectorizes them where they inline
+
+// y += a * x
+inline void BatchAxpy(float* y, const float* x, float a, std::size_t count)
+{
+    for(std::size_t i = 0; i < count; i++)
+    {
+        y[i] += a * x[i];
+    }
+}
+
+// y += a * x with a double accumulator, for the mixed precision state
+inline void BatchAxpy(double* y, const float* x, double a, std::size_t count)
+{
+    for(std::size_t i = 0; i < count; i++)
+    {
+        y[i] += a * static_cast<double>(x[i]);
+    }
+}
+
+// y = x rounded to float
+inline void BatchRound(float* y, const double* x, std::size_t count)
+{
+    for(std::size_t i = 0; i < count; i++)
+    {
+        y[i] = static_cast<float>(x[i]);
+    }
+}
+
+// Bounding box of count points, min and max are only grown
+inline void BatchBounds(const PVector3* points, std::size_t count, PVector3& min, PVector3& max)
+{
+    for(std::size_t i = 0; i < count; i++)
+    {
+        min = PVector3::Min(min, points[i]);
+        max = PVector3::Max(max, points[i]);
+    }
+}
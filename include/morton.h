@@ -0,0 +1,10 @@
+#pragma once
+#include <vector>
+
+#include "math.h"
+
+// 63 bit Morton (Z-order) keys, 21 bits per axis, of points quantized inside [min, max]
+void ComputeMortonKeys(const PVector3* points, std::size_t count, const PVector3& min, const PVector3& max, unsigned long long* keys);
+
+// Indices that visit points in Morton order
+std::vector<std::size_t> SortByMortonKey(const std::vector<PVector3>& points);
@@ -0,0 +1,181 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <glad/gl.h>
+#include <glfw3.h>
+
+#include "camera.h"
+#include "draw.h"
+#include "splat.h"
+#include "threadpool.h"
+
+// GL 4.5 context without a visible window, for rendering headless runs
+// Tries a hidden window on the native platform first, then no platform at all with EGL and finally OSMesa (software GL)
+class OffscreenContext
+{
+public:
+    OffscreenContext();
+    OffscreenContext(const OffscreenContext&) = delete;
+    OffscreenContext(OffscreenContext&&) = delete;
+    ~OffscreenContext();
+
+    bool isOK() const;
+    const char* getBackend() const;
+
+private:
+    bool tryCreate(int platform, int api);
+
+private:
+    GLFWwindow* window = nullptr;
+    const char* backend = "none";
+};
+
+// Encodes frames (RGBA rows, bottom up) to numbered image files on a small worker pool
+// At most WRITER_MAX_QUEUED frames wait for an encoder, past that submitting blocks so a slow disk holds the producer back
+class FrameWriter
+{
+public:
+    enum class Format
+    {
+        PNG,
+        RAW // Headerless rgb24
+    };
+
+    FrameWriter(const std::string& directory, int width, int height, Format format, std::size_t encoderThreads = WRITER_ENCODER_THREADS);
+    FrameWriter(const FrameWriter&) = delete;
+    FrameWriter(FrameWriter&&) = delete;
+    ~FrameWriter();
+
+    bool isOK() const;
+
+    // Buffer of width * height * 4 bytes to fill and submit, recycled once its frame is written
+    std::shared_ptr<std::vector<unsigned char>> takeBuffer();
+    // Written as frame_<frame>.<ext>
+    void submit(std::shared_ptr<std::vector<unsigned char>> pixels, unsigned long long frame);
+    void write(const unsigned char* rgba, unsigned long long frame);
+    // Waits for the encoders
+    void finish();
+
+    int getWidth() const;
+    int getHeight() const;
+    unsigned long long getWrittenFrames() const;
+    unsigned long long getFailedFrames() const;
+    unsigned long long getStalls() const; // Submits that had to wait for an encoder
+    void countFailure();
+
+    static const char* GetFormatName(Format format);
+    static bool ParseFormat(const std::string& name, Format& format);
+
+    static constexpr std::size_t WRITER_ENCODER_THREADS = 2;
+    static constexpr std::size_t WRITER_MAX_QUEUED = 8;
+
+private:
+    void encode(std::shared_ptr<std::vector<unsigned char>> pixels, unsigned long long frame);
+
+private:
+    std::string directory;
+    int width;
+    int height;
+    Format format;
+    bool ok = false;
+    ThreadPool encoders;
+    std::vector<std::future<void>> encoding;
+    std::mutex bufferMutex;
+    std::vector<std::shared_ptr<std::vector<unsigned char>>> freeBuffers;
+    std::atomic<unsigned long long> written = 0;
+    std::atomic<unsigned long long> failed = 0;
+    unsigned long long stalls = 0;
+};
+
+// Renders into its own framebuffer and reads frames back through a ring of pixel buffers
+// A frame is mapped once its transfer is done (at the latest RECORDER_PBO_COUNT captures later) and handed to a
+// FrameWriter, so the GPU transfer, the encoding and the simulation overlap
+class FrameRecorder
+{
+public:
+    FrameRecorder(const std::string& directory, int width, int height, FrameWriter::Format format);
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder(FrameRecorder&&) = delete;
+    ~FrameRecorder();
+
+    bool isOK() const;
+
+    // Render target for the next capture
+    void bind();
+    // Queues a readback of what was rendered since bind
+    void capture(unsigned long long frame);
+    // Reads back every queued frame and waits for the encoders
+    void finish();
+
+    FrameWriter* getWriter();
+    unsigned long long getStalls() const; // Captures that had to wait for a transfer
+
+    static constexpr std::size_t RECORDER_PBO_COUNT = 3;
+
+private:
+    struct Slot
+    {
+        GLuint buffer = 0;
+        GLsync fence = nullptr;
+        unsigned long long frame = 0;
+    };
+
+    // Hands the oldest queued readback to the writer, false if block is off and it isn't done yet
+    bool collect(bool block);
+
+private:
+    FrameWriter writer;
+    int width;
+    int height;
+    bool ok = false;
+    GLuint framebuffer = 0;
+    GLuint colorBuffer = 0;
+    GLuint depthBuffer = 0;
+    std::array<Slot, RECORDER_PBO_COUNT> slots;
+    std::size_t head = 0;
+    std::size_t queued = 0;
+    unsigned long long stalls = 0;
+};
+
+// Headless counterpart of RenderWindow, draws the bodies from the viewer's initial view into numbered image files
+// Billboards go through an offscreen GL context and a FrameRecorder, density splats need no GL at all
+// Members are declared so the GL objects go before the context that owns them
+class OffscreenRenderer
+{
+public:
+    enum class Mode
+    {
+        BILLBOARDS,
+        SPLAT
+    };
+
+    OffscreenRenderer(const std::string& directory, int width, int height, FrameWriter::Format format, Mode mode = Mode::BILLBOARDS);
+    OffscreenRenderer(const OffscreenRenderer&) = delete;
+    OffscreenRenderer(OffscreenRenderer&&) = delete;
+    ~OffscreenRenderer() = default;
+
+    bool isOK() const;
+    void render(const std::vector<PVector3>* positions, const std::vector<UVector4>* colors, unsigned long long frame);
+    void finish();
+    FrameWriter* getWriter();
+    unsigned long long getStalls() const; // Readback and encoder waits together
+
+    static const char* GetModeName(Mode mode);
+    static bool ParseMode(const std::string& name, Mode& mode);
+
+    static constexpr float OFFSCREEN_PARTICLE_SCALE = 5.0f;
+
+private:
+    std::unique_ptr<OffscreenContext> context;
+    std::unique_ptr<GenShader> shader;
+    std::unique_ptr<InstanceState> instances;
+    std::unique_ptr<FrameRecorder> recorder;
+    std::unique_ptr<DensitySplatter> splatter;
+    std::unique_ptr<FrameWriter> writer;
+    Camera camera;
+};
@@ -0,0 +1,34 @@
+#pragma once
+#include "math.h"
+
+// Precision of the state that accumulates over a run, chosen at build time with the STARWELL_MIXED_PRECISION option
+// Mixed keeps body positions and the tree's mass weighted sums in double while everything else, the force walks
+// included, stays in float on positions rounded from the double ones every step
+#ifdef STARWELL_MIXED_PRECISION
+using StateScalar = double;
+using StateVector3 = DVector3;
+#else
+using StateScalar = float;
+using StateVector3 = PVector3;
+#endif
+
+inline constexpr bool MIXED_PRECISION = sizeof(StateScalar) > sizeof(float);
+
+inline PVector3 ToFloat(const PVector3& v)
+{
+    return v;
+}
+
+inline PVector3 ToFloat(const DVector3& v)
+{
+    return v.toFloat();
+}
+
+inline StateVector3 ToState(const PVector3& v)
+{
+#ifdef STARWELL_MIXED_PRECISION
+    return DVector3::FromFloat(v);
+#else
+    return v;
+#endif
+}
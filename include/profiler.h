@@ -0,0 +1,113 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped phase timers with a rolling per phase breakdown and Chrome/Perfetto trace export
+// Scopes only exist when built with STARWELL_PROFILING, otherwise the macros expand to nothing
+#ifdef STARWELL_PROFILING
+#define STARWELL_PROFILE_CONCAT_(a, b) a##b
+#define STARWELL_PROFILE_CONCAT(a, b) STARWELL_PROFILE_CONCAT_(a, b)
+#define PROFILE_SCOPE(name) ProfileScope STARWELL_PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_THREAD(name) Profiler::Global().setThreadName(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_THREAD(name) ((void)sizeof(name))
+#endif
+
+// Times are nanoseconds since the profiler was created
+struct ProfileEvent
+{
+    const char* name;
+    std::int64_t start;
+    std::int64_t duration;
+};
+
+struct ProfilePhase
+{
+    const char* name = nullptr;
+    float last = 0.0f;
+    float average = 0.0f;
+    std::vector<float> history; // ms per frame
+};
+
+class Profiler
+{
+public:
+    Profiler(const Profiler&) = delete;
+    Profiler(Profiler&&) = delete;
+    ~Profiler() = default;
+
+    static Profiler& Global();
+    static std::int64_t Now();
+
+    // Names must outlive the profiler (string literals)
+    void record(const char* name, std::int64_t start, std::int64_t end);
+    void setThreadName(const std::string& name);
+
+    // Closes a frame on the calling thread, only scopes of that thread go into the breakdown
+    void endFrame();
+    const std::vector<ProfilePhase>& getPhases() const;
+    const std::vector<float>& getFrameHistory() const;
+    float getFrameAverage() const;
+
+    // Events of every thread are kept while capturing, up to PROFILER_MAX_EVENTS per thread
+    void startCapture();
+    void stopCapture();
+    bool isCapturing() const;
+    std::size_t getCapturedEventCount();
+    bool exportTrace(const std::string& path);
+
+#ifdef STARWELL_PROFILING
+    static constexpr bool PROFILER_ENABLED = true;
+#else
+    static constexpr bool PROFILER_ENABLED = false;
+#endif
+    static constexpr std::size_t PROFILER_HISTORY_SIZE = 240;
+    static constexpr std::size_t PROFILER_MAX_EVENTS = 1 << 20;
+
+private:
+    Profiler();
+
+    struct ThreadTrace
+    {
+        int id;
+        std::string name;
+        bool frameThread = false;
+        std::vector<std::pair<const char*, std::int64_t>> frameTotals; // Owner thread only
+        std::mutex mutex;
+        std::vector<ProfileEvent> events;
+        std::size_t dropped = 0;
+    };
+
+    ThreadTrace* getThreadTrace();
+
+private:
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadTrace>> threads;
+    std::atomic<bool> capturing = false;
+    std::vector<ProfilePhase> phases;
+    std::vector<float> frameHistory;
+    float frameAverage = 0.0f;
+    std::int64_t lastFrameEnd = 0;
+};
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* name) : name(name), start(Profiler::Now()) {}
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope(ProfileScope&&) = delete;
+    ~ProfileScope()
+    {
+        Profiler::Global().record(name, start, Profiler::Now());
+    }
+
+private:
+    const char* name;
+    std::int64_t start;
+};
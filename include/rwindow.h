@@ -5,12 +5,21 @@
 #include <backends/imgui_impl_opengl3.h>
 #include <glad/gl.h>
 #include <glfw3.h>
+#include <optional>
 #include <vector>
 
 #include "math.h"
+#include "bhtree.h"
+#include "analysis.h"
 #include "camera.h"
+#include "cost.h"
+#include "diagnostics.h"
 #include "draw.h"
+#include "lod.h"
 #include "scene.h"
+#include "snapshot.h"
+#include "splat.h"
+#include "stream.h"
 #include "windows/window.h"
 
 class RenderWindow
@@ -32,8 +41,44 @@ public:
     void removeScrollCallback(int id);
     void runScrollCallbacks(double yoff);
 
+    bool openReplay(const std::string& path);
+    void closeReplay();
+    bool replayActive() const;
+    SnapshotReplay* getReplay();
+
+    bool attachStream(const std::string& name, const std::string& controlPath = "");
+    void detachStream();
+    bool streamActive() const;
+    StreamSubscriber* getStream();
+    ControlClient* getControl();
+
+    // Click to select, the click is stored until the caller has a built tree to cast it against
+    void requestPick();
+    bool hasPendingPick() const;
+    void resolvePick(const Camera& camera, const BHTree& tree, float radius);
+    std::optional<int> takePickedBody();
+
+    // Level of detail is selected from a built tree right before render, like picking
+    bool lodActive() const;
+    void selectLOD(const Camera& camera, const BHTree& tree, float spriteRadius);
+
+    AnalysisPipeline* getAnalysis();
+    ConservationMonitor* getConservation();
+    BHTreeStats* getTreeStats();
+    CostMap* getCostMap();
+    LevelOfDetail* getLevelOfDetail();
+    DensitySplatter* getSplatter();
+
+    // True when the displayed bodies do not come from the local simulation
+    bool externalSourceActive() const;
+
 private:
     void registerWindows();
+    void uploadInstances(InstanceState& pstate, float dt);
+    void drawCostCells(const Camera& camera, GenShader& shader);
+    void drawSplat(const Camera& camera, GenShader& shader);
+    // Bodies on screen this frame, from the replay, the stream or the local simulation
+    std::size_t getSourceBodies(const PVector3*& positions, const UVector4*& colors);
 
 private:
     bool glfwOK;
@@ -42,5 +87,26 @@ private:
     int height;
     std::vector<std::unique_ptr<GenWindow>> windows;
     std::vector<std::function<void(double)>> scrollCallbacks;
+    SnapshotReplay replay;
+    StreamSubscriber stream;
+    ControlClient control;
+    AnalysisPipeline analysis;
+    ConservationMonitor conservation;
+    BHTreeStats treeStats;
+    CostMap costMap;
+    LevelOfDetail lod;
+    DensitySplatter splatter;
+    std::unique_ptr<ImageState> splatImage;
+    std::unique_ptr<LineState> costCells;
+    std::vector<LineVertex> costCellVertices;
+    unsigned long long costCellsVersion = 0;
+    unsigned long long uploadedCostColors = 0;
+    unsigned long long uploadedStreamColors = 0;
+    unsigned long long uploadedLODColors = 0;
+    double lastFrameTime = 0.0;
+    bool pendingPick = false;
+    float pickX = 0.0f;
+    float pickY = 0.0f;
+    std::optional<int> pickedBody;
 };
 
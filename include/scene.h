@@ -1,4 +1,5 @@
 #pragma once
+#include <map>
 #include <pybind11/embed.h>
 
 #include "math.h"
@@ -7,7 +8,7 @@
 class PythonScene
 {
 public:
-    explicit PythonScene(const std::string& name);
+    explicit PythonScene(const std::string& name, const std::map<std::string, double>& parameters = {});
     ~PythonScene() = default;
     void reload();
 
@@ -19,6 +20,7 @@ private:
 
 private:
     std::string name;
+    std::map<std::string, double> parameters;
     pybind11::module_ module;
     std::vector<Body> bodies;
 };
@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <vector>
+
+#include "body.h"
+#include "bhtree.h"
+#include "cost.h"
+#include "diagnostics.h"
+#include "direct.h"
+
+class Simulation
+{
+public:
+    enum class Engine
+    {
+        AUTO,   // Direct below SIMULATION_DIRECT_THRESHOLD bodies, tree above
+        TREE,
+        DIRECT
+    };
+
+    // What happens to bodies far outside the rest, which would otherwise stretch the tree around them
+    enum class EscaperPolicy
+    {
+        KEEP,     // In the tree like any other body
+        MONOPOLE, // Out of the tree, they see it as one mass and it sees them as a uniform field
+        REMOVE    // Deleted from the simulation, the pools are compacted
+    };
+
+    explicit Simulation(std::vector<Body>* bodies);
+    Simulation(const Simulation&) = delete;
+    Simulation(Simulation&&) = delete;
+    ~Simulation() = default;
+
+    // The tree stays built between these two so it can be used in between (e.g. rendering)
+    void buildTree();
+    void integrate(float thr);
+    void step(float thr);
+
+    // Due steps of integrate also fill the monitor, nullptr to disable
+    void setMonitor(ConservationMonitor* monitor);
+
+    // Receives the statistics of every tree right before it is reset, nullptr to disable
+    void setTreeStats(BHTreeStats* treeStats);
+
+    // Tree walks record their cost into the map while it is enabled, nullptr to disable
+    void setCostMap(CostMap* costMap);
+
+    // A body escapes once it is further than escapeFactor times the radius holding SIMULATION_ESCAPER_QUANTILE of
+    // the bodies from their center of mass
+    void setEscaperPolicy(EscaperPolicy policy, float escapeFactor = SIMULATION_DEFAULT_ESCAPE_FACTOR);
+    EscaperPolicy getEscaperPolicy() const;
+    std::size_t getEscaperCount() const;
+    unsigned long long getRemovedBodies() const; // Removed since the start, the body count changed when this did
+    static const char* GetEscaperPolicyName(EscaperPolicy policy);
+    static bool ParseEscaperPolicy(const std::string& name, EscaperPolicy& policy);
+
+    // Taken by both engines, the walks are dispatched on it once per step
+    void setForceLaw(const ForceLaw& law);
+    const ForceLaw& getForceLaw() const;
+
+    void setEngine(Engine engine);
+    Engine getEngine() const;
+    Engine getActiveEngine() const;
+    static const char* GetEngineName(Engine engine);
+    static bool ParseEngine(const std::string& name, Engine& engine);
+
+    // Builds the tree if this step has not yet (the direct engine skips it)
+    BHTree* getTree();
+    void resetTree();
+    unsigned long long getStep() const;
+
+    // Below this a tiled direct sum beats building the tree
+    static constexpr std::size_t SIMULATION_DIRECT_THRESHOLD = 20'000;
+    static constexpr float SIMULATION_ESCAPER_QUANTILE = 0.9f;
+    static constexpr float SIMULATION_DEFAULT_ESCAPE_FACTOR = 10.0f;
+
+private:
+    void ensureTree();
+    // Flags the escapers of this step, removing them right away under EscaperPolicy::REMOVE
+    void findEscapers();
+    // Fill field for every body, returning the potential energy when diagnostics are on
+    double walkTree(float thr, bool diagnostics);
+    double walkDirect(bool diagnostics);
+
+private:
+    std::vector<Body>* bodies;
+    BHTree tree;
+    bool treeBuilt = false;
+    Engine engine = Engine::AUTO;
+    ForceLaw forceLaw;
+    std::vector<PVector3> field;
+    DirectSummation direct;
+    std::vector<PVector3> directPoints;
+    std::vector<float> directPotential;
+    ConservationMonitor* monitor = nullptr;
+    BHTreeStats* treeStats = nullptr;
+    CostMap* costMap = nullptr;
+    unsigned long long stepCount = 0;
+    EscaperPolicy escaperPolicy = EscaperPolicy::KEEP;
+    float escapeFactor = SIMULATION_DEFAULT_ESCAPE_FACTOR;
+    std::vector<unsigned char> escaping; // By position in bodies, empty when nobody escapes
+    std::vector<std::size_t> escapers;
+    std::vector<float> distances;
+    unsigned long long removedBodies = 0;
+};
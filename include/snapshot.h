@@ -0,0 +1,102 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "math.h"
+
+// Snapshot file layout (native endianness):
+//   SnapshotHeader | UVector4 colors[bodyCount] | PVector3 positions[frameCount][bodyCount]
+// Colors are static so they are only stored once per file
+struct SnapshotHeader
+{
+    char magic[8];
+    unsigned long long version;
+    unsigned long long bodyCount;
+    unsigned long long frameCount;
+
+    static constexpr char SNAPSHOT_MAGIC[8] = { 'S', 'W', 'S', 'N', 'A', 'P', '\0', '\0' };
+    static constexpr unsigned long long SNAPSHOT_VERSION = 1;
+    static constexpr const char* SNAPSHOT_EXTENSION = ".sws";
+};
+
+class SnapshotWriter
+{
+public:
+    SnapshotWriter(const std::string& path, const std::vector<UVector4>* colors);
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter(SnapshotWriter&&) = delete;
+    ~SnapshotWriter();
+
+    bool isOpen() const;
+    void write(const std::vector<PVector3>* positions);
+    unsigned long long getFrameCount() const;
+    const std::string& getPath() const;
+
+private:
+    std::string path;
+    std::ofstream output;
+    SnapshotHeader header;
+};
+
+class SnapshotReplay
+{
+public:
+    SnapshotReplay();
+    SnapshotReplay(const SnapshotReplay&) = delete;
+    SnapshotReplay(SnapshotReplay&&) = delete;
+    ~SnapshotReplay();
+
+    // Path can be a single snapshot file or a directory of them (played in name order)
+    bool open(const std::string& path);
+    void close();
+    bool isOpen() const;
+
+    // Advance the playhead if playing and hint the prefetcher
+    void update(float dt);
+    void seek(std::size_t frame);
+
+    const PVector3* getFrame(std::size_t frame) const;
+    const UVector4* getColors() const;
+    std::size_t getFrameCount() const;
+    std::size_t getBodyCount() const;
+    std::size_t getCurrentFrame() const;
+
+    bool playing = false;
+    bool loop = true;
+    float framesPerSecond = 30.0f;
+
+private:
+    struct MappedFile
+    {
+        void* data;
+        std::size_t size;
+    };
+
+    bool mapFile(const std::string& file);
+    void unmapAll();
+    void requestPrefetch(std::size_t frame);
+    void prefetchWorker();
+    void touchFrame(std::size_t frame) const;
+
+private:
+    std::vector<MappedFile> files;
+    std::vector<const PVector3*> frames;
+    const UVector4* colors = nullptr;
+    std::size_t bodyCount = 0;
+    std::size_t currentFrame = 0;
+    float frameAccumulator = 0.0f;
+
+    std::mutex mapMutex;
+    std::thread prefetchThread;
+    std::mutex prefetchMutex;
+    std::condition_variable prefetchCv;
+    std::size_t prefetchTarget = 0;
+    std::size_t prefetchDone = 0;
+    bool prefetchStop = false;
+    static constexpr std::size_t PREFETCH_FRAMES = 16;
+};
@@ -0,0 +1,55 @@
+#pragma once
+#include <vector>
+
+#include "math.h"
+#include "threadpool.h"
+
+// CPU renderer that accumulates the colour of every body into a pixel grid, for counts billboards can't keep up with
+// Bodies are projected with the camera matrix and splatted bilinearly, each worker into its own grid, the grids are
+// summed and tone mapped at the end so the per body work is one projection and four adds
+class DensitySplatter
+{
+public:
+    enum class ToneMap
+    {
+        ASINH, // Linear for faint pixels, logarithmic for bright ones
+        LOG
+    };
+
+    DensitySplatter() = default;
+    DensitySplatter(const DensitySplatter&) = delete;
+    DensitySplatter(DensitySplatter&&) = delete;
+    ~DensitySplatter() = default;
+
+    // Image rows go bottom up like a GL texture, colours are weighted by their alpha
+    void render(const PVector3* positions, const UVector4* colors, std::size_t count, const PMatrix4& viewProjection, int width, int height, ThreadPool* pool = &ThreadPool::Global());
+
+    const std::vector<UVector4>& getImage() const;
+    int getWidth() const;
+    int getHeight() const;
+    unsigned long long getVersion() const; // Bumped by every render
+    std::size_t getGridCount() const;      // Accumulation grids used by the last render
+    float getPeak() const;                 // Brightest accumulated pixel, the top of the tone curve
+
+    static const char* GetToneMapName(ToneMap toneMap);
+
+    bool enabled = false;
+    ToneMap toneMap = ToneMap::ASINH;
+    float exposure = 1.0f; // Stretch of the tone curve, higher brings out faint regions
+
+    static constexpr std::size_t SPLAT_BLOCK = 256;                    // Bodies projected together before scattering
+    static constexpr std::size_t SPLAT_MIN_BODIES_PER_GRID = 1 << 16;  // Fewer and a private grid costs more to clear and merge than it saves
+    static constexpr std::size_t SPLAT_GRID_BUDGET = 256ull << 20;     // Bytes for all the accumulation grids together
+
+private:
+    void accumulate(const PVector3* positions, const UVector4* colors, std::size_t count, const PMatrix4& viewProjection, float* grid) const;
+
+private:
+    std::vector<std::vector<float>> grids; // RGB per pixel
+    std::vector<UVector4> image;
+    int width = 0;
+    int height = 0;
+    std::size_t gridCount = 0;
+    float peak = 0.0f;
+    unsigned long long version = 0;
+};
@@ -0,0 +1,131 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "math.h"
+
+// Shared memory layout:
+//   StreamHeader | UVector4 colors[maxBodies] | (StreamSlot | PVector3 positions[maxBodies])[slotCount]
+// Each slot is a seqlock: odd sequence while the publisher writes, even once the frame is complete.
+// The publisher never waits on readers, a reader that gets overwritten mid copy just retries
+struct StreamSlot
+{
+    std::atomic<unsigned long long> sequence;
+    unsigned long long bodyCount;
+    unsigned long long step;
+    unsigned long long padding;
+};
+
+struct StreamHeader
+{
+    char magic[8];
+    unsigned long long maxBodies;
+    unsigned long long slotCount;
+    std::atomic<unsigned long long> latest;       // Number of frames published so far
+    std::atomic<unsigned long long> colorVersion; // Bumped every time colors change
+
+    static constexpr char STREAM_MAGIC[8] = { 'S', 'W', 'S', 'T', 'R', 'M', '\0', '\0' };
+};
+
+static_assert(std::atomic<unsigned long long>::is_always_lock_free, "Shared memory streaming requires lock-free 64-bit atomics.");
+
+class StreamPublisher
+{
+public:
+    StreamPublisher(const std::string& name, std::size_t maxBodies, std::size_t slotCount = 4);
+    StreamPublisher(const StreamPublisher&) = delete;
+    StreamPublisher(StreamPublisher&&) = delete;
+    ~StreamPublisher();
+
+    bool isOpen() const;
+    void publish(const std::vector<PVector3>* positions, unsigned long long step);
+    void publishColors(const std::vector<UVector4>* colors);
+
+private:
+    std::string name;
+    void* data;
+    std::size_t size;
+};
+
+class StreamSubscriber
+{
+public:
+    StreamSubscriber();
+    StreamSubscriber(const StreamSubscriber&) = delete;
+    StreamSubscriber(StreamSubscriber&&) = delete;
+    ~StreamSubscriber();
+
+    bool attach(const std::string& name);
+    void detach();
+    bool isAttached() const;
+
+    // Copy the most recent complete frame, returns false if there is nothing new
+    bool acquireLatest();
+    const std::vector<PVector3>* getPositions() const;
+    const std::vector<UVector4>* getColors() const;
+    unsigned long long getColorVersion() const; // Changes whenever new colours were copied in
+    unsigned long long getStep() const;
+
+private:
+    void* data;
+    std::size_t size;
+    unsigned long long lastFrame;
+    unsigned long long lastColorVersion;
+    unsigned long long step;
+    std::vector<PVector3> positions;
+    std::vector<UVector4> colors;
+    static constexpr int STREAM_MAX_RETRIES = 8;
+};
+
+// Local control channel (unix datagram socket) from the viewer to the simulation
+struct ControlMessage
+{
+    enum class Type : unsigned int
+    {
+        PAUSE,
+        RESUME,
+        STEP,
+        SET_PARAMETER
+    };
+
+    Type type;
+    char parameter[32];
+    double value;
+};
+
+class ControlServer
+{
+public:
+    explicit ControlServer(const std::string& path);
+    ControlServer(const ControlServer&) = delete;
+    ControlServer(ControlServer&&) = delete;
+    ~ControlServer();
+
+    bool isOpen() const;
+
+    // Non blocking, returns every message received since the last call
+    std::vector<ControlMessage> poll();
+
+private:
+    std::string path;
+    int fd;
+};
+
+class ControlClient
+{
+public:
+    ControlClient();
+    ControlClient(const ControlClient&) = delete;
+    ControlClient(ControlClient&&) = delete;
+    ~ControlClient();
+
+    bool connect(const std::string& path);
+    void disconnect();
+    bool isConnected() const;
+
+    bool send(ControlMessage::Type type, const std::string& parameter = "", double value = 0.0);
+
+private:
+    int fd;
+};
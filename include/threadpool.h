@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(std::size_t threads = std::thread::hardware_concurrency());
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool(ThreadPool&&) = delete;
+    ~ThreadPool();
+
+    std::future<void> submit(std::function<void()> task);
+
+    // Split [begin, end) in chunks of at least grain and run body(chunkBegin, chunkEnd) on them
+    // The caller works on chunks too so this is safe to call from inside a pool task
+    void parallelFor(std::size_t begin, std::size_t end, const std::function<void(std::size_t, std::size_t)>& body, std::size_t grain = 1024);
+
+    std::size_t getThreadCount() const;
+
+    // Process wide pool, size it with ConfigureGlobal before the first use
+    static ThreadPool& Global();
+    static void ConfigureGlobal(std::size_t threads);
+
+private:
+    void worker(std::size_t index);
+
+private:
+    std::vector<std::thread> threads;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool stop = false;
+    static inline std::size_t GlobalThreadCount = 0;
+};
@@ -10,10 +10,24 @@ protected:
     void internalDraw(Camera& camera, InstanceState& pstate, PythonScene& scene, GenShader& shader) override;
 
 private:
-    void drawMetrics(Camera& camera);
-    void drawSceneControl(PythonScene& scene);
+    void drawMetrics(Camera& camera, InstanceState& pstate);
+    void drawProfiler();
+    void drawTreeStats();
+    void drawMemory();
+    void drawCpuPath();
+    void drawCost();
+    void drawLevelOfDetail();
+    void drawSplat();
+    void drawSceneControl(PythonScene& scene, InstanceState& pstate);
     void drawAnalysis(Camera& camera, InstanceState& pstate);
+    void drawProfiles();
+    void drawReplayControl();
+    void drawStreamControl();
 
 private:
     int particleFocus = -1;
+    char replayPath[256] = "snapshot.sws";
+    float streamThreshold = 0.5f;
+    char analysisExportPath[256] = "analysis.csv";
+    char tracePath[256] = "trace.json";
 };
@@ -1,57 +1,57 @@
 import numpy as np
 
 
-def main():
+def main(ring_radius=200, core_radius=100, ring_speed=150, core_speed=50, separation=700, drift=150):
     X = []
     V = []
     C = []
 
     # G1 ring
     for i in range(500):
-        X.append((200*np.sin(i) - 700, 0, 200*np.cos(i)))
-        V.append((150*np.sin(i + np.pi/2), 0, 150*np.cos(i + np.pi/2) + 150))
+        X.append((ring_radius*np.sin(i) - separation, 0, ring_radius*np.cos(i)))
+        V.append((ring_speed*np.sin(i + np.pi/2), 0, ring_speed*np.cos(i + np.pi/2) + drift))
         C.append((255, 0, 0, 255))
 
     # G1 center
     for i in range(1000):
-        X.append((100*np.sin(i) - 700, 0, 100*np.cos(i)))
-        V.append((50*np.sin(i + np.pi/2), 0, 50*np.cos(i + np.pi/2) + 150))
+        X.append((core_radius*np.sin(i) - separation, 0, core_radius*np.cos(i)))
+        V.append((core_speed*np.sin(i + np.pi/2), 0, core_speed*np.cos(i + np.pi/2) + drift))
         C.append((255, 0, 0, 255))
 
     # G2 ring
     for i in range(500):
-        X.append((200*np.sin(i) + 700, 0, 200*np.cos(i)))
-        V.append((150*np.sin(i + np.pi/2), 0, 150*np.cos(i + np.pi/2) - 150))
+        X.append((ring_radius*np.sin(i) + separation, 0, ring_radius*np.cos(i)))
+        V.append((ring_speed*np.sin(i + np.pi/2), 0, ring_speed*np.cos(i + np.pi/2) - drift))
         C.append((0, 255, 0, 255))
 
     # G2 center
     for i in range(1000):
-        X.append((100*np.sin(i) + 700, 0, 100*np.cos(i)))
-        V.append((50*np.sin(i + np.pi/2), 0, 50*np.cos(i + np.pi/2) - 150))
+        X.append((core_radius*np.sin(i) + separation, 0, core_radius*np.cos(i)))
+        V.append((core_speed*np.sin(i + np.pi/2), 0, core_speed*np.cos(i + np.pi/2) - drift))
         C.append((0, 255, 0, 255))
 
     # G3 ring
     for i in range(500):
-        X.append((200*np.sin(i), 0, 200*np.cos(i) - 700))
-        V.append((150*np.sin(i + np.pi/2) - 150, 0, 150*np.cos(i + np.pi/2)))
+        X.append((ring_radius*np.sin(i), 0, ring_radius*np.cos(i) - separation))
+        V.append((ring_speed*np.sin(i + np.pi/2) - drift, 0, ring_speed*np.cos(i + np.pi/2)))
         C.append((0, 0, 255, 255))
 
     # G3 center
     for i in range(1000):
-        X.append((100*np.sin(i), 0, 100*np.cos(i) - 700))
-        V.append((50*np.sin(i + np.pi/2) - 150, 0, 50*np.cos(i + np.pi/2)))
+        X.append((core_radius*np.sin(i), 0, core_radius*np.cos(i) - separation))
+        V.append((core_speed*np.sin(i + np.pi/2) - drift, 0, core_speed*np.cos(i + np.pi/2)))
         C.append((0, 0, 255, 255))
 
     # G4 ring
     for i in range(500):
-        X.append((200*np.sin(i), 0, 200*np.cos(i) + 700))
-        V.append((150*np.sin(i + np.pi/2) + 150, 0, 150*np.cos(i + np.pi/2)))
+        X.append((ring_radius*np.sin(i), 0, ring_radius*np.cos(i) + separation))
+        V.append((ring_speed*np.sin(i + np.pi/2) + drift, 0, ring_speed*np.cos(i + np.pi/2)))
         C.append((255, 255, 0, 255))
 
     # G4 center
     for i in range(1000):
-        X.append((100*np.sin(i), 0, 100*np.cos(i) + 700))
-        V.append((50*np.sin(i + np.pi/2) + 150, 0, 50*np.cos(i + np.pi/2)))
+        X.append((core_radius*np.sin(i), 0, core_radius*np.cos(i) + separation))
+        V.append((core_speed*np.sin(i + np.pi/2) + drift, 0, core_speed*np.cos(i + np.pi/2)))
         C.append((255, 255, 0, 255))
 
     return X, V, C
@@ -0,0 +1,233 @@
+#include "../include/analysis.h"
+#include "../include/threadpool.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <numbers>
+
+AnalysisPipeline::~AnalysisPipeline()
+{
+    wait();
+}
+
+void AnalysisPipeline::wait()
+{
+    if(job.valid())
+    {
+        job.wait();
+    }
+}
+
+void AnalysisPipeline::submit(const std::vector<Body>* bodies, unsigned long long step)
+{
+    if(!enabled || bodies->empty() || (step % std::max(every, 1)) != 0) return;
+
+    // Skip this round if the last job is still running, never stall the caller
+    bool expected = false;
+    if(!busy.compare_exchange_strong(expected, true)) return;
+
+    // Only the copy waits for the caller, split over the pool so it costs N / threads on the caller's thread
+    const std::size_t count = bodies->size();
+    positions.resize(count);
+    velocities.resize(count);
+    masses.resize(count);
+    ThreadPool::Global().parallelFor(0, count, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; i++)
+        {
+            const Body& body = (*bodies)[i];
+            positions[i] = body.getPosition();
+            velocities[i] = body.getVelocity();
+            masses[i] = body.getMass();
+        }
+    }, 16384);
+
+    const CenterMode mode = centerMode;
+    const int body = centerBody;
+    const int binCount = std::max(bins, 1);
+    const float radius = std::max(maxRadius, 1E-6f);
+
+    job = ThreadPool::Global().submit([this, step, mode, body, binCount, radius]() {
+        run(step, mode, body, binCount, radius);
+        busy.store(false, std::memory_order_release);
+    });
+}
+
+AnalysisResult AnalysisPipeline::getLatest() const
+{
+    std::lock_guard<std::mutex> lock(resultMutex);
+    return latest;
+}
+
+bool AnalysisPipeline::hasResult() const
+{
+    std::lock_guard<std::mutex> lock(resultMutex);
+    return resultReady;
+}
+
+void AnalysisPipeline::getHistory(std::vector<float>& dispersion, std::vector<float>& angularMomentum) const
+{
+    std::lock_guard<std::mutex> lock(resultMutex);
+    dispersion = historyDispersion;
+    angularMomentum = historyAngularMomentum;
+}
+
+bool AnalysisPipeline::exportCSV(const std::string& path) const
+{
+    std::ofstream output(path);
+    if(!output)
+    {
+        std::cerr << "Failed to open analysis export '" << path << "'." << std::endl;
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(resultMutex);
+
+    output << "# step " << latest.step << " center " << latest.center.x << " " << latest.center.y << " " << latest.center.z << std::endl;
+    output << "radius,density,radial_velocity,tangential_velocity,enclosed_mass" << std::endl;
+    for(std::size_t i = 0; i < latest.radii.size(); i++)
+    {
+        output << latest.radii[i] << "," << latest.density[i] << "," << latest.radialVelocity[i] << ","
+               << latest.tangentialVelocity[i] << "," << latest.enclosedMass[i] << "\n";
+    }
+
+    output << std::endl << "step,velocity_dispersion,angular_momentum" << std::endl;
+    for(std::size_t i = 0; i < historySteps.size(); i++)
+    {
+        output << historySteps[i] << "," << historyDispersion[i] << "," << historyAngularMomentum[i] << "\n";
+    }
+
+    std::cout << "Analysis exported to '" << path << "'." << std::endl;
+    return true;
+}
+
+void AnalysisPipeline::run(unsigned long long step, CenterMode mode, int body, int binCount, float radius)
+{
+    const std::size_t count = positions.size();
+    ThreadPool& pool = ThreadPool::Global();
+    std::mutex mergeMutex;
+
+    // Pass 1: totals (mass, momentum, second moment of velocity, center of mass)
+    float totalMass = 0.0f;
+    PVector3 weightedPosition = {0.0f, 0.0f, 0.0f};
+    PVector3 momentum = {0.0f, 0.0f, 0.0f};
+    double velocitySqr = 0.0;
+
+    pool.parallelFor(0, count, [&](std::size_t begin, std::size_t end) {
+        float m = 0.0f;
+        PVector3 mr = {0.0f, 0.0f, 0.0f};
+        PVector3 mv = {0.0f, 0.0f, 0.0f};
+        double mv2 = 0.0;
+        for(std::size_t i = begin; i < end; i++)
+        {
+            m += masses[i];
+            mr += masses[i] * positions[i];
+            mv += masses[i] * velocities[i];
+            mv2 += masses[i] * PVector3::InnerProduct(velocities[i], velocities[i]);
+        }
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        totalMass += m;
+        weightedPosition += mr;
+        momentum += mv;
+        velocitySqr += mv2;
+    });
+
+    AnalysisResult result;
+    result.step = step;
+    result.totalMass = totalMass;
+    result.meanVelocity = momentum / totalMass;
+
+    const float variance = static_cast<float>(velocitySqr / totalMass) - PVector3::InnerProduct(result.meanVelocity, result.meanVelocity);
+    result.velocityDispersion = std::sqrt(std::max(variance, 0.0f) / 3.0f);
+
+    switch(mode)
+    {
+        case CenterMode::ORIGIN:
+            result.center = {0.0f, 0.0f, 0.0f};
+            break;
+        case CenterMode::CENTER_OF_MASS:
+            result.center = weightedPosition / totalMass;
+            break;
+        case CenterMode::BODY:
+            result.center = positions[std::clamp<std::size_t>(static_cast<std::size_t>(std::max(body, 0)), 0, count - 1)];
+            break;
+    }
+
+    // Pass 2: shells and angular momentum about the center
+    const std::size_t nbins = static_cast<std::size_t>(binCount);
+    const float binWidth = radius / static_cast<float>(nbins);
+    std::vector<float> shellMass(nbins, 0.0f);
+    std::vector<float> shellRadial(nbins, 0.0f);
+    std::vector<float> shellTangential(nbins, 0.0f);
+    PVector3 angularMomentum = {0.0f, 0.0f, 0.0f};
+
+    pool.parallelFor(0, count, [&](std::size_t begin, std::size_t end) {
+        std::vector<float> m(nbins, 0.0f);
+        std::vector<float> vr(nbins, 0.0f);
+        std::vector<float> vt(nbins, 0.0f);
+        PVector3 l = {0.0f, 0.0f, 0.0f};
+
+        for(std::size_t i = begin; i < end; i++)
+        {
+            const PVector3 r = positions[i] - result.center;
+            const PVector3 v = velocities[i] - result.meanVelocity;
+            l += masses[i] * (r * v);
+
+            const float distance = PVector3::Magnitude(r);
+            const std::size_t bin = static_cast<std::size_t>(distance / binWidth);
+            if(bin >= nbins || distance <= 0.0f) continue;
+
+            const float radial = PVector3::InnerProduct(v, r) / distance;
+            const float tangential = std::sqrt(std::max(PVector3::InnerProduct(v, v) - radial * radial, 0.0f));
+            m[bin] += masses[i];
+            vr[bin] += masses[i] * radial;
+            vt[bin] += masses[i] * tangential;
+        }
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        angularMomentum += l;
+        for(std::size_t b = 0; b < nbins; b++)
+        {
+            shellMass[b] += m[b];
+            shellRadial[b] += vr[b];
+            shellTangential[b] += vt[b];
+        }
+    });
+
+    result.angularMomentum = angularMomentum;
+    result.radii.resize(nbins);
+    result.density.resize(nbins);
+    result.radialVelocity.resize(nbins);
+    result.tangentialVelocity.resize(nbins);
+    result.enclosedMass.resize(nbins);
+
+    float enclosed = 0.0f;
+    for(std::size_t b = 0; b < nbins; b++)
+    {
+        const float inner = b * binWidth;
+        const float outer = (b + 1) * binWidth;
+        const float volume = (4.0f / 3.0f) * std::numbers::pi_v<float> * (outer * outer * outer - inner * inner * inner);
+
+        enclosed += shellMass[b];
+        result.radii[b] = outer;
+        result.density[b] = shellMass[b] / volume;
+        result.radialVelocity[b] = (shellMass[b] > 0.0f) ? shellRadial[b] / shellMass[b] : 0.0f;
+        result.tangentialVelocity[b] = (shellMass[b] > 0.0f) ? shellTangential[b] / shellMass[b] : 0.0f;
+        result.enclosedMass[b] = enclosed;
+    }
+
+    std::lock_guard<std::mutex> lock(resultMutex);
+    latest = std::move(result);
+    resultReady = true;
+
+    historySteps.push_back(step);
+    historyDispersion.push_back(latest.velocityDispersion);
+    historyAngularMomentum.push_back(PVector3::Magnitude(latest.angularMomentum));
+    if(historySteps.size() > ANALYSIS_HISTORY_SIZE)
+    {
+        historySteps.erase(historySteps.begin());
+        historyDispersion.erase(historyDispersion.begin());
+        historyAngularMomentum.erase(historyAngularMomentum.begin());
+    }
+}
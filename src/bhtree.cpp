@@ -1,10 +1,119 @@
 #include "../include/bhtree.h"
+#include "../include/threadpool.h"
+#include "../include/morton.h"
 #include <algorithm>
+#include <bit>
+#include <limits>
+#include <mutex>
+#include <numbers>
+#include <queue>
 
+static bool IsLeaf(const BHNode* node)
+{
+    return std::none_of(node->children.begin(), node->children.end(), [](const BHNode* child) { return child != nullptr; });
+}
+
+// Squared distance from point to the node's body bounds (zero if inside)
+static float BoxDistanceSqr(const PVector3& point, const BHNode* node)
+{
+    float distanceSqr = 0.0f;
+    for(int i = 0; i < 3; i++)
+    {
+        float d = std::max({ node->boundsMin.data[i] - point.data[i], point.data[i] - node->boundsMax.data[i], 0.0f });
+        distanceSqr += d * d;
+    }
+    return distanceSqr;
+}
+
+// Squared distance from point to the farthest corner of the node's body bounds
+static float BoxFarDistanceSqr(const PVector3& point, const BHNode* node)
+{
+    float distanceSqr = 0.0f;
+    for(int i = 0; i < 3; i++)
+    {
+        float d = std::max(std::abs(point.data[i] - node->boundsMin.data[i]), std::abs(point.data[i] - node->boundsMax.data[i]));
+        distanceSqr += d * d;
+    }
+    return distanceSqr;
+}
+
+static bool NeighbourCompare(const BHNeighbour& a, const BHNeighbour& b)
+{
+    return a.distanceSqr < b.distanceSqr;
+}
+
+// Sorts the first count entries of a child visit order by key, an insertion sort since there are at most 8
+static void SortChildOrder(std::array<std::pair<float, const BHNode*>, 8>& order, std::size_t count)
+{
+    for(std::size_t i = 1; i < count; i++)
+    {
+        const std::pair<float, const BHNode*> entry = order[i];
+        std::size_t j = i;
+        for(; j > 0 && entry.first < order[j - 1].first; j--)
+        {
+            order[j] = order[j - 1];
+        }
+        order[j] = entry;
+    }
+}
+
+// Slab test against the node's body bounds grown by radius, enter is clamped to the ray origin
+static bool RayBoxEnter(const PVector3& origin, const PVector3& inverse, float radius, const BHNode* node, float& enter)
+{
+    float tmin = 0.0f;
+    float tmax = std::numeric_limits<float>::max();
+    for(int i = 0; i < 3; i++)
+    {
+        float t0 = (node->boundsMin.data[i] - radius - origin.data[i]) * inverse.data[i];
+        float t1 = (node->boundsMax.data[i] + radius - origin.data[i]) * inverse.data[i];
+        if(t0 > t1) std::swap(t0, t1);
+        tmin = std::max(tmin, t0);
+        tmax = std::min(tmax, t1);
+    }
+    enter = tmin;
+    return tmin <= tmax;
+}
+
+// Any part of the node's body bounds, grown by the view margin, inside every plane
+static bool InFrustum(const BHView& view, const BHNode* node)
+{
+    for(const PVector4& plane : view.planes)
+    {
+        // Corner furthest along the plane normal
+        float d = plane.w;
+        for(int i = 0; i < 3; i++)
+        {
+            d += plane.data[i] * ((plane.data[i] >= 0.0f) ? node->boundsMax.data[i] + view.margin : node->boundsMin.data[i] - view.margin);
+        }
+        if(d < 0.0f) return false;
+    }
+    return true;
+}
+
+// Diagonal of the node's body bounds in pixels, seen from its closest point
+static float ProjectedSize(const BHView& view, const BHNode* node)
+{
+    const float distanceSqr = BoxDistanceSqr(view.eye, node);
+    const float diagonal = PVector3::Distance(node->boundsMin, node->boundsMax);
+    if(distanceSqr <= 0.0f) return std::numeric_limits<float>::max();
+    return diagonal * view.pixelsPerUnit * FastRsqrt(distanceSqr);
+}
+
+
+double BHTreeStats::getMeanLeafDepth() const
+{
+    return (leaves > 0) ? static_cast<double>(leafDepthSum) / leaves : 0.0;
+}
+
+std::size_t BHTreeStats::getBytes() const
+{
+    return nodes * sizeof(BHNode) + listBytes;
+}
 
 BHTree::BHTree()
 {
     root = new BHNode();
+    resetStats();
 }
     
 BHTree::~BHTree()
@@ -17,6 +126,56 @@ void BHTree::reset()
     // HACK: (César) : This is very unefficient
     deleteNodes(root);
     root = new BHNode();
+    resetStats();
+}
+
+void BHTree::computeMoments(ThreadPool* pool)
+{
+    computeNodeMoments(root, 0, pool);
+}
+
+void BHTree::fitRoot(const std::vector<Body>& bodies, const std::vector<unsigned char>* skip, ThreadPool* pool)
+{
+    if(!root->bodies.empty())
+    {
+        std::cerr << "BHTree root can only be fitted while the tree is empty." << std::endl;
+        return;
+    }
+
+    std::mutex mergeMutex;
+    constexpr PVector3 emptyMin = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    constexpr PVector3 emptyMax = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+    PVector3 boundsMin = emptyMin;
+    PVector3 boundsMax = emptyMax;
+    // The shared bounds are only read and written under the lock
+    auto reduce = [&](std::size_t begin, std::size_t end) {
+        PVector3 localMin = emptyMin;
+        PVector3 localMax = emptyMax;
+        for(std::size_t i = begin; i < end; i++)
+        {
+            if(skip && (*skip)[i]) continue;
+            const PVector3 position = bodies[i].getPosition();
+            localMin = PVector3::Min(localMin, position);
+            localMax = PVector3::Max(localMax, position);
+        }
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        boundsMin = PVector3::Min(boundsMin, localMin);
+        boundsMax = PVector3::Max(boundsMax, localMax);
+    };
+    if(pool) pool->parallelFor(0, bodies.size(), reduce, 16384);
+    else     reduce(0, bodies.size());
+
+    // Nothing to fit, keep the default root
+    if(boundsMin.x > boundsMax.x) return;
+
+    float size = 0.0f;
+    for(int c = 0; c < 3; c++)
+    {
+        size = std::max(size, boundsMax.data[c] - boundsMin.data[c]);
+    }
+    root->nodeCenter = 0.5f * (boundsMin + boundsMax);
+    root->nodeSize = std::max(size * (1.0f + BHNode::BHNODE_ROOT_PADDING), BHNode::BHNODE_MIN_ROOT_SIZE);
 }
 
 void BHTree::insertBody(const Body* body)
@@ -25,11 +184,46 @@ void BHTree::insertBody(const Body* body)
     calculateNodeInsertion(body, root, 0);
 }
 
-PVector3 BHTree::calculateFieldOnPoint(const PVector3& point, const float thr)
+template<typename Law>
+PVector3 BHTree::calculateFieldOnPoint(const Law& law, const PVector3& point, const float thr, float* potential, BHWalkStats* stats)
 {
     // ST_PROF;
     // Traverse the tree with dfs and use a threshold of thr
-    return calculateFieldOnPointDFS(point, thr, root);
+    return calculateFieldOnPointDFS(law, point, thr, root, potential, stats);
+}
+
+PVector3 BHTree::calculateFieldOnPoint(const PVector3& point, const float thr, float* potential, BHWalkStats* stats)
+{
+    return calculateFieldOnPoint(LogLaw{}, point, thr, potential, stats);
+}
+
+template<typename Law>
+PVector3 BHTree::calculateMonopoleField(const Law& law, const PVector3& point, float* potential) const
+{
+    if(root->bodies.empty()) return {0.0f, 0.0f, 0.0f};
+    return CalculatePointField(law, point, root->centerOfMassNorm, root->mass, potential);
+}
+
+float BHTree::getMass() const
+{
+    return root->mass;
+}
+
+PVector3 BHTree::getCenterOfMass() const
+{
+    return root->centerOfMassNorm;
+}
+
+template<typename Law>
+PVector3 BHTree::CalculatePointField(const Law& law, const PVector3& point, const PVector3& source, float mass, float* potential)
+{
+    constexpr float K = BHNode::BHNODE_FIELD_CONSTANT;
+    const PVector3 d = source - point;
+    const float distanceSqr = PVector3::InnerProduct(d, d);
+    if(distanceSqr < BHNode::BHNODE_FIELD_EPSILON_THR * BHNode::BHNODE_FIELD_EPSILON_THR) return {0.0f, 0.0f, 0.0f};
+
+    if(potential) *potential += K * mass * law.potential(distanceSqr);
+    return (K * mass * law.scale(distanceSqr)) * d;
 }
 
 void BHTree::printNodes() const
@@ -39,22 +233,368 @@ void BHTree::printNodes() const
 
 unsigned long long BHTree::computeNodeNumber() const
 {
-    return countChildrenRecursive(root);
+    return stats.nodes;
+}
+
+BHTreeStats BHTree::getStats() const
+{
+    BHTreeStats current = stats;
+    current.rootSize = root->nodeSize;
+    current.bodies = root->bodies.size();
+    current.peakNodes = std::max(current.peakNodes, current.nodes);
+    current.peakBytes = std::max(current.peakBytes, current.getBytes());
+    return current;
+}
+
+const std::vector<const Body*>& BHTree::getBodies() const
+{
+    return root->bodies;
+}
+
+std::vector<std::vector<const Body*>> BHTree::queryRange(const std::vector<PVector3>& points, float radius) const
+{
+    std::vector<std::vector<const Body*>> results(points.size());
+    const float radiusSqr = radius * radius;
+
+    ThreadPool::Global().parallelFor(0, points.size(), [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; i++)
+        {
+            queryRangeDFS(points[i], radiusSqr, root, results[i]);
+        }
+    }, 64);
+
+    return results;
+}
+
+void BHTree::queryRange(const PVector3& point, float radius, std::vector<const Body*>& result) const
+{
+    queryRangeDFS(point, radius * radius, root, result);
+}
+
+std::vector<std::vector<BHNeighbour>> BHTree::queryNearest(const std::vector<PVector3>& points, std::size_t k) const
+{
+    std::vector<std::vector<BHNeighbour>> results(points.size());
+    if(k == 0) return results;
+
+    ThreadPool::Global().parallelFor(0, points.size(), [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; i++)
+        {
+            std::vector<BHNeighbour>& heap = results[i];
+            heap.reserve(k);
+            queryNearestDFS(points[i], k, root, nullptr, heap);
+            std::sort_heap(heap.begin(), heap.end(), NeighbourCompare);
+        }
+    }, 64);
+
+    return results;
+}
+
+void BHTree::calculateFieldOnPoints(const std::vector<PVector3>& points, const float thr, std::vector<PVector3>& field, std::vector<float>* potential) const
+{
+    calculateFieldOnPoints(LogLaw{}, points, thr, field, potential);
+}
+
+template<typename Law>
+void BHTree::calculateFieldOnPoints(const Law& law, const std::vector<PVector3>& points, const float thr, std::vector<PVector3>& field, std::vector<float>* potential) const
+{
+    constexpr float K = BHNode::BHNODE_FIELD_CONSTANT;
+    constexpr std::size_t G = BHNode::BHNODE_GROUP_SIZE;
+
+    field.assign(points.size(), PVector3{0.0f, 0.0f, 0.0f});
+    if(potential) potential->assign(points.size(), 0.0f);
+    if(points.empty()) return;
+
+    // Neighbouring samples end up in the same group and share the walk
+    const std::vector<std::size_t> order = SortByMortonKey(points);
+    const std::size_t groups = (points.size() + G - 1) / G;
+
+    ThreadPool::Global().parallelFor(0, groups, [&](std::size_t begin, std::size_t end) {
+        std::vector<const BHNode*> interactions;
+        for(std::size_t g = begin; g < end; g++)
+        {
+            const std::size_t first = g * G;
+            const std::size_t last = std::min(first + G, points.size());
+
+            PVector3 groupMin = points[order[first]];
+            PVector3 groupMax = points[order[first]];
+            for(std::size_t i = first; i < last; i++)
+            {
+                groupMin = PVector3::Min(groupMin, points[order[i]]);
+                groupMax = PVector3::Max(groupMax, points[order[i]]);
+            }
+
+            interactions.clear();
+            collectInteractions(groupMin, groupMax, thr, root, interactions);
+
+            for(std::size_t i = first; i < last; i++)
+            {
+                const std::size_t index = order[i];
+                const PVector3& point = points[index];
+                PVector3 f = {0.0f, 0.0f, 0.0f};
+                float phi = 0.0f;
+
+                for(const BHNode* node : interactions)
+                {
+                    const PVector3 d = node->centerOfMassNorm - point;
+                    const float distanceSqr = PVector3::InnerProduct(d, d);
+                    if(distanceSqr < BHNode::BHNODE_FIELD_EPSILON_THR * BHNode::BHNODE_FIELD_EPSILON_THR) continue;
+
+                    f += (K * node->mass * law.scale(distanceSqr)) * d;
+                    if(potential) phi += K * node->mass * law.potential(distanceSqr);
+                }
+
+                field[index] = f;
+                if(potential) (*potential)[index] = phi;
+            }
+        }
+    }, 4);
+}
+
+void BHTree::collectInteractions(const PVector3& groupMin, const PVector3& groupMax, const float thr, const BHNode* node, std::vector<const BHNode*>& interactions) const
+{
+    if(node->bodies.empty()) return;
+
+    // Closest any sample of the group gets to the node's center of mass
+    float distanceSqr = 0.0f;
+    for(int i = 0; i < 3; i++)
+    {
+        float d = std::max({ groupMin.data[i] - node->centerOfMassNorm.data[i], node->centerOfMassNorm.data[i] - groupMax.data[i], 0.0f });
+        distanceSqr += d * d;
+    }
+
+    // Accept only if the criterion holds for every sample in the group
+    const bool useCM = (node->bodies.size() == 1) || (node->nodeSize * node->nodeSize < thr * thr * distanceSqr);
+    if(useCM || IsLeaf(node))
+    {
+        interactions.push_back(node);
+        return;
+    }
+
+    for(const BHNode* child : node->children)
+    {
+        if(child) collectInteractions(groupMin, groupMax, thr, child, interactions);
+    }
+}
+
+std::vector<float> BHTree::calculateLocalDensity(std::size_t k) const
+{
+    const std::vector<const Body*>& bodies = root->bodies;
+    std::vector<float> density(bodies.size(), 0.0f);
+    if(k == 0) return density;
+
+    ThreadPool::Global().parallelFor(0, bodies.size(), [&](std::size_t begin, std::size_t end) {
+        std::vector<BHNeighbour> heap;
+        heap.reserve(k);
+        for(std::size_t i = begin; i < end; i++)
+        {
+            const Body* body = bodies[i];
+            heap.clear();
+            queryNearestDFS(body->getPosition(), k, root, body, heap);
+            if(heap.empty() || body->getIndex() >= density.size()) continue;
+
+            // Smoothing length is the distance to the k-th neighbour (the heap top)
+            float mass = body->getMass();
+            for(const auto& neighbour : heap)
+            {
+                mass += neighbour.body->getMass();
+            }
+            const float h = std::sqrt(heap.front().distanceSqr);
+            const float volume = (4.0f / 3.0f) * std::numbers::pi_v<float> * h * h * h;
+            density[body->getIndex()] = (volume > 0.0f) ? mass / volume : 0.0f;
+        }
+    }, 64);
+
+    return density;
+}
+
+void BHTree::queryRangeDFS(const PVector3& point, float radiusSqr, const BHNode* node, std::vector<const Body*>& result) const
+{
+    if(node->bodies.empty() || BoxDistanceSqr(point, node) > radiusSqr) return;
+
+    // Whole cell inside the sphere, every body below it is a match
+    if(BoxFarDistanceSqr(point, node) <= radiusSqr)
+    {
+        result.insert(result.end(), node->bodies.begin(), node->bodies.end());
+        return;
+    }
+
+    if(IsLeaf(node))
+    {
+        for(const Body* body : node->bodies)
+        {
+            if(PVector3::DistanceSqr(point, body->getPosition()) <= radiusSqr)
+            {
+                result.push_back(body);
+            }
+        }
+        return;
+    }
+
+    for(const BHNode* child : node->children)
+    {
+        if(child) queryRangeDFS(point, radiusSqr, child, result);
+    }
 }
 
-unsigned long long BHTree::countChildrenRecursive(BHNode* node) const
+void BHTree::queryNearestDFS(const PVector3& point, std::size_t k, const BHNode* node, const Body* exclude, std::vector<BHNeighbour>& heap) const
 {
-    unsigned long long count = 1ULL;
+    if(node->bodies.empty()) return;
+    if(heap.size() == k && BoxDistanceSqr(point, node) > heap.front().distanceSqr) return;
+
+    if(IsLeaf(node))
+    {
+        for(const Body* body : node->bodies)
+        {
+            if(body == exclude) continue;
+
+            float distanceSqr = PVector3::DistanceSqr(point, body->getPosition());
+            if(heap.size() < k)
+            {
+                heap.push_back({ body, distanceSqr });
+                std::push_heap(heap.begin(), heap.end(), NeighbourCompare);
+            }
+            else if(distanceSqr < heap.front().distanceSqr)
+            {
+                std::pop_heap(heap.begin(), heap.end(), NeighbourCompare);
+                heap.back() = { body, distanceSqr };
+                std::push_heap(heap.begin(), heap.end(), NeighbourCompare);
+            }
+        }
+        return;
+    }
+
+    // Visit the closest cells first so the k-th distance shrinks fast
+    std::array<std::pair<float, const BHNode*>, 8> order;
+    std::size_t count = 0;
+    for(const BHNode* child : node->children)
+    {
+        if(child && !child->bodies.empty())
+        {
+            order[count++] = { BoxDistanceSqr(point, child), child };
+        }
+    }
+    SortChildOrder(order, count);
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(heap.size() == k && order[i].first > heap.front().distanceSqr) break;
+        queryNearestDFS(point, k, order[i].second, exclude, heap);
+    }
+}
+
+const Body* BHTree::pickRay(const PVector3& origin, const PVector3& direction, float radius) const
+{
+    if(root->bodies.empty()) return nullptr;
+
+    const PVector3 dir = PVector3::Normalize(direction);
+    const PVector3 inverse = { 1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z };
+
+    const Body* best = nullptr;
+    float bestT = std::numeric_limits<float>::max();
+    pickRayDFS(origin, dir, inverse, radius, root, best, bestT);
+    return best;
+}
+
+void BHTree::pickRayDFS(const PVector3& origin, const PVector3& direction, const PVector3& inverse, float radius, const BHNode* node, const Body*& best, float& bestT) const
+{
+    if(IsLeaf(node))
+    {
+        const float radiusSqr = radius * radius;
+        for(const Body* body : node->bodies)
+        {
+            const PVector3 d = body->getPosition() - origin;
+            const float t = PVector3::InnerProduct(d, direction);
+            if(t < 0.0f || t >= bestT) continue;
+
+            if(PVector3::InnerProduct(d, d) - t * t <= radiusSqr)
+            {
+                best = body;
+                bestT = t;
+            }
+        }
+        return;
+    }
+
+    // Front to back, once a hit is found every cell entered behind it is skipped
+    std::array<std::pair<float, const BHNode*>, 8> order;
+    std::size_t count = 0;
+    for(const BHNode* child : node->children)
+    {
+        float enter;
+        if(child && !child->bodies.empty() && RayBoxEnter(origin, inverse, radius, child, enter) && enter < bestT)
+        {
+            order[count++] = { enter, child };
+        }
+    }
+    SortChildOrder(order, count);
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(order[i].first >= bestT) break;
+        pickRayDFS(origin, direction, inverse, radius, order[i].second, best, bestT);
+    }
+}
+
+void BHTree::computeNodeMoments(BHNode* node, int depth, ThreadPool* pool)
+{
+    if(node->bodies.empty()) return;
+
+    if(IsLeaf(node))
+    {
+        node->mass = 0.0f;
+        node->centerOfMassWeighted = {0.0f, 0.0f, 0.0f};
+        node->geometricCenter = {0.0f, 0.0f, 0.0f};
+        node->boundsMin = node->bodies.front()->getPosition();
+        node->boundsMax = node->boundsMin;
+        for(const Body* body : node->bodies)
+        {
+            const PVector3 position = body->getPosition();
+            node->mass += body->getMass();
+            node->centerOfMassWeighted += body->getMass() * body->getStatePosition();
+            node->geometricCenter += position;
+            node->boundsMin = PVector3::Min(node->boundsMin, position);
+            node->boundsMax = PVector3::Max(node->boundsMax, position);
+        }
+        node->geometricCenter = node->geometricCenter / static_cast<float>(node->bodies.size());
+        node->centerOfMassNorm = ToFloat(node->centerOfMassWeighted / node->mass);
+        return;
+    }
 
-    for(std::size_t i = 0; i < node->children.size(); i++)
+    // Sibling subtrees are independent, split the top few levels over the pool
+    if(pool && depth < BHNode::BHNODE_PARALLEL_DEPTH)
     {
-        if(node->children[i])
+        pool->parallelFor(0, node->children.size(), [&](std::size_t begin, std::size_t end) {
+            for(std::size_t i = begin; i < end; i++)
+            {
+                if(node->children[i]) computeNodeMoments(node->children[i], depth + 1, pool);
+            }
+        }, 1);
+    }
+    else
+    {
+        for(BHNode* child : node->children)
         {
-            count += countChildrenRecursive(node->children[i]);
+            if(child) computeNodeMoments(child, depth + 1, pool);
         }
     }
 
-    return count;
+    node->mass = 0.0f;
+    node->centerOfMassWeighted = {0.0f, 0.0f, 0.0f};
+    node->geometricCenter = {0.0f, 0.0f, 0.0f};
+    bool first = true;
+    for(const BHNode* child : node->children)
+    {
+        if(!child || child->bodies.empty()) continue;
+
+        node->mass += child->mass;
+        node->centerOfMassWeighted += child->centerOfMassWeighted;
+        node->geometricCenter += static_cast<float>(child->bodies.size()) * child->geometricCenter;
+        node->boundsMin = first ? child->boundsMin : PVector3::Min(node->boundsMin, child->boundsMin);
+        node->boundsMax = first ? child->boundsMax : PVector3::Max(node->boundsMax, child->boundsMax);
+        first = false;
+    }
+    node->geometricCenter = node->geometricCenter / static_cast<float>(node->bodies.size());
+    node->centerOfMassNorm = ToFloat(node->centerOfMassWeighted / node->mass);
 }
 
 void BHTree::printNode(const BHNode* node, int depth) const
@@ -78,6 +618,111 @@ void BHTree::printNode(const BHNode* node, int depth) const
     for(int i = 0; i < 8; i++) if(node->children[i]) printNode(node->children[i], depth + 1);
 }
 
+void BHTree::collectCostCells(const std::vector<float>& bodyCost, int maxLevel, std::vector<BHCostCell>& cells) const
+{
+    cells.clear();
+    collectCostCellsDFS(root, 0, bodyCost, maxLevel, cells);
+}
+
+double BHTree::collectCostCellsDFS(const BHNode* node, int level, const std::vector<float>& bodyCost, int maxLevel, std::vector<BHCostCell>& cells) const
+{
+    if(node->bodies.empty()) return 0.0;
+
+    if(IsLeaf(node))
+    {
+        const std::size_t index = node->bodies.front()->getIndex();
+        return (index < bodyCost.size()) ? bodyCost[index] : 0.0;
+    }
+
+    const int children = static_cast<int>(std::count_if(node->children.begin(), node->children.end(), [](const BHNode* child) { return child != nullptr; }));
+    const bool split = (children > 1);
+
+    // Reserve the slot first so parents come before their children
+    const std::size_t slot = cells.size();
+    if(split && level <= maxLevel)
+    {
+        cells.push_back({ node->boundsMin, node->boundsMax, 0.0, level });
+    }
+
+    double cost = 0.0;
+    for(const BHNode* child : node->children)
+    {
+        if(child) cost += collectCostCellsDFS(child, split ? level + 1 : level, bodyCost, maxLevel, cells);
+    }
+
+    if(split && level <= maxLevel)
+    {
+        cells[slot].cost = cost;
+    }
+    return cost;
+}
+
+void BHTree::selectLOD(const BHView& view, float minPixels, std::size_t budget, std::vector<BHSprite>& sprites, BHLODStats* stats) const
+{
+    sprites.clear();
+    BHLODStats local;
+    BHLODStats& counters = stats ? *stats : local;
+    counters = BHLODStats{};
+    if(root->bodies.empty() || budget == 0) return;
+
+    using Entry = std::pair<float, const BHNode*>;
+    std::priority_queue<Entry> open;
+    if(InFrustum(view, root))
+    {
+        open.push({ ProjectedSize(view, root), root });
+    }
+    else
+    {
+        counters.culled++;
+    }
+
+    // Every open cell is one sprite already, refining swaps it for its visible children
+    std::array<const BHNode*, 8> visible;
+    while(!open.empty())
+    {
+        const auto [size, node] = open.top();
+        open.pop();
+        counters.visited++;
+
+        if(node->bodies.size() == 1 || IsLeaf(node))
+        {
+            const Body* body = node->bodies.front();
+            sprites.push_back({ body->getPosition(), body, 1 });
+            continue;
+        }
+
+        std::size_t count = 0;
+        if(size >= minPixels)
+        {
+            for(const BHNode* child : node->children)
+            {
+                if(!child || child->bodies.empty()) continue;
+                if(InFrustum(view, child))
+                {
+                    visible[count++] = child;
+                }
+                else
+                {
+                    counters.culled++;
+                }
+            }
+
+            if(sprites.size() + open.size() + count <= budget)
+            {
+                for(std::size_t i = 0; i < count; i++)
+                {
+                    open.push({ ProjectedSize(view, visible[i]), visible[i] });
+                }
+                continue;
+            }
+            counters.budgetLimited++;
+        }
+
+        sprites.push_back({ node->centerOfMassNorm, node->bodies.front(), node->bodies.size() });
+        counters.aggregated++;
+    }
+}
+
 void BHTree::deleteNodes(BHNode* node)
 {
     for(std::size_t i = 0; i < 8; i++)
@@ -87,11 +732,14 @@ void BHTree::deleteNodes(BHNode* node)
     delete node;
 }
 
-PVector3 BHTree::calculateFieldOnPointDFS(const PVector3& point, const float thr, const BHNode* node)
+template<typename Law>
+PVector3 BHTree::calculateFieldOnPointDFS(const Law& law, const PVector3& point, const float thr, const BHNode* node, float* potential, BHWalkStats* stats)
 {
     PVector3 field = {0.0f, 0.0f, 0.0f};
     // constexpr float K = 1E3;
-    constexpr float K = 10.0f;
+    constexpr float K = BHNode::BHNODE_FIELD_CONSTANT;
+
+    if(stats) stats->nodeVisits++;
 
     if(node->bodies.empty())
     {
@@ -99,22 +747,25 @@ PVector3 BHTree::calculateFieldOnPointDFS(const PVector3& point, const float thr
     }
 
     // Check thr
-    // TODO: (César) : Change to DistanceSqr
-    float distance = PVector3::Distance(point, node->centerOfMassNorm);
+    const PVector3 d = node->centerOfMassNorm - point;
+    const float distanceSqr = PVector3::InnerProduct(d, d);
 
     // Exclude self (for now just use this distance approach)
     // There might be better ways
-    if(distance < BHNode::BHNODE_FIELD_EPSILON_THR && node->bodies.size() == 1)
+    if(distanceSqr < BHNode::BHNODE_FIELD_EPSILON_THR * BHNode::BHNODE_FIELD_EPSILON_THR && node->bodies.size() == 1)
     {
         return field;
     }
 
-    bool useCM = ((node->nodeSize / distance) < thr) || (node->bodies.size() == 1);
+    // size / distance < thr, squared so the walk takes no root or division per node
+    bool useCM = (node->nodeSize * node->nodeSize < thr * thr * distanceSqr) || (node->bodies.size() == 1);
 
     if(useCM)
     {
-        // field = (K * node->mass / (distance * distance)) * PVector3::Normalize(node->centerOfMassNorm - point);
-        field = (K * node->mass / distance) * PVector3::Normalize(node->centerOfMassNorm - point);
+        field = (K * node->mass * law.scale(distanceSqr)) * d;
+        if(stats) stats->interactions++;
+
+        if(potential) *potential += K * node->mass * law.potential(distanceSqr);
     }
     else
     {
@@ -123,7 +774,7 @@ PVector3 BHTree::calculateFieldOnPointDFS(const PVector3& point, const float thr
         {
             if(!node->children[i]) continue;
 
-            field += calculateFieldOnPointDFS(point, thr, node->children[i]);
+            field += calculateFieldOnPointDFS(law, point, thr, node->children[i], potential, stats);
         }
     }
     return field;
@@ -133,21 +784,28 @@ void BHTree::calculateNodeInsertion(const Body* body, BHNode* node, unsigned lon
 {
     if(node->bodies.empty())
     {
-        node->bodies.push_back(body);
+        addNodeBody(node, body);
         node->mass += body->getMass();
-        node->centerOfMassWeighted = body->getPosition();
-        node->centerOfMassNorm = node->centerOfMassWeighted;
+        node->centerOfMassWeighted = body->getStatePosition();
+        node->centerOfMassNorm = body->getPosition();
         node->geometricCenter = body->getPosition();
+        node->boundsMin = body->getPosition();
+        node->boundsMax = body->getPosition();
         return;
     }
     const PVector3& bposition = body->getPosition();
+    node->boundsMin = PVector3::Min(node->boundsMin, bposition);
+    node->boundsMax = PVector3::Max(node->boundsMax, bposition);
     node->geometricCenter += (bposition - node->geometricCenter) / (node->bodies.size() + 1);
-    node->centerOfMassWeighted += body->getMass() * bposition;
+    node->centerOfMassWeighted += body->getMass() * body->getStatePosition();
     node->mass += body->getMass();
-    node->centerOfMassNorm = node->centerOfMassWeighted / node->mass;
+    node->centerOfMassNorm = ToFloat(node->centerOfMassWeighted / node->mass);
+
+    addNodeBody(node, body);
+
+    // Coincident bodies would split forever, past the depth cap they share this leaf
+    if(depth >= static_cast<unsigned long long>(BHNode::BHNODE_MAX_DEPTH)) return;
 
-    node->bodies.push_back(body);
-    
     std::size_t cindex = calculateNodeIndex(bposition, node);
     if(!node->children[cindex])
     {
@@ -186,6 +844,14 @@ std::size_t BHTree::calculateNodeIndex(const PVector3& position, const BHNode* n
 
 void BHTree::spawnChildren(BHNode* parent, int depth)
 {
+    // A node only has one body while it is a leaf, this split turns it into an inner node
+    if(parent->bodies.size() == 2)
+    {
+        stats.leaves--;
+        stats.leafDepthSum -= depth;
+        stats.leafDepths[std::min<std::size_t>(depth, BHTreeStats::BHTREE_DEPTH_BINS - 1)]--;
+    }
+
     std::array<bool, 8> needRecalculation = { false };
     for(const Body* body : parent->bodies)
     {
@@ -196,6 +862,12 @@ void BHTree::spawnChildren(BHNode* parent, int depth)
             parent->children[cindex] = new BHNode();
             parent->children[cindex]->nodeCenter = calculateNodeCenter(cindex, parent);
             parent->children[cindex]->nodeSize = 0.5f * parent->nodeSize;
+
+            stats.nodes++;
+            stats.leaves++;
+            stats.leafDepthSum += depth + 1;
+            stats.leafDepths[std::min<std::size_t>(depth + 1, BHTreeStats::BHTREE_DEPTH_BINS - 1)]++;
+            stats.maxDepth = std::max(stats.maxDepth, depth + 1);
         }
 
         if(needRecalculation[cindex])
@@ -204,3 +876,42 @@ void BHTree::spawnChildren(BHNode* parent, int depth)
         }
     }
 }
+
+void BHTree::addNodeBody(BHNode* node, const Body* body)
+{
+    const std::size_t capacity = node->bodies.capacity();
+    node->bodies.push_back(body);
+    stats.listBytes += (node->bodies.capacity() - capacity) * sizeof(const Body*);
+    stats.bodyReferences++;
+
+    // Moves the node up one occupancy bin every time its count reaches a power of two
+    const std::size_t count = node->bodies.size();
+    const std::size_t bin = std::bit_width(count) - 1;
+    if(std::has_single_bit(count) && bin < BHTreeStats::BHTREE_OCCUPANCY_BINS)
+    {
+        stats.occupancy[bin]++;
+        if(bin > 0) stats.occupancy[bin - 1]--;
+    }
+}
+
+void BHTree::resetStats()
+{
+    BHTreeStats cleared;
+    cleared.peakNodes = std::max(stats.peakNodes, stats.nodes);
+    cleared.peakBytes = std::max(stats.peakBytes, stats.getBytes());
+    stats = cleared;
+
+    // The new root is an empty leaf
+    stats.nodes = 1;
+    stats.leaves = 1;
+    stats.leafDepths[0] = 1;
+}
+
+// The walks are compiled once for every law in forcelaw.h
+#define BHTREE_INSTANTIATE_LAW(Law) \
+    template PVector3 BHTree::calculateFieldOnPoint<Law>(const Law&, const PVector3&, const float, float*, BHWalkStats*); \
+    template PVector3 BHTree::calculateMonopoleField<Law>(const Law&, const PVector3&, float*) const; \
+    template void BHTree::calculateFieldOnPoints<Law>(const Law&, const std::vector<PVector3>&, const float, std::vector<PVector3>&, std::vector<float>*) const; \
+    template PVector3 BHTree::CalculatePointField<Law>(const Law&, const PVector3&, const PVector3&, float, float*);
+STARWELL_FORCE_LAWS(BHTREE_INSTANTIATE_LAW)
+#undef BHTREE_INSTANTIATE_LAW
@@ -1,4 +1,5 @@
 #include "../include/body.h"
+#include "../include/cpudispatch.h"
 #include <cmath>
 
 Body::Body(const PVector3& position, const PVector3& velocity, const UVector4& color) : force(nullptr), mass(1.0f)
@@ -6,11 +7,14 @@ Body::Body(const PVector3& position, const PVector3& velocity, const UVector4& c
     if(PositionPool.empty())
     {
         // Make an initial allocation
-        std::cout << "Creating PositionPool with 1'000'000 capacity." << std::endl;
+        std::clog << "Creating PositionPool with 1'000'000 capacity." << std::endl;
         PositionPool.reserve(1'000'000); // TODO: (César) : Remove these magic numbers
         VelocityPool.reserve(1'000'000); // TODO: (César) : Remove these magic numbers
         ForcePool.reserve(1'000'000); // TODO: (César) : Remove these magic numbers
         ColorPool.reserve(1'000'000); // TODO: (César) : Remove these magic numbers
+#ifdef STARWELL_MIXED_PRECISION
+        StatePositionPool.reserve(1'000'000);
+#endif
     }
 
     if(PositionPool.size() == PositionPool.capacity())
@@ -18,6 +22,7 @@ Body::Body(const PVector3& position, const PVector3& velocity, const UVector4& c
         std::cerr << "Body PositionPool reached max capacity. Oops!" << std::endl;
     }
 
+    index = PositionPool.size();
     PositionPool.push_back(position);
     VelocityPool.push_back(velocity);
     ForcePool.push_back(PVector3{0.0f, 0.0f, 0.0f});
@@ -26,13 +31,65 @@ Body::Body(const PVector3& position, const PVector3& velocity, const UVector4& c
     this->velocity = &VelocityPool.back();
     this->force = &ForcePool.back();
     this->color = &ColorPool.back();
+#ifdef STARWELL_MIXED_PRECISION
+    StatePositionPool.push_back(ToState(position));
+    this->statePosition = &StatePositionPool.back();
+#endif
 }
 
 void Body::move(const PVector3& field)
 {
     *force = mass * field;
-    *velocity += 0.01f * 2 * (*force);
-    *position += 0.01f * (*velocity);
+    *velocity += BODY_TIMESTEP * BODY_FIELD_GAIN * (*force);
+#ifdef STARWELL_MIXED_PRECISION
+    // Far from the origin a float position can't take a step this small, the double one can and is rounded after
+    *statePosition += static_cast<double>(BODY_TIMESTEP) * DVector3::FromFloat(*velocity);
+    *position = statePosition->toFloat();
+#else
+    *position += BODY_TIMESTEP * (*velocity);
+#endif
+}
+
+// Velocities and positions of count bodies from their forces, the pools as flat arrays
+STARWELL_KERNEL_INLINE void IntegrateBody(PVector3* velocity, const PVector3* force, PVector3* position, StateVector3* state, std::size_t count)
+{
+    float* velocities = reinterpret_cast<float*>(velocity);
+    BatchAxpy(velocities, reinterpret_cast<const float*>(force), Body::BODY_TIMESTEP * Body::BODY_FIELD_GAIN, 3 * count);
+#ifdef STARWELL_MIXED_PRECISION
+    double* states = reinterpret_cast<double*>(state);
+    BatchAxpy(states, velocities, static_cast<double>(Body::BODY_TIMESTEP), 3 * count);
+    BatchRound(reinterpret_cast<float*>(position), states, 3 * count);
+#else
+    (void)state;
+    BatchAxpy(reinterpret_cast<float*>(position), velocities, Body::BODY_TIMESTEP, 3 * count);
+#endif
+}
+
+STARWELL_KERNEL_VARIANTS(, Integrate,
+    (PVector3* velocity, const PVector3* force, PVector3* position, StateVector3* state, std::size_t count),
+    (velocity, force, position, state, count))
+
+using IntegrateFunction = void(PVector3*, const PVector3*, PVector3*, StateVector3*, std::size_t);
+
+static const CpuKernel IntegrateKernel("integrate");
+static IntegrateFunction* const IntegrateVariants[CPU_PATH_COUNT] = STARWELL_KERNEL_TABLE(Integrate);
+
+void Body::MoveAll(std::vector<Body>* bodies, const std::vector<PVector3>& field)
+{
+    if(bodies->size() != PositionPool.size())
+    {
+        for(std::size_t i = 0; i < bodies->size(); i++) (*bodies)[i].move(field[i]);
+        return;
+    }
+
+    // Every pool slot belongs to one body, so past the forces the order doesn't matter
+    for(std::size_t i = 0; i < bodies->size(); i++)
+    {
+        const Body& body = (*bodies)[i];
+        *body.force = body.mass * field[i];
+    }
+
+    IntegrateKernel.pick(IntegrateVariants)(VelocityPool.data(), ForcePool.data(), PositionPool.data(), GetStatePositionPool()->data(), PositionPool.size());
 }
 
 float Body::getMass() const
@@ -45,6 +102,25 @@ PVector3 Body::getPosition() const
     return *position;
 }
 
+StateVector3 Body::getStatePosition() const
+{
+#ifdef STARWELL_MIXED_PRECISION
+    return *statePosition;
+#else
+    return *position;
+#endif
+}
+
+PVector3 Body::getVelocity() const
+{
+    return *velocity;
+}
+
+std::size_t Body::getIndex() const
+{
+    return index;
+}
+
 std::vector<PVector3>* Body::GetLinearPositionPool()
 {
     return &PositionPool;
@@ -65,15 +141,96 @@ std::vector<UVector4>* Body::GetColorPool()
     return &ColorPool;
 }
 
+std::vector<StateVector3>* Body::GetStatePositionPool()
+{
+#ifdef STARWELL_MIXED_PRECISION
+    return &StatePositionPool;
+#else
+    return &PositionPool;
+#endif
+}
+
+void Body::ReservePools(std::size_t count)
+{
+    // Bodies point into the pools, growing them later would leave those pointers dangling
+    if(!PositionPool.empty() && count > PositionPool.capacity())
+    {
+        std::cerr << "Body pools can only grow while empty." << std::endl;
+        return;
+    }
+
+    PositionPool.reserve(count);
+    VelocityPool.reserve(count);
+    ForcePool.reserve(count);
+    ColorPool.reserve(count);
+#ifdef STARWELL_MIXED_PRECISION
+    StatePositionPool.reserve(count);
+#endif
+}
+
+std::size_t Body::RemoveBodies(std::vector<Body>* bodies, const std::vector<unsigned char>& remove)
+{
+    if(bodies->size() != PositionPool.size() || remove.size() != bodies->size())
+    {
+        std::cerr << "Bodies can only be removed from a simulation that owns the whole pool." << std::endl;
+        return 0;
+    }
+
+    // Survivors slide down over the freed slots, pointers into the pools stay valid since they only shrink
+    std::size_t kept = 0;
+    for(std::size_t i = 0; i < bodies->size(); i++)
+    {
+        if(remove[i]) continue;
+
+        const std::size_t from = (*bodies)[i].index;
+        PositionPool[kept] = PositionPool[from];
+        VelocityPool[kept] = VelocityPool[from];
+        ForcePool[kept] = ForcePool[from];
+        ColorPool[kept] = ColorPool[from];
+#ifdef STARWELL_MIXED_PRECISION
+        StatePositionPool[kept] = StatePositionPool[from];
+#endif
+
+        Body& body = (*bodies)[kept];
+        body = (*bodies)[i];
+        body.index = kept;
+        body.position = &PositionPool[kept];
+        body.velocity = &VelocityPool[kept];
+        body.force = &ForcePool[kept];
+        body.color = &ColorPool[kept];
+#ifdef STARWELL_MIXED_PRECISION
+        body.statePosition = &StatePositionPool[kept];
+#endif
+        kept++;
+    }
+
+    const std::size_t removed = bodies->size() - kept;
+    bodies->erase(bodies->begin() + kept, bodies->end());
+    PositionPool.resize(kept);
+    VelocityPool.resize(kept);
+    ForcePool.resize(kept);
+    ColorPool.resize(kept);
+#ifdef STARWELL_MIXED_PRECISION
+    StatePositionPool.resize(kept);
+#endif
+    return removed;
+}
+
 void Body::ResetPools()
 {
     PositionPool.clear();
     VelocityPool.clear();
     ForcePool.clear();
     ColorPool.clear();
+#ifdef STARWELL_MIXED_PRECISION
+    StatePositionPool.clear();
+#endif
 
     PositionPool.shrink_to_fit();
     VelocityPool.shrink_to_fit();
     ForcePool.shrink_to_fit();
     ColorPool.shrink_to_fit();
+#ifdef STARWELL_MIXED_PRECISION
+    StatePositionPool.shrink_to_fit();
+#endif
 }
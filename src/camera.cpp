@@ -68,6 +68,24 @@ PVector3 Camera::getHeading() const
     }
 }
 
+float Camera::getFov() const
+{
+    return fov;
+}
+
+void Camera::getRay(float ndcX, float ndcY, PVector3& origin, PVector3& direction) const
+{
+    // Unproject the same pixel on the near and far planes
+    const PMatrix4 inverse = PMatrix4::Inverse(getMatrix());
+    PVector4 near = inverse * PVector4{ ndcX, ndcY, -1.0f, 1.0f };
+    PVector4 far = inverse * PVector4{ ndcX, ndcY, 1.0f, 1.0f };
+    near = near / near.w;
+    far = far / far.w;
+
+    origin = { near.x, near.y, near.z };
+    direction = PVector3::Normalize(PVector3{ far.x - near.x, far.y - near.y, far.z - near.z });
+}
+
 float Camera::getScrollSensitivity() const
 {
     return scrollSensitivity;
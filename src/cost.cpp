@@ -0,0 +1,111 @@
+#include "../include/cost.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+BHWalkStats* CostMap::begin(std::size_t count)
+{
+    bodyStats.assign(count, BHWalkStats{});
+    return bodyStats.data();
+}
+
+void CostMap::finish(const BHTree& tree)
+{
+    bodyCost.resize(bodyStats.size());
+    double sum = 0.0;
+    for(std::size_t i = 0; i < bodyStats.size(); i++)
+    {
+        const BHWalkStats& stats = bodyStats[i];
+        bodyCost[i] = static_cast<float>((metric == Metric::INTERACTIONS) ? stats.interactions : stats.nodeVisits);
+        sum += bodyCost[i];
+    }
+
+    version++;
+    ready = !bodyCost.empty();
+    if(!ready) return;
+
+    meanCost = static_cast<float>(sum / bodyCost.size());
+    maxCost = *std::max_element(bodyCost.begin(), bodyCost.end());
+
+    // The 99th percentile tops the scale, a handful of outliers would wash everything else out
+    std::vector<float> sorted = bodyCost;
+    const std::size_t p99 = std::min(sorted.size() - 1, static_cast<std::size_t>(0.99 * sorted.size()));
+    std::nth_element(sorted.begin(), sorted.begin() + p99, sorted.end());
+    percentileCost = std::max(sorted[p99], 1.0f);
+
+    if(colorBodies)
+    {
+        colors.resize(bodyCost.size());
+        for(std::size_t i = 0; i < bodyCost.size(); i++)
+        {
+            colors[i] = HeatColor(bodyCost[i] / percentileCost);
+        }
+    }
+
+    if(showCells)
+    {
+        tree.collectCostCells(bodyCost, maxCellLevel, cells);
+    }
+    else
+    {
+        cells.clear();
+    }
+}
+
+bool CostMap::hasResult() const
+{
+    return ready;
+}
+
+unsigned long long CostMap::getVersion() const
+{
+    return version;
+}
+
+const std::vector<UVector4>& CostMap::getColors() const
+{
+    return colors;
+}
+
+const std::vector<BHCostCell>& CostMap::getCells() const
+{
+    return cells;
+}
+
+float CostMap::getMeanCost() const
+{
+    return meanCost;
+}
+
+float CostMap::getMaxCost() const
+{
+    return maxCost;
+}
+
+float CostMap::getPercentileCost() const
+{
+    return percentileCost;
+}
+
+UVector4 CostMap::HeatColor(float t, unsigned char alpha)
+{
+    static constexpr std::array<std::array<float, 3>, 5> stops = {{
+        { 0.0f, 0.0f, 1.0f },
+        { 0.0f, 1.0f, 1.0f },
+        { 0.0f, 1.0f, 0.0f },
+        { 1.0f, 1.0f, 0.0f },
+        { 1.0f, 0.0f, 0.0f }
+    }};
+
+    t = std::clamp(t, 0.0f, 1.0f) * (stops.size() - 1);
+    const std::size_t i = std::min(static_cast<std::size_t>(t), stops.size() - 2);
+    const float f = t - i;
+
+    UVector4 color;
+    for(int c = 0; c < 3; c++)
+    {
+        color.data[c] = static_cast<unsigned char>(255.0f * (stops[i][c] + f * (stops[i + 1][c] - stops[i][c])));
+    }
+    color.a = alpha;
+    return color;
+}
@@ -0,0 +1,107 @@
+#include "../include/cpudispatch.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+CpuPath CpuDispatch::Detect()
+{
+    static const CpuPath detected = []() {
+#ifdef STARWELL_CPU_DISPATCH
+        // Also checks that the OS saves the wider registers
+        __builtin_cpu_init();
+        if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vl") && __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512bw"))
+        {
+            return CpuPath::AVX512;
+        }
+        if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return CpuPath::AVX2;
+        if(__builtin_cpu_supports("sse4.2")) return CpuPath::SSE4;
+#endif
+        return CpuPath::SCALAR;
+    }();
+    return detected;
+}
+
+void CpuDispatch::SetLimit(CpuPath limit)
+{
+    CpuDispatch::limit.store(static_cast<int>(limit), std::memory_order_relaxed);
+}
+
+CpuPath CpuDispatch::GetLimit()
+{
+    return static_cast<CpuPath>(limit.load(std::memory_order_relaxed));
+}
+
+CpuPath CpuDispatch::GetPath()
+{
+    return static_cast<CpuPath>(std::min(limit.load(std::memory_order_relaxed), static_cast<int>(Detect())));
+}
+
+const char* CpuDispatch::GetPathName(CpuPath path)
+{
+    switch(path)
+    {
+        case CpuPath::SCALAR: return "scalar";
+        case CpuPath::SSE4:   return "sse4";
+        case CpuPath::AVX2:   return "avx2";
+        case CpuPath::AVX512: return "avx512";
+        default:              return "unknown";
+    }
+}
+
+bool CpuDispatch::ParsePath(const std::string& name, CpuPath& path)
+{
+    // No cap, the best detected path
+    if(name == "auto")
+    {
+        path = CpuPath::AVX512;
+        return true;
+    }
+    for(int i = 0; i < CPU_PATH_COUNT; i++)
+    {
+        if(name == GetPathName(static_cast<CpuPath>(i)))
+        {
+            path = static_cast<CpuPath>(i);
+            return true;
+        }
+    }
+    std::cerr << "Unknown CPU path '" << name << "', expected auto, scalar, sse4, avx2 or avx512." << std::endl;
+    return false;
+}
+
+std::string CpuDispatch::Describe()
+{
+    std::ostringstream text;
+    text << GetPathName(GetPath()) << " (detected " << GetPathName(Detect()) << ")";
+    for(const CpuKernel* kernel : CpuKernel::GetKernels())
+    {
+        text << ", " << kernel->getName() << " " << GetPathName(kernel->getPath());
+    }
+    return text.str();
+}
+
+CpuKernel::CpuKernel(const char* name) : name(name)
+{
+    Registry().push_back(this);
+}
+
+const char* CpuKernel::getName() const
+{
+    return name;
+}
+
+CpuPath CpuKernel::getPath() const
+{
+    return CpuDispatch::GetPath();
+}
+
+const std::vector<const CpuKernel*>& CpuKernel::GetKernels()
+{
+    return Registry();
+}
+
+std::vector<const CpuKernel*>& CpuKernel::Registry()
+{
+    // Kernels register from static initializers in other files, a function local list exists before any of them
+    static std::vector<const CpuKernel*> kernels;
+    return kernels;
+}
@@ -0,0 +1,145 @@
+#include "../include/diagnostics.h"
+#include "../include/threadpool.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+double ConservationSample::getEnergy() const
+{
+    return kinetic + potential;
+}
+
+bool ConservationMonitor::due(unsigned long long step) const
+{
+    return enabled && (step % static_cast<unsigned long long>(std::max(every, 1))) == 0;
+}
+
+void ConservationMonitor::record(const ConservationSample& sample)
+{
+    if(!initialized)
+    {
+        initial = sample;
+        initialized = true;
+    }
+    latest = sample;
+
+    energyHistory.push_back(static_cast<float>(getEnergyDrift()));
+    momentumHistory.push_back(static_cast<float>(getMomentumDrift()));
+    angularMomentumHistory.push_back(static_cast<float>(getAngularMomentumDrift()));
+    if(energyHistory.size() > CONSERVATION_HISTORY_SIZE)
+    {
+        energyHistory.erase(energyHistory.begin());
+        momentumHistory.erase(momentumHistory.begin());
+        angularMomentumHistory.erase(angularMomentumHistory.begin());
+    }
+}
+
+void ConservationMonitor::reset()
+{
+    initialized = false;
+    initial = {};
+    latest = {};
+    energyHistory.clear();
+    momentumHistory.clear();
+    angularMomentumHistory.clear();
+}
+
+bool ConservationMonitor::hasSample() const
+{
+    return initialized;
+}
+
+const ConservationSample& ConservationMonitor::getInitial() const
+{
+    return initial;
+}
+
+const ConservationSample& ConservationMonitor::getLatest() const
+{
+    return latest;
+}
+
+double ConservationMonitor::getEnergyDrift() const
+{
+    // The ln(r) potential has no natural zero so |E| is arbitrary, the kinetic energy sets the scale instead
+    const double reference = (initial.kinetic > 0.0) ? initial.kinetic : std::abs(initial.getEnergy());
+    if(reference <= 0.0) return 0.0;
+    return (latest.getEnergy() - initial.getEnergy()) / reference;
+}
+
+double ConservationMonitor::getMomentumDrift() const
+{
+    // Total momentum usually starts near zero, compare against the momentum flowing around instead
+    if(initial.momentumScale <= 0.0) return 0.0;
+    return PVector3::Magnitude(latest.momentum - initial.momentum) / initial.momentumScale;
+}
+
+double ConservationMonitor::getAngularMomentumDrift() const
+{
+    const double reference = PVector3::Magnitude(initial.angularMomentum);
+    if(reference <= 0.0) return 0.0;
+    return PVector3::Magnitude(latest.angularMomentum - initial.angularMomentum) / reference;
+}
+
+const std::vector<float>& ConservationMonitor::getEnergyHistory() const
+{
+    return energyHistory;
+}
+
+const std::vector<float>& ConservationMonitor::getMomentumHistory() const
+{
+    return momentumHistory;
+}
+
+const std::vector<float>& ConservationMonitor::getAngularMomentumHistory() const
+{
+    return angularMomentumHistory;
+}
+
+void ConservationMonitor::Reduce(const std::vector<Body>* bodies, ConservationSample& sample)
+{
+    std::mutex mergeMutex;
+    double kinetic = 0.0;
+    double scale = 0.0;
+    double p[3] = {0.0, 0.0, 0.0};
+    double l[3] = {0.0, 0.0, 0.0};
+
+    ThreadPool::Global().parallelFor(0, bodies->size(), [&](std::size_t begin, std::size_t end) {
+        // Partial sums in double, float loses the drift we are looking for at a few 100k bodies
+        double k = 0.0;
+        double s = 0.0;
+        double cp[3] = {0.0, 0.0, 0.0};
+        double cl[3] = {0.0, 0.0, 0.0};
+
+        for(std::size_t i = begin; i < end; i++)
+        {
+            const Body& body = (*bodies)[i];
+            const double m = body.getMass();
+            const PVector3 r = body.getPosition();
+            const PVector3 v = body.getVelocity();
+            const PVector3 rv = r * v;
+
+            k += 0.5 * m * PVector3::InnerProduct(v, v);
+            s += m * PVector3::Magnitude(v);
+            for(int c = 0; c < 3; c++)
+            {
+                cp[c] += m * v.data[c];
+                cl[c] += m * rv.data[c];
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        kinetic += k;
+        scale += s;
+        for(int c = 0; c < 3; c++)
+        {
+            p[c] += cp[c];
+            l[c] += cl[c];
+        }
+    });
+
+    sample.kinetic = kinetic;
+    sample.momentumScale = scale;
+    sample.momentum = { static_cast<float>(p[0]), static_cast<float>(p[1]), static_cast<float>(p[2]) };
+    sample.angularMomentum = { static_cast<float>(l[0]), static_cast<float>(l[1]), static_cast<float>(l[2]) };
+}
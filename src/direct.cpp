@@ -0,0 +1,171 @@
+#include "../include/direct.h"
+#include "../include/bhtree.h"
+#include "../include/cpudispatch.h"
+#include "../include/threadpool.h"
+#include <algorithm>
+#include <cmath>
+
+void DirectSummation::setSources(const std::vector<Body>* bodies)
+{
+    const std::size_t count = bodies->size();
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    m.resize(count);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        const Body& body = (*bodies)[i];
+        const PVector3 position = body.getPosition();
+        x[i] = position.x;
+        y[i] = position.y;
+        z[i] = position.z;
+        m[i] = body.getMass();
+    }
+}
+
+void DirectSummation::setSources(const std::vector<PVector3>& positions, const std::vector<float>& masses)
+{
+    const std::size_t count = std::min(positions.size(), masses.size());
+    x.resize(count);
+    y.resize(count);
+    z.resize(count);
+    m.resize(count);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        x[i] = positions[i].x;
+        y[i] = positions[i].y;
+        z[i] = positions[i].z;
+        m[i] = masses[i];
+    }
+}
+
+std::size_t DirectSummation::getSourceCount() const
+{
+    return m.size();
+}
+
+void DirectSummation::calculateFieldOnPoints(const std::vector<PVector3>& points, std::vector<PVector3>& field, std::vector<float>* potential) const
+{
+    calculateFieldOnPoints(LogLaw{}, points, field, potential);
+}
+
+template<typename Law>
+void DirectSummation::calculateFieldOnPoints(const Law& law, const std::vector<PVector3>& points, std::vector<PVector3>& field, std::vector<float>* potential) const
+{
+    field.assign(points.size(), PVector3{0.0f, 0.0f, 0.0f});
+    if(potential) potential->assign(points.size(), 0.0f);
+    if(points.empty() || m.empty()) return;
+
+    const std::size_t blocks = (points.size() + DIRECT_TARGET_BLOCK - 1) / DIRECT_TARGET_BLOCK;
+    ThreadPool::Global().parallelFor(0, blocks, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t b = begin; b < end; b++)
+        {
+            const std::size_t first = b * DIRECT_TARGET_BLOCK;
+            const std::size_t count = std::min(DIRECT_TARGET_BLOCK, points.size() - first);
+            calculateBlock(law, points.data() + first, count, field.data() + first, potential ? potential->data() + first : nullptr);
+        }
+    }, 1);
+}
+
+// Field of every source on a block of at most DIRECT_TARGET_BLOCK points, compiled for every CPU path
+template<typename Law>
+STARWELL_KERNEL_INLINE void CalculateBlockBody(const Law& law, const float* x, const float* y, const float* z, const float* m, std::size_t sources, const PVector3* points, std::size_t count, PVector3* field, float* potential)
+{
+    constexpr std::size_t DIRECT_TARGET_BLOCK = DirectSummation::DIRECT_TARGET_BLOCK;
+    constexpr std::size_t DIRECT_TILE_SIZE = DirectSummation::DIRECT_TILE_SIZE;
+    constexpr float K = BHNode::BHNODE_FIELD_CONSTANT;
+    constexpr float EPSILON_SQR = BHNode::BHNODE_FIELD_EPSILON_THR * BHNode::BHNODE_FIELD_EPSILON_THR;
+
+    // Targets are the vector dimension: one source is broadcast against the whole block,
+    // every lane owns its accumulator so there is no reduction for the compiler to refuse
+    float px[DIRECT_TARGET_BLOCK] = {};
+    float py[DIRECT_TARGET_BLOCK] = {};
+    float pz[DIRECT_TARGET_BLOCK] = {};
+    float fx[DIRECT_TARGET_BLOCK] = {};
+    float fy[DIRECT_TARGET_BLOCK] = {};
+    float fz[DIRECT_TARGET_BLOCK] = {};
+    float phi[DIRECT_TARGET_BLOCK] = {};
+
+    // Padding lanes sit far away and are never written back
+    for(std::size_t t = 0; t < DIRECT_TARGET_BLOCK; t++)
+    {
+        const PVector3 p = (t < count) ? points[t] : PVector3{ 1E30f, 1E30f, 1E30f };
+        px[t] = p.x;
+        py[t] = p.y;
+        pz[t] = p.z;
+    }
+
+    for(std::size_t tile = 0; tile < sources; tile += DIRECT_TILE_SIZE)
+    {
+        const std::size_t tileEnd = std::min(tile + DIRECT_TILE_SIZE, sources);
+
+        for(std::size_t j = tile; j < tileEnd; j++)
+        {
+            const float sx = x[j];
+            const float sy = y[j];
+            const float sz = z[j];
+            const float sm = m[j];
+
+            // K m scale(r^2) d, coincident bodies (self) are masked out, not branched on
+            for(std::size_t t = 0; t < DIRECT_TARGET_BLOCK; t++)
+            {
+                const float dx = sx - px[t];
+                const float dy = sy - py[t];
+                const float dz = sz - pz[t];
+                const float r2 = dx * dx + dy * dy + dz * dz;
+                const float w = (r2 > EPSILON_SQR) ? sm : 0.0f;
+                const float s = w * law.scale(std::max(r2, EPSILON_SQR));
+                fx[t] += s * dx;
+                fy[t] += s * dy;
+                fz[t] += s * dz;
+            }
+        }
+
+        // Kept out of the loop above, log and pow do not vectorize without a vector math library
+        if(potential)
+        {
+            for(std::size_t t = 0; t < count; t++)
+            {
+                float p = 0.0f;
+                for(std::size_t j = tile; j < tileEnd; j++)
+                {
+                    const float dx = x[j] - px[t];
+                    const float dy = y[j] - py[t];
+                    const float dz = z[j] - pz[t];
+                    const float r2 = dx * dx + dy * dy + dz * dz;
+                    if(r2 > EPSILON_SQR) p += m[j] * law.potential(r2);
+                }
+                phi[t] += p;
+            }
+        }
+    }
+
+    for(std::size_t t = 0; t < count; t++)
+    {
+        field[t] = { K * fx[t], K * fy[t], K * fz[t] };
+        if(potential) potential[t] = K * phi[t];
+    }
+}
+
+STARWELL_KERNEL_VARIANTS(template<typename Law>, CalculateBlock,
+    (const Law& law, const float* x, const float* y, const float* z, const float* m, std::size_t sources, const PVector3* points, std::size_t count, PVector3* field, float* potential),
+    (law, x, y, z, m, sources, points, count, field, potential))
+
+template<typename Law>
+using CalculateBlockFunction = void(const Law&, const float*, const float*, const float*, const float*, std::size_t, const PVector3*, std::size_t, PVector3*, float*);
+
+static const CpuKernel ForceKernel("force");
+template<typename Law>
+static CalculateBlockFunction<Law>* const ForceVariants[CPU_PATH_COUNT] = STARWELL_KERNEL_TABLE(CalculateBlock, <Law>);
+
+template<typename Law>
+void DirectSummation::calculateBlock(const Law& law, const PVector3* points, std::size_t count, PVector3* field, float* potential) const
+{
+    ForceKernel.pick(ForceVariants<Law>)(law, x.data(), y.data(), z.data(), m.data(), m.size(), points, count, field, potential);
+}
+
+// Compiled once for every law in forcelaw.h
+#define DIRECT_INSTANTIATE_LAW(Law) \
+    template void DirectSummation::calculateFieldOnPoints<Law>(const Law&, const std::vector<PVector3>&, std::vector<PVector3>&, std::vector<float>*) const;
+STARWELL_FORCE_LAWS(DIRECT_INSTANTIATE_LAW)
+#undef DIRECT_INSTANTIATE_LAW
@@ -0,0 +1,129 @@
+#include "../include/distributions.h"
+#include <cmath>
+#include <iostream>
+#include <numbers>
+#include <random>
+
+static constexpr float DISTRIBUTION_RADIUS = 500.0f;
+static constexpr float PLUMMER_SCALE = 100.0f;
+static constexpr float DISK_SCALE = 100.0f;
+static constexpr float DISK_THICKNESS = 5.0f;
+static constexpr float DISK_SEPARATION = 700.0f;
+static constexpr float DISK_SPEED = 100.0f;
+static constexpr float DISK_DRIFT = 50.0f;
+
+static PVector3 RandomDirection(std::mt19937& rng)
+{
+    std::uniform_real_distribution<float> u(-1.0f, 1.0f);
+    std::uniform_real_distribution<float> angle(0.0f, 2.0f * std::numbers::pi_v<float>);
+    const float z = u(rng);
+    const float phi = angle(rng);
+    const float r = std::sqrt(std::max(1.0f - z * z, 0.0f));
+    return { r * std::cos(phi), r * std::sin(phi), z };
+}
+
+static void GenerateUniform(std::size_t count, std::mt19937& rng, Distribution& distribution)
+{
+    std::uniform_real_distribution<float> u(0.0f, 1.0f);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        const float r = DISTRIBUTION_RADIUS * std::cbrt(u(rng));
+        distribution.positions.push_back(r * RandomDirection(rng));
+        distribution.velocities.push_back({0.0f, 0.0f, 0.0f});
+    }
+}
+
+static void GeneratePlummer(std::size_t count, std::mt19937& rng, Distribution& distribution)
+{
+    std::uniform_real_distribution<float> u(1E-6f, 1.0f);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        // Inverse of the cumulative mass M(<r) = r^3 / (r^2 + a^2)^(3/2), cut at 10 scale radii
+        float r;
+        do
+        {
+            r = PLUMMER_SCALE / std::sqrt(std::pow(u(rng), -2.0f / 3.0f) - 1.0f);
+        } while(r > 10.0f * PLUMMER_SCALE);
+
+        distribution.positions.push_back(r * RandomDirection(rng));
+        distribution.velocities.push_back({0.0f, 0.0f, 0.0f});
+    }
+}
+
+static void GenerateTwoDisk(std::size_t count, std::mt19937& rng, Distribution& distribution)
+{
+    std::exponential_distribution<float> radius(1.0f / DISK_SCALE);
+    std::normal_distribution<float> height(0.0f, DISK_THICKNESS);
+    std::uniform_real_distribution<float> angle(0.0f, 2.0f * std::numbers::pi_v<float>);
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        const float side = (i % 2 == 0) ? -1.0f : 1.0f;
+        const float r = std::min(radius(rng), 6.0f * DISK_SCALE);
+        const float phi = angle(rng);
+        const PVector3 center = { side * DISK_SEPARATION, 0.0f, 0.0f };
+
+        // Same layout as the galaxy scene: disks in the xz plane, rotating, drifting towards each other
+        distribution.positions.push_back(center + PVector3{ r * std::sin(phi), height(rng), r * std::cos(phi) });
+        distribution.velocities.push_back({ DISK_SPEED * std::cos(phi), 0.0f, -DISK_SPEED * std::sin(phi) - side * DISK_DRIFT });
+    }
+}
+
+Distribution GenerateDistribution(DistributionType type, std::size_t count, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    Distribution distribution;
+    distribution.type = type;
+    distribution.positions.reserve(count);
+    distribution.velocities.reserve(count);
+
+    switch(type)
+    {
+        case DistributionType::UNIFORM:
+            GenerateUniform(count, rng, distribution);
+            break;
+        case DistributionType::PLUMMER:
+            GeneratePlummer(count, rng, distribution);
+            break;
+        case DistributionType::TWO_DISK:
+            GenerateTwoDisk(count, rng, distribution);
+            break;
+    }
+    return distribution;
+}
+
+std::vector<Body> CreateBodies(const Distribution& distribution)
+{
+    std::vector<Body> bodies;
+    bodies.reserve(distribution.positions.size());
+    for(std::size_t i = 0; i < distribution.positions.size(); i++)
+    {
+        bodies.emplace_back(distribution.positions[i], distribution.velocities[i]);
+    }
+    return bodies;
+}
+
+const char* GetDistributionName(DistributionType type)
+{
+    switch(type)
+    {
+        case DistributionType::UNIFORM:  return "uniform";
+        case DistributionType::PLUMMER:  return "plummer";
+        case DistributionType::TWO_DISK: return "twodisk";
+        default:                         return "unknown";
+    }
+}
+
+bool ParseDistribution(const std::string& name, DistributionType& type)
+{
+    for(DistributionType t : { DistributionType::UNIFORM, DistributionType::PLUMMER, DistributionType::TWO_DISK })
+    {
+        if(name == GetDistributionName(t))
+        {
+            type = t;
+            return true;
+        }
+    }
+    std::cerr << "Unknown distribution '" << name << "', expected uniform, plummer or twodisk." << std::endl;
+    return false;
+}
@@ -1,7 +1,101 @@
+#include <algorithm>
+#include <bit>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
 #include <fstream>
 
 #include "../include/draw.h"
+#include "../include/threadpool.h"
+
+// Instance attributes are read straight out of these, tightly packed
+static_assert(sizeof(PVector3) == 3 * sizeof(GLfloat));
+static_assert(sizeof(UVector4) == 4 * sizeof(GLubyte));
+
+static constexpr std::size_t ENCODE_GRAIN = 65536;
+
+// Round to nearest even, overflow goes to infinity
+static std::uint16_t FloatToHalf(float value)
+{
+    std::uint32_t bits = std::bit_cast<std::uint32_t>(value);
+    const std::uint16_t sign = static_cast<std::uint16_t>((bits >> 16) & 0x8000u);
+    bits &= 0x7FFFFFFFu;
+
+    if(bits >= 0x47800000u)
+    {
+        return sign | ((bits > 0x7F800000u) ? 0x7E00u : 0x7C00u);
+    }
+    if(bits < 0x38800000u)
+    {
+        // Subnormal, counted in units of 2^-24
+        return sign | static_cast<std::uint16_t>(std::nearbyint(std::bit_cast<float>(bits) * 16777216.0f));
+    }
+    const std::uint32_t rounded = bits + 0x0FFFu + ((bits >> 13) & 1u);
+    return sign | static_cast<std::uint16_t>((rounded - 0x38000000u) >> 13);
+}
+
+static void ComputeBounds(const PVector3* p, std::size_t count, PVector3& min, PVector3& max)
+{
+    std::mutex mergeMutex;
+    min = { std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max() };
+    max = { std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest() };
+
+    ThreadPool::Global().parallelFor(0, count, [&](std::size_t begin, std::size_t end) {
+        PVector3 cmin = p[begin];
+        PVector3 cmax = p[begin];
+        for(std::size_t i = begin; i < end; i++)
+        {
+            for(int c = 0; c < 3; c++)
+            {
+                cmin.data[c] = std::min(cmin.data[c], p[i].data[c]);
+                cmax.data[c] = std::max(cmax.data[c], p[i].data[c]);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        for(int c = 0; c < 3; c++)
+        {
+            min.data[c] = std::min(min.data[c], cmin.data[c]);
+            max.data[c] = std::max(max.data[c], cmax.data[c]);
+        }
+    }, ENCODE_GRAIN);
+}
+
+static void EncodeUnorm16(const PVector3* p, std::size_t count, const PVector3& origin, const PVector3& scale, std::uint16_t* out)
+{
+    PVector3 inverse;
+    for(int c = 0; c < 3; c++)
+    {
+        inverse.data[c] = (scale.data[c] > 0.0f) ? 65535.0f / scale.data[c] : 0.0f;
+    }
+
+    ThreadPool::Global().parallelFor(0, count, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; i++)
+        {
+            for(int c = 0; c < 3; c++)
+            {
+                const float q = std::clamp((p[i].data[c] - origin.data[c]) * inverse.data[c], 0.0f, 65535.0f);
+                out[3 * i + c] = static_cast<std::uint16_t>(q + 0.5f);
+            }
+        }
+    }, ENCODE_GRAIN);
+}
+
+static void EncodeHalf16(const PVector3* p, std::size_t count, const PVector3& origin, std::uint16_t* out)
+{
+    ThreadPool::Global().parallelFor(0, count, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; i++)
+        {
+            for(int c = 0; c < 3; c++)
+            {
+                out[3 * i + c] = FloatToHalf(p[i].data[c] - origin.data[c]);
+            }
+        }
+    }, ENCODE_GRAIN);
+}
 
 GenShader::GenShader() : activeProgram(0)
 {
@@ -26,10 +120,16 @@ bool GenShader::swap(const std::string& name) const
     }
 
     activeProgram = shader->second;
+    activeName = name;
     glUseProgram(activeProgram);
     return true;
 }
 
+const std::string& GenShader::getActive() const
+{
+    return activeName;
+}
+
 void GenShader::setRenderTarget()
 {
 
@@ -139,22 +239,22 @@ InstanceState::InstanceState()
     };
 
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertex_data), vertex_data, GL_STATIC_DRAW);
-
-    glGenBuffers(1, &position);
-    glBindBuffer(GL_ARRAY_BUFFER, position);
-    glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCE_PARTICLES * 3 * sizeof(GLfloat), nullptr, GL_STREAM_DRAW);
-
-    glGenBuffers(1, &color);
-    glBindBuffer(GL_ARRAY_BUFFER, color);
-    glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCE_PARTICLES * 4 * sizeof(GLubyte), nullptr, GL_STREAM_DRAW);
-
     setAttribute(0, billboard, 3, GL_FLOAT, false);
-    setAttribute(1, position, 3, GL_FLOAT, true);
-    setAttribute(2, color, 4, GL_UNSIGNED_BYTE, true);
+
+    // Instance buffers get their storage on the first update, once the particle count is known
 }
 
 InstanceState::~InstanceState()
 {
+    for(std::size_t i = 0; i < INSTANCE_RING_SIZE; i++)
+    {
+        if(fences[i]) glDeleteSync(fences[i]);
+    }
+    if(mappedPositions)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, position);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
     glDeleteBuffers(1, &billboard);
     glDeleteBuffers(1, &position);
     glDeleteBuffers(1, &color);
@@ -163,32 +263,294 @@ InstanceState::~InstanceState()
 
 void InstanceState::updatePositions(const std::vector<PVector3>* p)
 {
-    glBindBuffer(GL_ARRAY_BUFFER, position);
-    glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCE_PARTICLES * 3 * sizeof(GLfloat), nullptr, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, p->size() * 3 * sizeof(GLfloat), p->data());
-    particleCount = p->size();
+    updatePositions(p->data(), p->size());
+}
+
+void InstanceState::updatePositions(const PVector3* p, std::size_t count)
+{
+    if(positionFormat == PositionFormat::FLOAT32)
+    {
+        positionOrigin = {0.0f, 0.0f, 0.0f};
+        positionScale = {1.0f, 1.0f, 1.0f};
+        PVector3* target = reinterpret_cast<PVector3*>(mapRegion(count));
+        if(particleCount > 0)
+        {
+            std::memcpy(target, p, particleCount * sizeof(PVector3));
+        }
+        return;
+    }
+
+    std::uint16_t* target = reinterpret_cast<std::uint16_t*>(mapRegion(count));
+    if(particleCount == 0) return;
+
+    PVector3 min, max;
+    ComputeBounds(p, particleCount, min, max);
+    if(positionFormat == PositionFormat::UNORM16)
+    {
+        positionOrigin = min;
+        positionScale = max - min;
+        EncodeUnorm16(p, particleCount, positionOrigin, positionScale, target);
+    }
+    else
+    {
+        positionOrigin = 0.5f * (min + max);
+        positionScale = {1.0f, 1.0f, 1.0f};
+        EncodeHalf16(p, particleCount, positionOrigin, target);
+    }
 }
 
 void InstanceState::updateColors(const std::vector<UVector4>* c)
 {
+    updateColors(c->data(), c->size());
+}
+
+void InstanceState::updateColors(const UVector4* c, std::size_t count)
+{
+    // Sized by the positions, growing here would recreate the buffers after this frame's positions were written
+    // Only the first particleCount colours are drawn and those always fit
+    count = std::min(count, capacity);
+    if(color == 0 || count == 0) return;
+    if(!colorsDirty && c == colorSource && count == colorCount) return;
+
     glBindBuffer(GL_ARRAY_BUFFER, color);
-    glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCE_PARTICLES * 4 * sizeof(GLubyte), nullptr, GL_STREAM_DRAW);
-    glBufferSubData(GL_ARRAY_BUFFER, 0, c->size() * 4 * sizeof(GLubyte), c->data());
+    glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(UVector4), c);
+    colorSource = c;
+    colorCount = count;
+    colorsDirty = false;
+}
+
+void InstanceState::markColorsDirty()
+{
+    colorsDirty = true;
+}
+
+void InstanceState::setPositionFormat(PositionFormat format)
+{
+    positionFormat = format;
 }
 
-void InstanceState::draw() const
+InstanceState::PositionFormat InstanceState::getPositionFormat() const
+{
+    return positionFormat;
+}
+
+const char* InstanceState::GetPositionFormatName(PositionFormat format)
+{
+    switch(format)
+    {
+        case PositionFormat::FLOAT32: return "float32";
+        case PositionFormat::UNORM16: return "unorm16";
+        case PositionFormat::HALF16:  return "half16";
+        default:                      return "unknown";
+    }
+}
+
+bool InstanceState::ParsePositionFormat(const std::string& name, PositionFormat& format)
+{
+    for(PositionFormat f : { PositionFormat::FLOAT32, PositionFormat::UNORM16, PositionFormat::HALF16 })
+    {
+        if(name == GetPositionFormatName(f))
+        {
+            format = f;
+            return true;
+        }
+    }
+    std::cerr << "Unknown position format '" << name << "', expected float32, unorm16 or half16." << std::endl;
+    return false;
+}
+
+const PVector3& InstanceState::getPositionOrigin() const
+{
+    return positionOrigin;
+}
+
+const PVector3& InstanceState::getPositionScale() const
+{
+    return positionScale;
+}
+
+std::size_t InstanceState::getPositionBytes() const
+{
+    return particleCount * getPositionStride();
+}
+
+void InstanceState::draw()
 {
     if(particleCount < 1) return;
 
     glBindVertexArray(vao);
     glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, particleCount);
+
+    // The region can be written again once this draw is done with it
+    if(fences[region]) glDeleteSync(fences[region]);
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+unsigned char* InstanceState::mapRegion(std::size_t count)
+{
+    if(count > MAX_INSTANCE_PARTICLES)
+    {
+        std::cerr << "Only the first " << MAX_INSTANCE_PARTICLES << " particles can be drawn." << std::endl;
+        count = MAX_INSTANCE_PARTICLES;
+    }
+    reserve(count);
+
+    region = (region + 1) % INSTANCE_RING_SIZE;
+    waitRegion(region);
+    particleCount = count;
+
+    const std::size_t offset = region * capacity * positionStride;
+    switch(positionFormat)
+    {
+        case PositionFormat::FLOAT32:
+            setAttribute(1, position, 3, GL_FLOAT, true, offset);
+            break;
+        case PositionFormat::UNORM16:
+            setAttribute(1, position, 3, GL_UNSIGNED_SHORT, true, offset);
+            break;
+        case PositionFormat::HALF16:
+            setAttribute(1, position, 3, GL_HALF_FLOAT, true, offset);
+            break;
+    }
+    return mappedPositions + offset;
+}
+
+std::size_t InstanceState::getPositionStride() const
+{
+    return (positionFormat == PositionFormat::FLOAT32) ? sizeof(PVector3) : 3 * sizeof(std::uint16_t);
+}
+
+void InstanceState::reserve(std::size_t count)
+{
+    if(count <= capacity && position != 0 && positionStride == getPositionStride()) return;
+
+    // Immutable storage can't be resized, both buffers are recreated with some headroom
+    if(count > capacity) capacity = std::max<std::size_t>({ count, capacity + capacity / 2, 1024 });
+    capacity = std::min<std::size_t>(capacity, MAX_INSTANCE_PARTICLES);
+    for(std::size_t i = 0; i < INSTANCE_RING_SIZE; i++)
+    {
+        waitRegion(i);
+    }
+    if(mappedPositions)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, position);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    glDeleteBuffers(1, &position);
+    glDeleteBuffers(1, &color);
+
+    positionStride = getPositionStride();
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    const GLsizeiptr positionBytes = INSTANCE_RING_SIZE * capacity * positionStride;
+    glGenBuffers(1, &position);
+    glBindBuffer(GL_ARRAY_BUFFER, position);
+    glBufferStorage(GL_ARRAY_BUFFER, positionBytes, nullptr, flags);
+    mappedPositions = static_cast<unsigned char*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, positionBytes, flags));
+
+    glGenBuffers(1, &color);
+    glBindBuffer(GL_ARRAY_BUFFER, color);
+    glBufferStorage(GL_ARRAY_BUFFER, capacity * sizeof(UVector4), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    setAttribute(2, color, 4, GL_UNSIGNED_BYTE, true);
+
+    colorsDirty = true;
+    particleCount = 0;
 }
 
-void InstanceState::setAttribute(int location, GLuint buffer, int size, GLenum type, bool perInstance) const
+void InstanceState::waitRegion(std::size_t region)
+{
+    if(!fences[region]) return;
+
+    while(true)
+    {
+        const GLenum status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000);
+        if(status != GL_TIMEOUT_EXPIRED) break;
+    }
+    glDeleteSync(fences[region]);
+    fences[region] = nullptr;
+}
+
+void InstanceState::setAttribute(int location, GLuint buffer, int size, GLenum type, bool perInstance, std::size_t offset) const
 {
     glBindVertexArray(vao);
     glEnableVertexAttribArray(location);
     glBindBuffer(GL_ARRAY_BUFFER, buffer);
-    glVertexAttribPointer(location, size, type, (type == GL_FLOAT) ? GL_FALSE : GL_TRUE, 0, (void*)0);
+    const GLboolean normalized = (type == GL_UNSIGNED_BYTE || type == GL_UNSIGNED_SHORT) ? GL_TRUE : GL_FALSE;
+    glVertexAttribPointer(location, size, type, normalized, 0, reinterpret_cast<void*>(offset));
     glVertexAttribDivisor(location, perInstance ? 1 : 0);
 }
+
+LineState::LineState()
+{
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(LineVertex), (void*)offsetof(LineVertex, position));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(LineVertex), (void*)offsetof(LineVertex, color));
+}
+
+LineState::~LineState()
+{
+    glDeleteBuffers(1, &buffer);
+    glDeleteVertexArrays(1, &vao);
+}
+
+void LineState::update(const std::vector<LineVertex>& vertices)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, buffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(LineVertex), vertices.data(), GL_STREAM_DRAW);
+    vertexCount = vertices.size();
+}
+
+void LineState::draw() const
+{
+    if(vertexCount < 2) return;
+
+    glBindVertexArray(vao);
+    glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(vertexCount));
+}
+
+ImageState::ImageState()
+{
+    // The vertices come from gl_VertexID, core profile still wants a bound vertex array
+    glGenVertexArrays(1, &vao);
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+ImageState::~ImageState()
+{
+    glDeleteTextures(1, &texture);
+    glDeleteVertexArrays(1, &vao);
+}
+
+void ImageState::update(const UVector4* rgba, int width, int height)
+{
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if(width != this->width || height != this->height)
+    {
+        this->width = width;
+        this->height = height;
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+        return;
+    }
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, rgba);
+}
+
+void ImageState::draw() const
+{
+    if(width < 1 || height < 1) return;
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
@@ -0,0 +1,185 @@
+#include "../include/ensemble.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+
+#include "../include/scene.h"
+#include "../include/simulation.h"
+#include "../include/snapshot.h"
+
+EnsembleRunner::EnsembleRunner(ThreadPool& pool, const std::string& outputDir, unsigned long long snapshotEvery)
+    : pool(pool), outputDir(outputDir), snapshotEvery(std::max(snapshotEvery, 1ULL))
+{
+
+}
+
+bool EnsembleRunner::load(const std::string& path)
+{
+    std::ifstream input(path);
+    if(!input)
+    {
+        std::cerr << "Failed to open ensemble file '" << path << "'." << std::endl;
+        return false;
+    }
+
+    std::size_t lineNumber = 0;
+    for(std::string line; std::getline(input, line);)
+    {
+        lineNumber++;
+        if(line.empty() || line[0] == '#') continue;
+
+        std::istringstream tokens(line);
+        EnsembleRun run;
+        if(!(tokens >> run.scene >> run.steps))
+        {
+            std::cerr << "Ensemble file '" << path << "' line " << lineNumber << ": expected '<scene> <steps>'." << std::endl;
+            return false;
+        }
+
+        for(std::string token; tokens >> token;)
+        {
+            std::size_t eq = token.find('=');
+            if(eq == std::string::npos)
+            {
+                std::cerr << "Ensemble file '" << path << "' line " << lineNumber << ": expected '<name>=<value>', got '" << token << "'." << std::endl;
+                return false;
+            }
+
+            std::string key = token.substr(0, eq);
+            double value = std::stod(token.substr(eq + 1));
+            if(key == "thr")
+            {
+                run.thr = static_cast<float>(value);
+            }
+            else
+            {
+                run.parameters[key] = value;
+            }
+        }
+        runs.push_back(run);
+    }
+
+    std::cout << "Loaded " << runs.size() << " ensemble runs from '" << path << "'." << std::endl;
+    return true;
+}
+
+void EnsembleRunner::add(const EnsembleRun& run)
+{
+    runs.push_back(run);
+}
+
+std::size_t EnsembleRunner::run()
+{
+    std::error_code ec;
+    std::filesystem::create_directories(outputDir, ec);
+
+    std::vector<std::future<void>> futures;
+    std::vector<char> results(runs.size(), 0);
+    std::vector<double> seconds(runs.size(), 0.0);
+    std::atomic<std::size_t> finished = 0;
+
+    {
+        // Workers take the GIL only while they talk to their scene script
+        pybind11::gil_scoped_release release;
+
+        for(std::size_t i = 0; i < runs.size(); i++)
+        {
+            futures.push_back(pool.submit([this, i, &results, &seconds, &finished]() {
+                auto start = std::chrono::steady_clock::now();
+                results[i] = runOne(i);
+                seconds[i] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+                std::size_t count = ++finished;
+                std::cout << "Ensemble run " << i << " " << (results[i] ? "done" : "FAILED") << " (" << count << "/" << runs.size() << ")." << std::endl;
+            }));
+        }
+
+        for(auto& future : futures)
+        {
+            future.wait();
+        }
+    }
+
+    // Keep a manifest next to the outputs so the sweep can be matched back to its parameters
+    std::ofstream manifest(outputDir + "/ensemble.csv");
+    manifest << "run,scene,steps,thr,parameters,status,seconds" << std::endl;
+
+    std::size_t failed = 0;
+    for(std::size_t i = 0; i < runs.size(); i++)
+    {
+        manifest << i << "," << runs[i].scene << "," << runs[i].steps << "," << runs[i].thr << ",";
+        for(const auto& [key, value] : runs[i].parameters)
+        {
+            manifest << key << "=" << value << " ";
+        }
+        manifest << "," << (results[i] ? "ok" : "failed") << "," << seconds[i] << std::endl;
+        failed += results[i] ? 0 : 1;
+    }
+    return failed;
+}
+
+bool EnsembleRunner::runOne(std::size_t index)
+{
+    const EnsembleRun& run = runs[index];
+
+    // Bodies live in this thread's pools, so the whole run stays on this worker
+    std::optional<PythonScene> scene;
+    {
+        pybind11::gil_scoped_acquire gil;
+        try
+        {
+            scene.emplace(run.scene, run.parameters);
+        }
+        catch(const std::exception& e)
+        {
+            std::cerr << "Ensemble run " << index << " failed to load scene '" << run.scene << "': " << e.what() << std::endl;
+            return false;
+        }
+    }
+
+    std::ostringstream path;
+    path << outputDir << "/run_" << std::setw(5) << std::setfill('0') << index << SnapshotHeader::SNAPSHOT_EXTENSION;
+
+    bool ok = false;
+    if(scene->getBodies()->empty())
+    {
+        // A script that fails to parse only reports it and leaves the scene empty, there is nothing to write
+        std::cerr << "Ensemble run " << index << " has no bodies, scene '" << run.scene << "' failed to load." << std::endl;
+    }
+    else
+    {
+        SnapshotWriter writer(path.str(), Body::GetColorPool());
+        if(!writer.isOpen())
+        {
+            std::cerr << "Ensemble run " << index << " failed to open '" << path.str() << "'." << std::endl;
+        }
+        else
+        {
+            Simulation simulation(scene->getBodies());
+
+            for(unsigned long long step = 0; step < run.steps; step++)
+            {
+                if(step % snapshotEvery == 0)
+                {
+                    writer.write(Body::GetLinearPositionPool());
+                }
+                simulation.step(run.thr);
+            }
+            writer.write(Body::GetLinearPositionPool());
+            ok = writer.isOpen();
+        }
+    }
+
+    {
+        pybind11::gil_scoped_acquire gil;
+        scene.reset();
+    }
+    Body::ResetPools();
+    return ok;
+}
@@ -0,0 +1,28 @@
+#include "../include/forcelaw.h"
+#include <iostream>
+
+const char* ForceLaw::GetTypeName(Type type)
+{
+    switch(type)
+    {
+        case Type::LOG:     return "log";
+        case Type::PLUMMER: return "plummer";
+        case Type::SPLINE:  return "spline";
+        case Type::POWER:   return "power";
+        default:            return "unknown";
+    }
+}
+
+bool ForceLaw::ParseType(const std::string& name, Type& type)
+{
+    for(Type t : { Type::LOG, Type::PLUMMER, Type::SPLINE, Type::POWER })
+    {
+        if(name == GetTypeName(t))
+        {
+            type = t;
+            return true;
+        }
+    }
+    std::cerr << "Unknown force law '" << name << "', expected log, plummer, spline or power." << std::endl;
+    return false;
+}
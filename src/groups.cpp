@@ -0,0 +1,166 @@
+#include "../include/groups.h"
+#include "../include/threadpool.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+GroupFinder::GroupFinder(float linkingLength, std::size_t minMembers)
+    : linkingLength(linkingLength), minMembers(minMembers)
+{
+
+}
+
+const std::vector<BodyGroup>& GroupFinder::find(const BHTree& tree)
+{
+    const std::vector<const Body*>& bodies = tree.getBodies();
+
+    std::size_t count = 0;
+    for(const Body* body : bodies)
+    {
+        count = std::max(count, body->getIndex() + 1);
+    }
+
+    // Every body starts as its own set
+    parents = std::vector<std::atomic<unsigned int>>(count);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        parents[i].store(static_cast<unsigned int>(i), std::memory_order_relaxed);
+    }
+
+    ThreadPool::Global().parallelFor(0, bodies.size(), [&](std::size_t begin, std::size_t end) {
+        std::vector<const Body*> neighbours;
+        for(std::size_t i = begin; i < end; i++)
+        {
+            const Body* body = bodies[i];
+            neighbours.clear();
+            tree.queryRange(body->getPosition(), linkingLength, neighbours);
+
+            const unsigned int self = static_cast<unsigned int>(body->getIndex());
+            for(const Body* neighbour : neighbours)
+            {
+                // Each pair is seen from both sides, link it only once
+                const unsigned int other = static_cast<unsigned int>(neighbour->getIndex());
+                if(other > self) unite(self, other);
+            }
+        }
+    }, 256);
+
+    // Flatten, then keep the sets that are large enough
+    std::vector<unsigned int> roots(count);
+    ThreadPool::Global().parallelFor(0, count, [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; i++)
+        {
+            roots[i] = findRoot(static_cast<unsigned int>(i));
+        }
+    });
+
+    std::vector<std::size_t> sizes(count, 0);
+    for(const Body* body : bodies)
+    {
+        sizes[roots[body->getIndex()]]++;
+    }
+
+    std::vector<unsigned int> kept;
+    for(std::size_t i = 0; i < count; i++)
+    {
+        if(sizes[i] >= minMembers && sizes[i] > 0) kept.push_back(static_cast<unsigned int>(i));
+    }
+    std::sort(kept.begin(), kept.end(), [&sizes](unsigned int a, unsigned int b) { return sizes[a] > sizes[b]; });
+
+    std::vector<int> rootToGroup(count, -1);
+    for(std::size_t g = 0; g < kept.size(); g++)
+    {
+        rootToGroup[kept[g]] = static_cast<int>(g);
+    }
+
+    groups.assign(kept.size(), BodyGroup{ 0, 0.0f, {0.0f, 0.0f, 0.0f}, {0.0f, 0.0f, 0.0f} });
+    groupIds.assign(count, -1);
+    for(const Body* body : bodies)
+    {
+        const int g = rootToGroup[roots[body->getIndex()]];
+        groupIds[body->getIndex()] = g;
+        if(g < 0) continue;
+
+        BodyGroup& group = groups[g];
+        const float mass = body->getMass();
+        group.members++;
+        group.mass += mass;
+        group.centerOfMass += mass * body->getPosition();
+        group.velocity += mass * body->getVelocity();
+    }
+
+    for(auto& group : groups)
+    {
+        group.centerOfMass = group.centerOfMass / group.mass;
+        group.velocity = group.velocity / group.mass;
+    }
+
+    return groups;
+}
+
+const std::vector<BodyGroup>& GroupFinder::getGroups() const
+{
+    return groups;
+}
+
+const std::vector<int>& GroupFinder::getGroupIds() const
+{
+    return groupIds;
+}
+
+bool GroupFinder::writeCatalogue(const std::string& path, unsigned long long step) const
+{
+    const bool exists = std::ifstream(path).good();
+    std::ofstream output(path, std::ios::app);
+    if(!output)
+    {
+        std::cerr << "Failed to open group catalogue '" << path << "'." << std::endl;
+        return false;
+    }
+
+    if(!exists)
+    {
+        output << "step,group,members,mass,cx,cy,cz,vx,vy,vz" << std::endl;
+    }
+
+    for(std::size_t g = 0; g < groups.size(); g++)
+    {
+        const BodyGroup& group = groups[g];
+        output << step << "," << g << "," << group.members << "," << group.mass << ","
+               << group.centerOfMass.x << "," << group.centerOfMass.y << "," << group.centerOfMass.z << ","
+               << group.velocity.x << "," << group.velocity.y << "," << group.velocity.z << "\n";
+    }
+    return true;
+}
+
+unsigned int GroupFinder::findRoot(unsigned int i)
+{
+    // Path halving, losing a race here only makes the path a bit longer
+    while(true)
+    {
+        unsigned int parent = parents[i].load(std::memory_order_relaxed);
+        if(parent == i) return i;
+
+        unsigned int grandparent = parents[parent].load(std::memory_order_relaxed);
+        if(grandparent != parent)
+        {
+            parents[i].compare_exchange_weak(parent, grandparent, std::memory_order_relaxed);
+        }
+        i = grandparent;
+    }
+}
+
+void GroupFinder::unite(unsigned int a, unsigned int b)
+{
+    // Always hang the larger root under the smaller one so no cycles can form
+    while(true)
+    {
+        a = findRoot(a);
+        b = findRoot(b);
+        if(a == b) return;
+        if(a < b) std::swap(a, b);
+
+        unsigned int expected = a;
+        if(parents[a].compare_exchange_strong(expected, b, std::memory_order_acq_rel)) return;
+    }
+}
@@ -0,0 +1,122 @@
+#include "../include/heapstats.h"
+#include <atomic>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+// Constant initialized, so allocations made before main are counted too
+static std::atomic<unsigned long long> Allocations = 0;
+static std::atomic<unsigned long long> Frees = 0;
+static std::atomic<std::size_t> LiveBytes = 0;
+static std::atomic<std::size_t> PeakBytes = 0;
+
+static unsigned long long FrameStartAllocations = 0;
+static unsigned long long FrameAllocations = 0;
+static std::vector<float> FrameAllocationHistory;
+
+HeapSnapshot HeapStats::Get()
+{
+    HeapSnapshot snapshot;
+    snapshot.allocations = Allocations.load(std::memory_order_relaxed);
+    snapshot.frees = Frees.load(std::memory_order_relaxed);
+    snapshot.liveBytes = LiveBytes.load(std::memory_order_relaxed);
+    snapshot.peakBytes = PeakBytes.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+void HeapStats::ResetPeak()
+{
+    PeakBytes.store(LiveBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void HeapStats::EndFrame()
+{
+    const unsigned long long allocations = Allocations.load(std::memory_order_relaxed);
+    FrameAllocations = allocations - FrameStartAllocations;
+    FrameStartAllocations = allocations;
+
+    FrameAllocationHistory.push_back(static_cast<float>(FrameAllocations));
+    if(FrameAllocationHistory.size() > HEAPSTATS_HISTORY_SIZE)
+    {
+        FrameAllocationHistory.erase(FrameAllocationHistory.begin());
+    }
+}
+
+unsigned long long HeapStats::GetFrameAllocations()
+{
+    return FrameAllocations;
+}
+
+const std::vector<float>& HeapStats::GetFrameAllocationHistory()
+{
+    return FrameAllocationHistory;
+}
+
+#ifdef STARWELL_HEAP_STATS
+// Sizes come from malloc_usable_size so frees balance no matter which delete overload the caller used
+static void CountAllocation(void* p)
+{
+    const std::size_t bytes = malloc_usable_size(p);
+    Allocations.fetch_add(1, std::memory_order_relaxed);
+    const std::size_t live = LiveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+
+    std::size_t peak = PeakBytes.load(std::memory_order_relaxed);
+    while(live > peak && !PeakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+}
+
+static void CountFree(void* p)
+{
+    Frees.fetch_add(1, std::memory_order_relaxed);
+    LiveBytes.fetch_sub(malloc_usable_size(p), std::memory_order_relaxed);
+}
+
+static void* Allocate(std::size_t size, std::size_t alignment, bool nothrow)
+{
+    void* p = nullptr;
+    if(alignment <= alignof(std::max_align_t))
+    {
+        p = std::malloc(size ? size : 1);
+    }
+    else if(posix_memalign(&p, alignment, size ? size : 1) != 0)
+    {
+        p = nullptr;
+    }
+
+    if(!p)
+    {
+        if(nothrow) return nullptr;
+        throw std::bad_alloc();
+    }
+    CountAllocation(p);
+    return p;
+}
+
+static void Free(void* p)
+{
+    if(!p) return;
+    CountFree(p);
+    std::free(p);
+}
+
+void* operator new(std::size_t size) { return Allocate(size, 0, false); }
+void* operator new[](std::size_t size) { return Allocate(size, 0, false); }
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return Allocate(size, 0, true); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return Allocate(size, 0, true); }
+void* operator new(std::size_t size, std::align_val_t alignment) { return Allocate(size, static_cast<std::size_t>(alignment), false); }
+void* operator new[](std::size_t size, std::align_val_t alignment) { return Allocate(size, static_cast<std::size_t>(alignment), false); }
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return Allocate(size, static_cast<std::size_t>(alignment), true); }
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept { return Allocate(size, static_cast<std::size_t>(alignment), true); }
+
+void operator delete(void* p) noexcept { Free(p); }
+void operator delete[](void* p) noexcept { Free(p); }
+void operator delete(void* p, std::size_t) noexcept { Free(p); }
+void operator delete[](void* p, std::size_t) noexcept { Free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { Free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { Free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { Free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { Free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { Free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { Free(p); }
+#endif
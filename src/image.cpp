@@ -0,0 +1,357 @@
+#include "../include/image.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+static constexpr std::array<std::uint32_t, 256> MakeCRCTable()
+{
+    std::array<std::uint32_t, 256> table = {};
+    for(std::uint32_t n = 0; n < 256; n++)
+    {
+        std::uint32_t c = n;
+        for(int k = 0; k < 8; k++)
+        {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        table[n] = c;
+    }
+    return table;
+}
+
+static constexpr std::array<std::uint32_t, 256> CRCTable = MakeCRCTable();
+
+static std::uint32_t CRC32(std::uint32_t crc, const unsigned char* data, std::size_t size)
+{
+    crc = ~crc;
+    for(std::size_t i = 0; i < size; i++)
+    {
+        crc = CRCTable[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static std::uint32_t Adler32(const unsigned char* data, std::size_t size)
+{
+    std::uint32_t a = 1, b = 0;
+    while(size > 0)
+    {
+        // Largest run that can't overflow b before the modulo
+        const std::size_t run = std::min<std::size_t>(size, 5552);
+        for(std::size_t i = 0; i < run; i++)
+        {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += run;
+        size -= run;
+    }
+    return (b << 16) | a;
+}
+
+static void PutBigEndian(std::vector<unsigned char>& out, std::uint32_t value)
+{
+    out.push_back(static_cast<unsigned char>(value >> 24));
+    out.push_back(static_cast<unsigned char>(value >> 16));
+    out.push_back(static_cast<unsigned char>(value >> 8));
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+// Deflate bits go out least significant first, Huffman codes most significant first
+class BitWriter
+{
+public:
+    explicit BitWriter(std::vector<unsigned char>& out) : out(out) {  }
+
+    void put(std::uint32_t value, int bits)
+    {
+        buffer |= static_cast<std::uint64_t>(value) << count;
+        count += bits;
+        while(count >= 8)
+        {
+            out.push_back(static_cast<unsigned char>(buffer));
+            buffer >>= 8;
+            count -= 8;
+        }
+    }
+
+    void putCode(std::uint32_t code, int bits)
+    {
+        std::uint32_t reversed = 0;
+        for(int i = 0; i < bits; i++)
+        {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        put(reversed, bits);
+    }
+
+    void flush()
+    {
+        if(count > 0) out.push_back(static_cast<unsigned char>(buffer));
+        buffer = 0;
+        count = 0;
+    }
+
+private:
+    std::vector<unsigned char>& out;
+    std::uint64_t buffer = 0;
+    int count = 0;
+};
+
+static void PutLiteralLength(BitWriter& bits, int symbol)
+{
+    // Fixed Huffman code of RFC 1951 3.2.6
+    if(symbol < 144)      bits.putCode(0x30 + symbol, 8);
+    else if(symbol < 256) bits.putCode(0x190 + symbol - 144, 9);
+    else if(symbol < 280) bits.putCode(symbol - 256, 7);
+    else                  bits.putCode(0xC0 + symbol - 280, 8);
+}
+
+static void PutMatch(BitWriter& bits, int length, int distance)
+{
+    static constexpr int lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static constexpr int lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static constexpr int distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    static constexpr int distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+    int l = 28;
+    while(lengthBase[l] > length) l--;
+    PutLiteralLength(bits, 257 + l);
+    bits.put(length - lengthBase[l], lengthExtra[l]);
+
+    int d = 29;
+    while(distanceBase[d] > distance) d--;
+    bits.putCode(d, 5);
+    bits.put(distance - distanceBase[d], distanceExtra[d]);
+}
+
+static int MatchLength(const unsigned char* a, const unsigned char* b, int limit)
+{
+    int length = 0;
+    while(length + 8 <= limit)
+    {
+        std::uint64_t x, y;
+        std::memcpy(&x, a + length, 8);
+        std::memcpy(&y, b + length, 8);
+        if(x != y) return length + std::countr_zero(x ^ y) / 8; // First differing byte, little endian
+        length += 8;
+    }
+    while(length < limit && a[length] == b[length]) length++;
+    return length;
+}
+
+// One fixed Huffman block with hash chained LZ77, rendered frames are mostly background so this goes a long way
+static void Deflate(const std::vector<unsigned char>& data, std::vector<unsigned char>& out)
+{
+    static constexpr int WINDOW = 32768;
+    static constexpr int MIN_MATCH = 3;
+    static constexpr int MAX_MATCH = 258;
+    static constexpr int MAX_CHAIN = 32;
+    static constexpr int HASH_BITS = 15;
+    static constexpr int MAX_INSERT = 32; // Longer matches skip hashing their interior, runs of background stay cheap
+
+    BitWriter bits(out);
+    bits.put(1, 1); // Final block
+    bits.put(1, 2); // Fixed Huffman
+
+    const int size = static_cast<int>(data.size());
+    std::vector<int> head(1 << HASH_BITS, -1);
+    std::vector<int> previous(WINDOW, -1);
+    auto hash = [&data](int i) {
+        const std::uint32_t v = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+        return static_cast<int>((v * 2654435761u) >> (32 - HASH_BITS));
+    };
+    auto insert = [&](int i) {
+        const int h = hash(i);
+        previous[i & (WINDOW - 1)] = head[h];
+        head[h] = i;
+    };
+
+    int i = 0;
+    while(i < size)
+    {
+        int bestLength = 0;
+        int bestDistance = 0;
+        if(i + MIN_MATCH <= size)
+        {
+            const int limit = std::min(MAX_MATCH, size - i);
+            int candidate = head[hash(i)];
+            for(int chain = 0; chain < MAX_CHAIN && candidate >= 0 && i - candidate <= WINDOW; chain++)
+            {
+                const int length = MatchLength(data.data() + candidate, data.data() + i, limit);
+                if(length > bestLength)
+                {
+                    bestLength = length;
+                    bestDistance = i - candidate;
+                    if(length == limit) break;
+                }
+
+                // Slots are reused once the window moves on, a newer entry ends the chain
+                const int next = previous[candidate & (WINDOW - 1)];
+                if(next >= candidate) break;
+                candidate = next;
+            }
+        }
+
+        if(bestLength >= MIN_MATCH)
+        {
+            PutMatch(bits, bestLength, bestDistance);
+            if(bestLength <= MAX_INSERT)
+            {
+                for(int j = 0; j < bestLength; j++)
+                {
+                    if(i + j + MIN_MATCH <= size) insert(i + j);
+                }
+            }
+            else
+            {
+                insert(i);
+            }
+            i += bestLength;
+        }
+        else
+        {
+            PutLiteralLength(bits, data[i]);
+            if(i + MIN_MATCH <= size) insert(i);
+            i++;
+        }
+    }
+
+    PutLiteralLength(bits, 256);
+    bits.flush();
+}
+
+static int Paeth(int a, int b, int c)
+{
+    const int p = a + b - c;
+    const int pa = std::abs(p - a);
+    const int pb = std::abs(p - b);
+    const int pc = std::abs(p - c);
+    if(pa <= pb && pa <= pc) return a;
+    return (pb <= pc) ? b : c;
+}
+
+// Scanlines with the filter byte in front, each row takes the filter with the smallest absolute sum
+static std::vector<unsigned char> FilterRows(int width, int height, const unsigned char* rgba, bool flipRows)
+{
+    static constexpr int BPP = 3;
+    const std::size_t stride = static_cast<std::size_t>(width) * BPP;
+    std::vector<unsigned char> filtered((stride + 1) * height);
+    std::vector<unsigned char> row(stride), above(stride, 0);
+    std::array<std::vector<unsigned char>, 5> candidates;
+    for(auto& candidate : candidates) candidate.resize(stride);
+
+    for(int y = 0; y < height; y++)
+    {
+        const unsigned char* source = rgba + static_cast<std::size_t>(flipRows ? height - 1 - y : y) * width * 4;
+        for(int x = 0; x < width; x++)
+        {
+            row[x * BPP + 0] = source[x * 4 + 0];
+            row[x * BPP + 1] = source[x * 4 + 1];
+            row[x * BPP + 2] = source[x * 4 + 2];
+        }
+
+        // None, Sub, Up, Average, Paeth
+        for(std::size_t i = 0; i < stride; i++)
+        {
+            const int a = (i >= BPP) ? row[i - BPP] : 0;
+            const int b = above[i];
+            const int c = (i >= BPP) ? above[i - BPP] : 0;
+            candidates[0][i] = row[i];
+            candidates[1][i] = static_cast<unsigned char>(row[i] - a);
+            candidates[2][i] = static_cast<unsigned char>(row[i] - b);
+            candidates[3][i] = static_cast<unsigned char>(row[i] - (a + b) / 2);
+            candidates[4][i] = static_cast<unsigned char>(row[i] - Paeth(a, b, c));
+        }
+
+        std::size_t bestFilter = 0;
+        unsigned long long bestSum = ~0ULL;
+        for(std::size_t filter = 0; filter < candidates.size(); filter++)
+        {
+            unsigned long long sum = 0;
+            for(unsigned char value : candidates[filter])
+            {
+                sum += std::abs(static_cast<signed char>(value));
+            }
+            if(sum < bestSum)
+            {
+                bestSum = sum;
+                bestFilter = filter;
+            }
+        }
+
+        unsigned char* target = filtered.data() + y * (stride + 1);
+        target[0] = static_cast<unsigned char>(bestFilter);
+        std::copy(candidates[bestFilter].begin(), candidates[bestFilter].end(), target + 1);
+        std::swap(row, above);
+    }
+    return filtered;
+}
+
+static void PutChunk(std::vector<unsigned char>& png, const char* type, const std::vector<unsigned char>& data)
+{
+    PutBigEndian(png, static_cast<std::uint32_t>(data.size()));
+    const std::size_t start = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    PutBigEndian(png, CRC32(0, png.data() + start, png.size() - start));
+}
+
+static bool WriteFile(const std::string& path, const unsigned char* data, std::size_t size)
+{
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if(!file)
+    {
+        std::cerr << "Failed to open image file '" << path << "' for writing." << std::endl;
+        return false;
+    }
+    file.write(reinterpret_cast<const char*>(data), size);
+    return static_cast<bool>(file);
+}
+
+bool WritePNG(const std::string& path, int width, int height, const unsigned char* rgba, bool flipRows)
+{
+    if(width <= 0 || height <= 0) return false;
+
+    const std::vector<unsigned char> filtered = FilterRows(width, height, rgba, flipRows);
+    std::vector<unsigned char> zlib = { 0x78, 0x01 };
+    Deflate(filtered, zlib);
+    PutBigEndian(zlib, Adler32(filtered.data(), filtered.size()));
+
+    std::vector<unsigned char> header;
+    PutBigEndian(header, static_cast<std::uint32_t>(width));
+    PutBigEndian(header, static_cast<std::uint32_t>(height));
+    header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bit RGB, deflate, adaptive filters, no interlace
+
+    std::vector<unsigned char> png = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    PutChunk(png, "IHDR", header);
+    PutChunk(png, "IDAT", zlib);
+    PutChunk(png, "IEND", {});
+    return WriteFile(path, png.data(), png.size());
+}
+
+bool WriteRaw(const std::string& path, int width, int height, const unsigned char* rgba, bool flipRows)
+{
+    if(width <= 0 || height <= 0) return false;
+
+    std::vector<unsigned char> rgb(static_cast<std::size_t>(width) * height * 3);
+    for(int y = 0; y < height; y++)
+    {
+        const unsigned char* source = rgba + static_cast<std::size_t>(flipRows ? height - 1 - y : y) * width * 4;
+        unsigned char* target = rgb.data() + static_cast<std::size_t>(y) * width * 3;
+        for(int x = 0; x < width; x++)
+        {
+            target[x * 3 + 0] = source[x * 4 + 0];
+            target[x * 3 + 1] = source[x * 4 + 1];
+            target[x * 3 + 2] = source[x * 4 + 2];
+        }
+    }
+    return WriteFile(path, rgb.data(), rgb.size());
+}
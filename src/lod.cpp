@@ -0,0 +1,79 @@
+#include "../include/lod.h"
+#include "../include/profiler.h"
+#include <algorithm>
+#include <cmath>
+
+void LevelOfDetail::select(const BHTree& tree, const Camera& camera, int viewportHeight, float spriteRadius)
+{
+    PROFILE_SCOPE("lod select");
+    const BHView view = MakeView(camera, viewportHeight, spriteRadius);
+    tree.selectLOD(view, minPixels, static_cast<std::size_t>(std::clamp(budget, 1, LOD_MAX_BUDGET)), sprites, &stats);
+
+    // Aggregates take the colour of a representative body of their cell
+    const std::vector<UVector4>& pool = *Body::GetColorPool();
+    positions.resize(sprites.size());
+    colors.resize(sprites.size());
+    representedBodies = 0;
+    for(std::size_t i = 0; i < sprites.size(); i++)
+    {
+        const BHSprite& sprite = sprites[i];
+        const std::size_t index = sprite.body->getIndex();
+        positions[i] = sprite.position;
+        colors[i] = (index < pool.size()) ? pool[index] : UVector4{ 255, 255, 255, 255 };
+        representedBodies += sprite.count;
+    }
+
+    version++;
+    ready = true;
+}
+
+BHView LevelOfDetail::MakeView(const Camera& camera, int viewportHeight, float spriteRadius)
+{
+    // Gribb/Hartmann, the clip space planes pulled back through the view projection matrix
+    const PMatrix4 matrix = camera.getMatrix();
+    const PVector4 r0 = matrix.getRow(0);
+    const PVector4 r1 = matrix.getRow(1);
+    const PVector4 r2 = matrix.getRow(2);
+    const PVector4 r3 = matrix.getRow(3);
+
+    BHView view;
+    view.planes = { r3 + r0, r3 - r0, r3 + r1, r3 - r1, r3 + r2, r3 - r2 };
+
+    // Both camera types, the ray through the center starts on the near plane right in front of the eye
+    PVector3 direction;
+    camera.getRay(0.0f, 0.0f, view.eye, direction);
+
+    view.pixelsPerUnit = std::max(viewportHeight, 1) / (2.0f * std::tan(0.5f * camera.getFov()));
+    view.margin = spriteRadius;
+    return view;
+}
+
+bool LevelOfDetail::hasResult() const
+{
+    return ready;
+}
+
+unsigned long long LevelOfDetail::getVersion() const
+{
+    return version;
+}
+
+const std::vector<PVector3>& LevelOfDetail::getPositions() const
+{
+    return positions;
+}
+
+const std::vector<UVector4>& LevelOfDetail::getColors() const
+{
+    return colors;
+}
+
+const BHLODStats& LevelOfDetail::getStats() const
+{
+    return stats;
+}
+
+std::size_t LevelOfDetail::getRepresentedBodies() const
+{
+    return representedBodies;
+}
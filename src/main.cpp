@@ -3,6 +3,9 @@
 
 #include <stperf.h>
 #include <config.h>
+#include <algorithm>
+#include <memory>
+#include <string>
 
 #include "../include/math.h"
 #include "../include/camera.h"
@@ -11,9 +14,567 @@
 #include "../include/rwindow.h"
 #include "../include/draw.h"
 #include "../include/scene.h"
+#include "../include/snapshot.h"
+#include "../include/stream.h"
+#include "../include/simulation.h"
+#include "../include/ensemble.h"
+#include "../include/threadpool.h"
+#include "../include/groups.h"
+#include "../include/analysis.h"
+#include "../include/diagnostics.h"
+#include "../include/heapstats.h"
+#include "../include/profiler.h"
+#include "../include/offscreen.h"
+#include "../include/cpudispatch.h"
+#include <filesystem>
+#include <chrono>
+#include <cstdio>
+#include <thread>
 
-int main(void)
+struct Options
 {
+    bool headless = false;
+    unsigned long long steps = 1000;
+    std::string scene = "scenes.galaxies";
+    std::string snapshot;
+    unsigned long long snapshotEvery = 1;
+    std::string replay;
+    std::string stream;
+    std::string attach;
+    std::string control;
+    float thr = 0.5f;
+    std::string ensemble;
+    std::string output = "ensemble";
+    std::size_t threads = 0;
+    float fofLinkingLength = 0.0f;
+    unsigned long long fofEvery = 100;
+    std::size_t fofMinMembers = 8;
+    std::string analysis;
+    int analysisEvery = 10;
+    int conservationEvery = 100;
+    std::string trace;
+    int telemetryEvery = 100;
+    InstanceState::PositionFormat positions = InstanceState::PositionFormat::FLOAT32;
+    std::string record;
+    unsigned long long recordEvery = 1;
+    int recordWidth = 1920;
+    int recordHeight = 1080;
+    FrameWriter::Format recordFormat = FrameWriter::Format::PNG;
+    OffscreenRenderer::Mode recordRenderer = OffscreenRenderer::Mode::BILLBOARDS;
+    Simulation::Engine engine = Simulation::Engine::AUTO;
+    Simulation::EscaperPolicy escapers = Simulation::EscaperPolicy::KEEP;
+    float escapeFactor = Simulation::SIMULATION_DEFAULT_ESCAPE_FACTOR;
+    ForceLaw forceLaw;
+    CpuPath cpuPath = CpuPath::AVX512; // Cap on the kernel paths, the best detected one by default
+};
+
+struct RunState
+{
+    bool paused = false;
+    unsigned long long pendingSteps = 0;
+};
+
+static void PrintUsage(const char* exe)
+{
+    std::cout << "Usage: " << exe << " [options]" << std::endl;
+    std::cout << "  --headless            Run without a window" << std::endl;
+    std::cout << "  --steps <n>           Number of steps to run when headless (default 1000)" << std::endl;
+    std::cout << "  --scene <module>      Python scene module (default scenes.galaxies)" << std::endl;
+    std::cout << "  --snapshot <file>     Record positions to a snapshot file" << std::endl;
+    std::cout << "  --snapshot-every <n>  Record every n steps (default 1)" << std::endl;
+    std::cout << "  --replay <path>       Open a snapshot file or directory in the viewer" << std::endl;
+    std::cout << "  --stream <name>       Publish positions to a shared memory stream (e.g. /starwell)" << std::endl;
+    std::cout << "  --attach <name>       View a shared memory stream published by another process" << std::endl;
+    std::cout << "  --control <path>      Control socket, served by the simulation or used by --attach" << std::endl;
+    std::cout << "  --thr <value>         Barnes-Hut opening threshold (default 0.5)" << std::endl;
+    std::cout << "  --ensemble <file>     Run every scene listed in file concurrently (headless)" << std::endl;
+    std::cout << "  --output <dir>        Ensemble output directory (default ensemble)" << std::endl;
+    std::cout << "  --threads <n>         Worker threads (default: all cores)" << std::endl;
+    std::cout << "  --cpu-path <path>     Highest kernel path: auto, scalar, sse4, avx2 or avx512 (default auto)" << std::endl;
+    std::cout << "  --fof <length>        Find friends-of-friends groups with this linking length" << std::endl;
+    std::cout << "  --fof-every <n>       Run the group finder every n steps (default 100)" << std::endl;
+    std::cout << "  --fof-min <n>         Minimum members for a group (default 8)" << std::endl;
+    std::cout << "  --analysis <file>     Compute radial profiles while headless and export them to file" << std::endl;
+    std::cout << "  --analysis-every <n>  Profile every n steps (default 10)" << std::endl;
+    std::cout << "  --engine <name>       Force engine: auto, tree or direct (default auto, direct below 20k bodies)" << std::endl;
+    std::cout << "  --force-law <law>     log (|F| ~ 1/r), plummer or spline (softened 1/r^2) or power (default log)" << std::endl;
+    std::cout << "  --softening <length>  Plummer radius or spline length (default 1)" << std::endl;
+    std::cout << "  --force-exponent <p>  Exponent of the power law, |F| ~ 1/r^p (default 2)" << std::endl;
+    std::cout << "  --escapers <policy>   Far-flung bodies: keep (in the tree), monopole (out of it) or remove (default keep)" << std::endl;
+    std::cout << "  --escape-factor <f>   Escape beyond f times the radius of 90% of the bodies (default 10)" << std::endl;
+    std::cout << "  --conservation <n>    Log energy and momentum drift every n steps when headless (default 100, 0 to disable)" << std::endl;
+    std::cout << "  --trace <file>        Capture a Chrome/Perfetto trace of the whole run to file" << std::endl;
+    std::cout << "  --telemetry <n>       Log tree and heap statistics every n steps when headless (default 100, 0 to disable)" << std::endl;
+    std::cout << "  --positions <format>  Instance upload format: float32, unorm16 or half16 (default float32)" << std::endl;
+    std::cout << "  --record <dir>        Render headless steps offscreen and write them to dir as an image sequence" << std::endl;
+    std::cout << "  --record-every <n>    Record every n steps (default 1)" << std::endl;
+    std::cout << "  --record-size <WxH>   Recorded frame size (default 1920x1080)" << std::endl;
+    std::cout << "  --record-format <f>   Frame format: png or raw rgb24 (default png)" << std::endl;
+    std::cout << "  --record-renderer <r> billboards (offscreen GL) or splat (CPU density, no GL needed) (default billboards)" << std::endl;
+}
+
+static bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        std::string arg = argv[i];
+        bool hasValue = (i + 1 < argc);
+
+        if(arg == "--headless")
+        {
+            options.headless = true;
+        }
+        else if(arg == "--steps" && hasValue)
+        {
+            options.steps = std::stoull(argv[++i]);
+        }
+        else if(arg == "--scene" && hasValue)
+        {
+            options.scene = argv[++i];
+        }
+        else if(arg == "--snapshot" && hasValue)
+        {
+            options.snapshot = argv[++i];
+        }
+        else if(arg == "--snapshot-every" && hasValue)
+        {
+            options.snapshotEvery = std::max(std::stoull(argv[++i]), 1ULL);
+        }
+        else if(arg == "--replay" && hasValue)
+        {
+            options.replay = argv[++i];
+        }
+        else if(arg == "--stream" && hasValue)
+        {
+            options.stream = argv[++i];
+        }
+        else if(arg == "--attach" && hasValue)
+        {
+            options.attach = argv[++i];
+        }
+        else if(arg == "--control" && hasValue)
+        {
+            options.control = argv[++i];
+        }
+        else if(arg == "--thr" && hasValue)
+        {
+            options.thr = std::stof(argv[++i]);
+        }
+        else if(arg == "--ensemble" && hasValue)
+        {
+            options.ensemble = argv[++i];
+        }
+        else if(arg == "--output" && hasValue)
+        {
+            options.output = argv[++i];
+        }
+        else if(arg == "--threads" && hasValue)
+        {
+            options.threads = std::stoull(argv[++i]);
+        }
+        else if(arg == "--cpu-path" && hasValue)
+        {
+            if(!CpuDispatch::ParsePath(argv[++i], options.cpuPath)) return false;
+        }
+        else if(arg == "--fof" && hasValue)
+        {
+            options.fofLinkingLength = std::stof(argv[++i]);
+        }
+        else if(arg == "--fof-every" && hasValue)
+        {
+            options.fofEvery = std::max(std::stoull(argv[++i]), 1ULL);
+        }
+        else if(arg == "--fof-min" && hasValue)
+        {
+            options.fofMinMembers = std::stoull(argv[++i]);
+        }
+        else if(arg == "--analysis" && hasValue)
+        {
+            options.analysis = argv[++i];
+        }
+        else if(arg == "--analysis-every" && hasValue)
+        {
+            options.analysisEvery = std::max(std::stoi(argv[++i]), 1);
+        }
+        else if(arg == "--engine" && hasValue)
+        {
+            if(!Simulation::ParseEngine(argv[++i], options.engine)) return false;
+        }
+        else if(arg == "--force-law" && hasValue)
+        {
+            if(!ForceLaw::ParseType(argv[++i], options.forceLaw.type)) return false;
+        }
+        else if(arg == "--softening" && hasValue)
+        {
+            options.forceLaw.softening = std::stof(argv[++i]);
+        }
+        else if(arg == "--force-exponent" && hasValue)
+        {
+            options.forceLaw.exponent = std::stof(argv[++i]);
+        }
+        else if(arg == "--escapers" && hasValue)
+        {
+            if(!Simulation::ParseEscaperPolicy(argv[++i], options.escapers)) return false;
+        }
+        else if(arg == "--escape-factor" && hasValue)
+        {
+            options.escapeFactor = std::stof(argv[++i]);
+        }
+        else if(arg == "--conservation" && hasValue)
+        {
+            options.conservationEvery = std::max(std::stoi(argv[++i]), 0);
+        }
+        else if(arg == "--trace" && hasValue)
+        {
+            options.trace = argv[++i];
+        }
+        else if(arg == "--telemetry" && hasValue)
+        {
+            options.telemetryEvery = std::max(std::stoi(argv[++i]), 0);
+        }
+        else if(arg == "--positions" && hasValue)
+        {
+            if(!InstanceState::ParsePositionFormat(argv[++i], options.positions)) return false;
+        }
+        else if(arg == "--record" && hasValue)
+        {
+            options.record = argv[++i];
+        }
+        else if(arg == "--record-every" && hasValue)
+        {
+            options.recordEvery = std::max(std::stoull(argv[++i]), 1ULL);
+        }
+        else if(arg == "--record-size" && hasValue)
+        {
+            const std::string size = argv[++i];
+            if(std::sscanf(size.c_str(), "%dx%d", &options.recordWidth, &options.recordHeight) != 2 || options.recordWidth <= 0 || options.recordHeight <= 0)
+            {
+                std::cerr << "Invalid frame size '" << size << "', expected WxH." << std::endl;
+                return false;
+            }
+        }
+        else if(arg == "--record-format" && hasValue)
+        {
+            if(!FrameWriter::ParseFormat(argv[++i], options.recordFormat)) return false;
+        }
+        else if(arg == "--record-renderer" && hasValue)
+        {
+            if(!OffscreenRenderer::ParseMode(argv[++i], options.recordRenderer)) return false;
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if(options.escapers == Simulation::EscaperPolicy::REMOVE && !options.snapshot.empty())
+    {
+        std::cerr << "Snapshots need a fixed body count, --escapers remove can't be combined with --snapshot." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static void RecordStep(SnapshotWriter* writer, unsigned long long step, const Options& options)
+{
+    if(writer && (step % options.snapshotEvery) == 0)
+    {
+        PROFILE_SCOPE("snapshot");
+        writer->write(Body::GetLinearPositionPool());
+    }
+}
+
+static std::unique_ptr<GroupFinder> CreateGroupFinder(const Options& options)
+{
+    if(options.fofLinkingLength <= 0.0f) return nullptr;
+    return std::make_unique<GroupFinder>(options.fofLinkingLength, options.fofMinMembers);
+}
+
+// Runs on the built tree, the catalogue goes next to the snapshot if there is one
+static void FindGroups(GroupFinder* finder, Simulation& simulation, unsigned long long step, const Options& options)
+{
+    if(!finder || (step % options.fofEvery) != 0) return;
+    PROFILE_SCOPE("groups");
+
+    finder->find(*simulation.getTree());
+
+    std::filesystem::path catalogue = options.snapshot.empty() ? std::filesystem::path("groups.csv") : std::filesystem::path(options.snapshot).replace_extension(".groups.csv");
+    finder->writeCatalogue(catalogue.string(), step);
+}
+
+static std::unique_ptr<StreamPublisher> CreatePublisher(const Options& options)
+{
+    if(options.stream.empty()) return nullptr;
+
+    auto publisher = std::make_unique<StreamPublisher>(options.stream, Body::GetLinearPositionPool()->capacity());
+    publisher->publishColors(Body::GetColorPool());
+    return publisher;
+}
+
+// Removing escapers shifts the bodies behind them down, subscribers need the compacted colours
+static void PublishRemovals(StreamPublisher* publisher, const Simulation& simulation, unsigned long long& published)
+{
+    if(!publisher || simulation.getRemovedBodies() == published) return;
+    published = simulation.getRemovedBodies();
+    publisher->publishColors(Body::GetColorPool());
+}
+
+static void ApplyControl(ControlServer* server, RunState& state, Options& options)
+{
+    if(!server) return;
+
+    for(const auto& message : server->poll())
+    {
+        switch(message.type)
+        {
+            case ControlMessage::Type::PAUSE:
+                state.paused = true;
+                break;
+            case ControlMessage::Type::RESUME:
+                state.paused = false;
+                break;
+            case ControlMessage::Type::STEP:
+                state.pendingSteps++;
+                break;
+            case ControlMessage::Type::SET_PARAMETER:
+                if(std::string(message.parameter) == "thr")
+                {
+                    options.thr = static_cast<float>(message.value);
+                }
+                else
+                {
+                    std::cerr << "Unknown control parameter '" << message.parameter << "'." << std::endl;
+                }
+                break;
+        }
+    }
+}
+
+// Returns true if the simulation should advance this iteration
+static bool ShouldStep(RunState& state)
+{
+    if(!state.paused) return true;
+    if(state.pendingSteps == 0) return false;
+    state.pendingSteps--;
+    return true;
+}
+
+static int RunEnsemble(const Options& options)
+{
+    EnsembleRunner runner(ThreadPool::Global(), options.output, options.snapshotEvery);
+    if(!runner.load(options.ensemble)) return 1;
+
+    std::size_t failed = runner.run();
+    if(failed > 0)
+    {
+        std::cerr << failed << " ensemble runs failed." << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+static void LogConservation(const ConservationMonitor& conservation)
+{
+    const ConservationSample& sample = conservation.getLatest();
+    std::cout << "Step " << sample.step << ": E " << sample.getEnergy()
+              << " dE/K0 " << conservation.getEnergyDrift()
+              << " dP " << conservation.getMomentumDrift()
+              << " dL/L " << conservation.getAngularMomentumDrift() << std::endl;
+}
+
+static void LogTelemetry(unsigned long long step, const BHTreeStats& tree)
+{
+    std::cout << "Step " << step << ": ";
+    if(tree.nodes > 0)
+    {
+        std::cout << "tree " << tree.nodes << " nodes, depth " << tree.getMeanLeafDepth() << "/" << tree.maxDepth
+                  << ", " << tree.getBytes() / 1048576.0 << " MB (" << tree.getBytes() / static_cast<double>(tree.leaves) << " B/body"
+                  << ", peak " << tree.peakBytes / 1048576.0 << " MB), root " << tree.rootSize << ", " << tree.escapers << " escapers";
+        if(tree.removedBodies > 0)
+        {
+            std::cout << " (" << tree.removedBodies << " removed)";
+        }
+    }
+    else
+    {
+        std::cout << "no tree";
+    }
+
+    if(HeapStats::HEAPSTATS_ENABLED)
+    {
+        const HeapSnapshot heap = HeapStats::Get();
+        std::cout << "; heap " << heap.liveBytes / 1048576.0 << " MB (peak " << heap.peakBytes / 1048576.0 << " MB), "
+                  << HeapStats::GetFrameAllocations() << " allocations last step";
+    }
+    std::cout << std::endl;
+}
+
+static void StartTrace(const Options& options)
+{
+    if(options.trace.empty()) return;
+    if(!Profiler::PROFILER_ENABLED)
+    {
+        std::cerr << "Profiling is compiled out, configure with -DSTARWELL_PROFILING=ON to use --trace." << std::endl;
+        return;
+    }
+    Profiler::Global().startCapture();
+}
+
+static void FinishTrace(const Options& options)
+{
+    Profiler& profiler = Profiler::Global();
+    if(!profiler.isCapturing()) return;
+
+    profiler.stopCapture();
+    if(profiler.exportTrace(options.trace))
+    {
+        std::cout << "Trace written to " << options.trace << "." << std::endl;
+    }
+}
+
+static void LogProfile()
+{
+    if(!Profiler::PROFILER_ENABLED) return;
+
+    const Profiler& profiler = Profiler::Global();
+    std::cout << "Average step " << profiler.getFrameAverage() << " ms (last " << profiler.getFrameHistory().size() << " steps):" << std::endl;
+    for(const ProfilePhase& phase : profiler.getPhases())
+    {
+        std::cout << "  " << phase.name << " " << phase.average << " ms" << std::endl;
+    }
+}
+
+static int RunHeadless(Options& options)
+{
+    PythonScene scene(options.scene);
+    Simulation simulation(scene.getBodies());
+    simulation.setEngine(options.engine);
+    simulation.setEscaperPolicy(options.escapers, options.escapeFactor);
+    simulation.setForceLaw(options.forceLaw);
+    std::cout << "Force engine: " << Simulation::GetEngineName(simulation.getActiveEngine()) << " (" << scene.getBodies()->size() << " bodies, "
+              << ForceLaw::GetTypeName(simulation.getForceLaw().type) << " law, " << (MIXED_PRECISION ? "mixed" : "float") << " precision)." << std::endl;
+
+    std::unique_ptr<SnapshotWriter> writer;
+    if(!options.snapshot.empty())
+    {
+        writer = std::make_unique<SnapshotWriter>(options.snapshot, Body::GetColorPool());
+        if(!writer->isOpen()) return 1;
+    }
+
+    std::unique_ptr<StreamPublisher> publisher = CreatePublisher(options);
+    std::unique_ptr<GroupFinder> finder = CreateGroupFinder(options);
+    std::unique_ptr<ControlServer> server;
+
+    AnalysisPipeline analysis;
+    analysis.enabled = !options.analysis.empty();
+    analysis.every = options.analysisEvery;
+
+    ConservationMonitor conservation;
+    conservation.enabled = options.conservationEvery > 0;
+    conservation.every = std::max(options.conservationEvery, 1);
+    simulation.setMonitor(&conservation);
+
+    BHTreeStats treeStats;
+    simulation.setTreeStats(&treeStats);
+
+    if(!options.control.empty())
+    {
+        server = std::make_unique<ControlServer>(options.control);
+    }
+
+    std::unique_ptr<OffscreenRenderer> renderer;
+    if(!options.record.empty())
+    {
+        renderer = std::make_unique<OffscreenRenderer>(options.record, options.recordWidth, options.recordHeight, options.recordFormat, options.recordRenderer);
+        if(!renderer->isOK()) return 1;
+    }
+
+    StartTrace(options);
+    RunState state;
+    unsigned long long removedBodies = 0;
+    for(unsigned long long step = 0; step < options.steps;)
+    {
+        ApplyControl(server.get(), state, options);
+        if(!ShouldStep(state))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+
+        RecordStep(writer.get(), step, options);
+        if(publisher)
+        {
+            publisher->publish(Body::GetLinearPositionPool(), step);
+        }
+
+        if(renderer && (step % options.recordEvery) == 0)
+        {
+            // Encoding (and for billboards the readback too) overlaps the next steps
+            renderer->render(Body::GetLinearPositionPool(), Body::GetColorPool(), step);
+        }
+
+        simulation.buildTree();
+        PublishRemovals(publisher.get(), simulation, removedBodies);
+        FindGroups(finder.get(), simulation, step, options);
+        const bool sampled = conservation.due(step);
+        simulation.integrate(options.thr);
+        step++;
+        analysis.submit(scene.getBodies(), step);
+
+        if(sampled)
+        {
+            LogConservation(conservation);
+        }
+        Profiler::Global().endFrame();
+        HeapStats::EndFrame();
+
+        if(options.telemetryEvery > 0 && (step % options.telemetryEvery) == 0)
+        {
+            LogTelemetry(step, treeStats);
+        }
+    }
+    if(renderer)
+    {
+        renderer->finish();
+        const FrameWriter* frames = renderer->getWriter();
+        std::cout << frames->getWrittenFrames() << " frames written to " << options.record << " (" << frames->getFailedFrames()
+                  << " failed, " << renderer->getStalls() << " stalls)." << std::endl;
+    }
+    LogProfile();
+    FinishTrace(options);
+
+    if(analysis.enabled)
+    {
+        analysis.wait();
+        analysis.exportCSV(options.analysis);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+    PROFILE_THREAD("main");
+    ThreadPool::ConfigureGlobal(options.threads);
+    CpuDispatch::SetLimit(options.cpuPath);
+    std::cout << "CPU path: " << CpuDispatch::Describe() << "." << std::endl;
+
+    if(!options.ensemble.empty())
+    {
+        return RunEnsemble(options);
+    }
+
+    if(options.headless)
+    {
+        return RunHeadless(options);
+    }
+
     // Init window
     RenderWindow rwindow("starwell v" STARWELL_VERSION);
 
@@ -25,46 +586,129 @@ int main(void)
 
     // Init instances memory on GPU
     InstanceState pstate;
+    pstate.setPositionFormat(options.positions);
 
     // Init camera
     Camera camera(PRadians(90.0f), (16.0f / 9.0f), Camera::Type::LOOKAT);
     camera.set({0.0f, -20.0f, -500.0f}, {0.0f, 0.0f, 0.0f});
-    shader.load("sf", 5.0f);
+    constexpr float particleScale = 5.0f;
+    shader.load("sf", particleScale);
 
     // Scroll default behaviour
     rwindow.registerScrollCallback([&camera](double yoff) -> void {
         camera.translate(camera.getScrollSensitivity() * yoff * camera.getHeading());
     });
-    
-    // Init BH tree
-    BHTree tree;
 
     // Populate the space with the selected script
-    PythonScene scene("scenes.galaxies");
+    PythonScene scene(options.scene);
+
+    // Init BH tree
+    Simulation simulation(scene.getBodies());
+    simulation.setEngine(options.engine);
+    simulation.setMonitor(rwindow.getConservation());
+    simulation.setTreeStats(rwindow.getTreeStats());
+    simulation.setCostMap(rwindow.getCostMap());
+    simulation.setEscaperPolicy(options.escapers, options.escapeFactor);
+    simulation.setForceLaw(options.forceLaw);
+    std::cout << "Force engine: " << Simulation::GetEngineName(simulation.getActiveEngine()) << " (" << scene.getBodies()->size() << " bodies, "
+              << ForceLaw::GetTypeName(simulation.getForceLaw().type) << " law, " << (MIXED_PRECISION ? "mixed" : "float") << " precision)." << std::endl;
+
+    std::unique_ptr<SnapshotWriter> writer;
+    if(!options.snapshot.empty())
+    {
+        writer = std::make_unique<SnapshotWriter>(options.snapshot, Body::GetColorPool());
+        if(!writer->isOpen()) return 1;
+    }
+
+    if(!options.replay.empty())
+    {
+        rwindow.openReplay(options.replay);
+    }
+
+    std::unique_ptr<GroupFinder> finder = CreateGroupFinder(options);
+
+    // When attached to another process the control socket is theirs
+    std::unique_ptr<StreamPublisher> publisher;
+    std::unique_ptr<ControlServer> server;
+    if(!options.attach.empty())
+    {
+        rwindow.attachStream(options.attach, options.control);
+    }
+    else
+    {
+        publisher = CreatePublisher(options);
+        if(!options.control.empty())
+        {
+            server = std::make_unique<ControlServer>(options.control);
+        }
+    }
 
     if(rwindow.initOK())
     {
+        StartTrace(options);
+        unsigned long long step = 0;
+        unsigned long long removedBodies = 0;
+        RunState state;
         while(rwindow.windowOpen())
         {
+            ApplyControl(server.get(), state, options);
+
+            // A replay or a remote simulation needs no local simulation, just draw it
+            if(rwindow.externalSourceActive() || !ShouldStep(state))
+            {
+                // Paused bodies still get picked, the tree is only built when there is a click or level of detail is on
+                if(!rwindow.externalSourceActive() && (rwindow.hasPendingPick() || rwindow.lodActive()))
+                {
+                    BHTree* tree = simulation.getTree();
+                    rwindow.resolvePick(camera, *tree, 0.5f * particleScale);
+                    if(rwindow.lodActive())
+                    {
+                        rwindow.selectLOD(camera, *tree, 0.5f * particleScale);
+                    }
+                    simulation.resetTree();
+                }
+
+                rwindow.clearBuffer();
+                rwindow.render(camera, pstate, scene, shader);
+                rwindow.swapBuffers();
+                Profiler::Global().endFrame();
+                HeapStats::EndFrame();
+                continue;
+            }
+
+            // Recorded before stepping like the headless run, so snapshots start from the initial state
+            RecordStep(writer.get(), step, options);
+            if(publisher)
+            {
+                publisher->publish(Body::GetLinearPositionPool(), step);
+            }
+
             // Compute BHTree
-            for(auto& body : *scene.getBodies())
+            simulation.buildTree();
+            PublishRemovals(publisher.get(), simulation, removedBodies);
+            FindGroups(finder.get(), simulation, step, options);
+            if(rwindow.hasPendingPick())
+            {
+                rwindow.resolvePick(camera, *simulation.getTree(), 0.5f * particleScale);
+            }
+            if(rwindow.lodActive())
             {
-                tree.insertBody(&body);
+                rwindow.selectLOD(camera, *simulation.getTree(), 0.5f * particleScale);
             }
-            
+
             // Render
             rwindow.clearBuffer();
             rwindow.render(camera, pstate, scene, shader);
             rwindow.swapBuffers();
-            
+
             // Calculate field from BHTree and displace bodies
-            for(auto& body : *scene.getBodies())
-            {
-                PVector3 field = tree.calculateFieldOnPoint(body.getPosition(), 0.5f);
-                body.move(field);
-            }
-            tree.reset();
+            simulation.integrate(options.thr);
+            step++;
+            rwindow.getAnalysis()->submit(scene.getBodies(), step);
+            Profiler::Global().endFrame();
+            HeapStats::EndFrame();
         }
+        FinishTrace(options);
     }
     return 0;
 }
@@ -3,130 +3,16 @@
 
 #include "../include/math.h"
 
-
-    
-float PVector3::DistanceSqr(const PVector3& a, const PVector3& b)
-{
-    return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z); 
-}
-
-float PVector3::Distance(const PVector3& a, const PVector3& b)
-{
-    return std::sqrt(DistanceSqr(a, b));
-}
-
-float PVector3::InnerProduct(const PVector3& a, const PVector3& b)
-{
-    return a.x * b.x + a.y * b.y + a.z * b.z;
-}
-
-float PVector3::Magnitude(const PVector3& v)
-{
-    return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z);
-}
-
-PVector3& PVector3::operator+=(const PVector3& a)
-{
-    this->x += a.x;
-    this->y += a.y;
-    this->z += a.z;
-    return *this;
-}
-
-PVector3 operator*(float s, const PVector3& v)
-{
-    return PVector3 { s * v.x, s * v.y, s * v.z };
-}
-
-PVector3 operator*(const PVector3& a, const PVector3& b)
-{
-    return PVector3 {
-        a.data[1]*b.data[2] - a.data[2]*b.data[1],
-        a.data[2]*b.data[0] - a.data[0]*b.data[2],
-        a.data[0]*b.data[1] - a.data[1]*b.data[0]
-    };
-}
-
-PVector3 operator/(const PVector3& v, float s)
-{
-    return PVector3 { v.x / s, v.y / s, v.z / s };
-}
-
-PVector3 operator+(const PVector3& a, const PVector3& b)
-{
-    return {a.x + b.x, a.y + b.y, a.z + b.z};
-}
-
-PVector3 operator-(const PVector3& a, const PVector3& b)
-{
-    return {a.x - b.x, a.y - b.y, a.z - b.z};
-}
-
-PVector3 PVector3::Normalize(const PVector3& v)
-{
-    return v / Magnitude(v);
-}
-
 std::ostream& operator<<(std::ostream& cout, const PVector3& v)
 {
     cout << "[" << v.x << " " << v.y << " " << v.z << "]";
     return cout;
 }
 
-
-    
-float PVector4::DistanceSqr(const PVector4& a, const PVector4& b)
-{
-    return (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z) + (a.w - b.w) * (a.w - b.w); 
-}
-
-float PVector4::Distance(const PVector4& a, const PVector4& b)
-{
-    return std::sqrt(DistanceSqr(a, b));
-}
-
-float PVector4::InnerProduct(const PVector4& a, const PVector4& b)
-{
-    return a.x * b.x + a.y * b.y + a.z * b.z + a.w * b.w;
-}
-
-float PVector4::Magnitude(const PVector4& v)
-{
-    return std::sqrt(v.x * v.x + v.y * v.y + v.z * v.z + v.w * v.w);
-}
-
-PVector4& PVector4::operator+=(const PVector4& a)
-{
-    this->x += a.x;
-    this->y += a.y;
-    this->z += a.z;
-    this->w += a.w;
-    return *this;
-}
-
-PVector4 operator*(float s, const PVector4& v)
-{
-    return PVector4 { s * v.x, s * v.y, s * v.z, s * v.w };
-}
-
-PVector4 operator/(const PVector4& v, float s)
-{
-    return PVector4 { v.x / s, v.y / s, v.z / s, v.w / s };
-}
-
-PVector4 operator+(const PVector4& a, const PVector4& b)
-{
-    return {a.x + b.x, a.y + b.y, a.z + b.z, a.w + b.w};
-}
-
-PVector4 operator-(const PVector4& a, const PVector4& b)
-{
-    return {a.x - b.x, a.y - b.y, a.z - b.z, a.w - b.w};
-}
-
-PVector4 PVector4::Normalize(const PVector4& v)
+std::ostream& operator<<(std::ostream& cout, const DVector3& v)
 {
-    return v / Magnitude(v);
+    cout << "[" << v.x << " " << v.y << " " << v.z << "]";
+    return cout;
 }
 
 std::ostream& operator<<(std::ostream& cout, const PVector4& v)
@@ -135,24 +21,13 @@ std::ostream& operator<<(std::ostream& cout, const PVector4& v)
     return cout;
 }
 
-
-
-PVector4 PMatrix4::getRow(int i) const
-{
-    return PVector4 { data[0][i], data[1][i], data[2][i], data[3][i] };
-}
-
-PMatrix4 PMatrix4::Identity()
+std::ostream& operator<<(std::ostream& cout, const PMatrix4& v)
 {
-    PMatrix4 mat;
-    for(int i = 0; i < 4; i++)
-    {
-        for(int j = 0; j < 4; j++)
-        {
-            mat.data[i][j] = (i == j) ? 1.0f : 0.0f;
-        }
-    }
-    return mat;
+    cout << v.r0 << std::endl;
+    cout << v.r1 << std::endl;
+    cout << v.r2 << std::endl;
+    cout << v.r3 << std::endl;
+    return cout;
 }
 
 PMatrix4 PMatrix4::Translate(const PVector3& v)
@@ -243,58 +118,40 @@ PMatrix4 PMatrix4::LookAt(const PVector3& eye, const PVector3& center, const PVe
     return mat;
 }
 
-PMatrix4 operator*(float s, const PMatrix4& v)
-{
-    return PMatrix4 { 
-        PVector4 { s * v.r0.x, s * v.r0.y, s * v.r0.z, s * v.r0.w },
-        PVector4 { s * v.r1.x, s * v.r1.y, s * v.r1.z, s * v.r1.w },
-        PVector4 { s * v.r2.x, s * v.r2.y, s * v.r2.z, s * v.r2.w },
-        PVector4 { s * v.r3.x, s * v.r3.y, s * v.r3.z, s * v.r3.w }
-    };
-}
-
-PMatrix4 operator*(const PMatrix4& a, const PMatrix4& b)
-{
-    PMatrix4 result;
-    for(int i = 0; i < 4; i++)
+PMatrix4 PMatrix4::Inverse(const PMatrix4& m)
+{
+    // Cofactor expansion on the flat array, works the same for either storage order
+    const float* a = &m.data[0][0];
+    float inv[16];
+
+    inv[0]  =  a[5]*a[10]*a[15] - a[5]*a[11]*a[14] - a[9]*a[6]*a[15] + a[9]*a[7]*a[14] + a[13]*a[6]*a[11] - a[13]*a[7]*a[10];
+    inv[4]  = -a[4]*a[10]*a[15] + a[4]*a[11]*a[14] + a[8]*a[6]*a[15] - a[8]*a[7]*a[14] - a[12]*a[6]*a[11] + a[12]*a[7]*a[10];
+    inv[8]  =  a[4]*a[9]*a[15]  - a[4]*a[11]*a[13] - a[8]*a[5]*a[15] + a[8]*a[7]*a[13] + a[12]*a[5]*a[11] - a[12]*a[7]*a[9];
+    inv[12] = -a[4]*a[9]*a[14]  + a[4]*a[10]*a[13] + a[8]*a[5]*a[14] - a[8]*a[6]*a[13] - a[12]*a[5]*a[10] + a[12]*a[6]*a[9];
+    inv[1]  = -a[1]*a[10]*a[15] + a[1]*a[11]*a[14] + a[9]*a[2]*a[15] - a[9]*a[3]*a[14] - a[13]*a[2]*a[11] + a[13]*a[3]*a[10];
+    inv[5]  =  a[0]*a[10]*a[15] - a[0]*a[11]*a[14] - a[8]*a[2]*a[15] + a[8]*a[3]*a[14] + a[12]*a[2]*a[11] - a[12]*a[3]*a[10];
+    inv[9]  = -a[0]*a[9]*a[15]  + a[0]*a[11]*a[13] + a[8]*a[1]*a[15] - a[8]*a[3]*a[13] - a[12]*a[1]*a[11] + a[12]*a[3]*a[9];
+    inv[13] =  a[0]*a[9]*a[14]  - a[0]*a[10]*a[13] - a[8]*a[1]*a[14] + a[8]*a[2]*a[13] + a[12]*a[1]*a[10] - a[12]*a[2]*a[9];
+    inv[2]  =  a[1]*a[6]*a[15]  - a[1]*a[7]*a[14]  - a[5]*a[2]*a[15] + a[5]*a[3]*a[14] + a[13]*a[2]*a[7]  - a[13]*a[3]*a[6];
+    inv[6]  = -a[0]*a[6]*a[15]  + a[0]*a[7]*a[14]  + a[4]*a[2]*a[15] - a[4]*a[3]*a[14] - a[12]*a[2]*a[7]  + a[12]*a[3]*a[6];
+    inv[10] =  a[0]*a[5]*a[15]  - a[0]*a[7]*a[13]  - a[4]*a[1]*a[15] + a[4]*a[3]*a[13] + a[12]*a[1]*a[7]  - a[12]*a[3]*a[5];
+    inv[14] = -a[0]*a[5]*a[14]  + a[0]*a[6]*a[13]  + a[4]*a[1]*a[14] - a[4]*a[2]*a[13] - a[12]*a[1]*a[6]  + a[12]*a[2]*a[5];
+    inv[3]  = -a[1]*a[6]*a[11]  + a[1]*a[7]*a[10]  + a[5]*a[2]*a[11] - a[5]*a[3]*a[10] - a[9]*a[2]*a[7]   + a[9]*a[3]*a[6];
+    inv[7]  =  a[0]*a[6]*a[11]  - a[0]*a[7]*a[10]  - a[4]*a[2]*a[11] + a[4]*a[3]*a[10] + a[8]*a[2]*a[7]   - a[8]*a[3]*a[6];
+    inv[11] = -a[0]*a[5]*a[11]  + a[0]*a[7]*a[9]   + a[4]*a[1]*a[11] - a[4]*a[3]*a[9]  - a[8]*a[1]*a[7]   + a[8]*a[3]*a[5];
+    inv[15] =  a[0]*a[5]*a[10]  - a[0]*a[6]*a[9]   - a[4]*a[1]*a[10] + a[4]*a[2]*a[9]  + a[8]*a[1]*a[6]   - a[8]*a[2]*a[5];
+
+    const float det = a[0]*inv[0] + a[1]*inv[4] + a[2]*inv[8] + a[3]*inv[12];
+    if(std::abs(det) < 1E-30f)
     {
-        for(int j = 0; j < 4; j++)
-        {
-            result.data[i][j] = 0.0f;
-            for(int k = 0; k < 4; k++)
-            {
-                result.data[i][j] += a.data[k][j] * b.data[i][k];
-            }
-        }
+        return PMatrix4::Identity();
     }
-    return result;
-}
 
-PVector4 operator*(const PMatrix4& a, const PVector4& b)
-{
-    PVector4 result;
-    for(int i = 0; i < 4; i++)
+    PMatrix4 result;
+    float* r = &result.data[0][0];
+    for(int i = 0; i < 16; i++)
     {
-        result.data[i] = 0.0f;
-        for(int j = 0; j < 4; j++)
-        {
-            result.data[i] += a.data[j][i] * b.data[j];
-        }
+        r[i] = inv[i] / det;
     }
     return result;
 }
-
-std::ostream& operator<<(std::ostream& cout, const PMatrix4& v)
-{
-    cout << v.r0 << std::endl;
-    cout << v.r1 << std::endl;
-    cout << v.r2 << std::endl;
-    cout << v.r3 << std::endl;
-    return cout;
-}
-
-float PRadians(float degrees)
-{
-    static constexpr float A2R = 3.141592654f / 180;
-    return degrees * A2R;
-}
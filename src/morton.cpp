@@ -0,0 +1,88 @@
+#include "../include/morton.h"
+#include "../include/cpudispatch.h"
+#include "../include/threadpool.h"
+#include <algorithm>
+#include <mutex>
+
+STARWELL_KERNEL_INLINE unsigned long long SpreadBits(unsigned long long v)
+{
+    v &= 0x1FFFFFULL;
+    v = (v | (v << 32)) & 0x1F00000000FFFFULL;
+    v = (v | (v << 16)) & 0x1F0000FF0000FFULL;
+    v = (v | (v << 8))  & 0x100F00F00F00F00FULL;
+    v = (v | (v << 4))  & 0x10C30C30C30C30C3ULL;
+    v = (v | (v << 2))  & 0x1249249249249249ULL;
+    return v;
+}
+
+// Compiled for every CPU path, see ComputeMortonKeys
+STARWELL_KERNEL_INLINE void MortonKeysBody(const PVector3* points, std::size_t count, const PVector3& min, const PVector3& max, unsigned long long* keys)
+{
+    constexpr float MORTON_RANGE = static_cast<float>((1 << 21) - 1);
+
+    PVector3 scale;
+    for(int i = 0; i < 3; i++)
+    {
+        float extent = max.data[i] - min.data[i];
+        scale.data[i] = (extent > 0.0f) ? MORTON_RANGE / extent : 0.0f;
+    }
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        unsigned long long q[3];
+        for(int j = 0; j < 3; j++)
+        {
+            float v = std::clamp((points[i].data[j] - min.data[j]) * scale.data[j], 0.0f, MORTON_RANGE);
+            // Through int, the range fits and a 32 bit conversion vectorizes without AVX-512
+            q[j] = static_cast<unsigned long long>(static_cast<int>(v));
+        }
+        keys[i] = (SpreadBits(q[0]) << 2) | (SpreadBits(q[1]) << 1) | SpreadBits(q[2]);
+    }
+}
+
+STARWELL_KERNEL_VARIANTS(, MortonKeys,
+    (const PVector3* points, std::size_t count, const PVector3& min, const PVector3& max, unsigned long long* keys),
+    (points, count, min, max, keys))
+
+using MortonKeysFunction = void(const PVector3*, std::size_t, const PVector3&, const PVector3&, unsigned long long*);
+
+static const CpuKernel MortonKernel("morton");
+static MortonKeysFunction* const MortonVariants[CPU_PATH_COUNT] = STARWELL_KERNEL_TABLE(MortonKeys);
+
+void ComputeMortonKeys(const PVector3* points, std::size_t count, const PVector3& min, const PVector3& max, unsigned long long* keys)
+{
+    MortonKernel.pick(MortonVariants)(points, count, min, max, keys);
+}
+
+std::vector<std::size_t> SortByMortonKey(const std::vector<PVector3>& points)
+{
+    const std::size_t count = points.size();
+    std::vector<std::size_t> order(count);
+    if(count == 0) return order;
+
+    PVector3 min = points[0];
+    PVector3 max = points[0];
+    std::mutex boundsMutex;
+
+    ThreadPool::Global().parallelFor(0, count, [&](std::size_t begin, std::size_t end) {
+        PVector3 lmin = points[begin];
+        PVector3 lmax = points[begin];
+        BatchBounds(points.data() + begin, end - begin, lmin, lmax);
+
+        std::lock_guard<std::mutex> lock(boundsMutex);
+        min = PVector3::Min(min, lmin);
+        max = PVector3::Max(max, lmax);
+    });
+
+    std::vector<unsigned long long> keys(count);
+    ThreadPool::Global().parallelFor(0, count, [&](std::size_t begin, std::size_t end) {
+        ComputeMortonKeys(points.data() + begin, end - begin, min, max, keys.data() + begin);
+    });
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&keys](std::size_t a, std::size_t b) { return keys[a] < keys[b]; });
+    return order;
+}
@@ -0,0 +1,463 @@
+#include "../include/offscreen.h"
+#include "../include/image.h"
+#include "../include/profiler.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <GLFW/glfw3.h>
+
+OffscreenContext::OffscreenContext()
+{
+    glfwSetErrorCallback([](int error, const char* msg) {
+        std::cerr << "glfw Error : " << error << " - " << msg << std::endl;
+    });
+
+    // A display is not a given on compute nodes, each fallback needs less of the system than the one before
+    if(tryCreate(GLFW_ANY_PLATFORM, GLFW_NATIVE_CONTEXT_API))
+    {
+        backend = "hidden window";
+    }
+    else if(tryCreate(GLFW_PLATFORM_NULL, GLFW_EGL_CONTEXT_API))
+    {
+        backend = "EGL";
+    }
+    else if(tryCreate(GLFW_PLATFORM_NULL, GLFW_OSMESA_CONTEXT_API))
+    {
+        backend = "OSMesa";
+    }
+    else
+    {
+        std::cerr << "Failed to create an offscreen GL context." << std::endl;
+    }
+}
+
+OffscreenContext::~OffscreenContext()
+{
+    if(window)
+    {
+        glfwDestroyWindow(window);
+        glfwTerminate();
+    }
+}
+
+bool OffscreenContext::tryCreate(int platform, int api)
+{
+    glfwInitHint(GLFW_PLATFORM, platform);
+    if(!glfwInit()) return false;
+
+    glfwDefaultWindowHints();
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_CONTEXT_CREATION_API, api);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+
+    // Everything is drawn into the recorder's framebuffer, the window's own is never used
+    window = glfwCreateWindow(64, 64, "starwell offscreen", nullptr, nullptr);
+    if(window)
+    {
+        glfwMakeContextCurrent(window);
+        if(gladLoadGL(glfwGetProcAddress)) return true;
+
+        std::cerr << "Failed to load GL functions." << std::endl;
+        glfwDestroyWindow(window);
+        window = nullptr;
+    }
+    glfwTerminate();
+    return false;
+}
+
+bool OffscreenContext::isOK() const
+{
+    return window != nullptr;
+}
+
+const char* OffscreenContext::getBackend() const
+{
+    return backend;
+}
+
+FrameWriter::FrameWriter(const std::string& directory, int width, int height, Format format, std::size_t encoderThreads)
+    : directory(directory), width(width), height(height), format(format), encoders(std::max<std::size_t>(encoderThreads, 1))
+{
+    std::error_code error;
+    std::filesystem::create_directories(directory, error);
+    if(error)
+    {
+        std::cerr << "Failed to create frame directory '" << directory << "': " << error.message() << std::endl;
+        return;
+    }
+    ok = true;
+}
+
+FrameWriter::~FrameWriter()
+{
+    finish();
+}
+
+bool FrameWriter::isOK() const
+{
+    return ok;
+}
+
+std::shared_ptr<std::vector<unsigned char>> FrameWriter::takeBuffer()
+{
+    {
+        std::lock_guard<std::mutex> lock(bufferMutex);
+        if(!freeBuffers.empty())
+        {
+            std::shared_ptr<std::vector<unsigned char>> buffer = std::move(freeBuffers.back());
+            freeBuffers.pop_back();
+            return buffer;
+        }
+    }
+    return std::make_shared<std::vector<unsigned char>>(static_cast<std::size_t>(width) * height * 4);
+}
+
+void FrameWriter::submit(std::shared_ptr<std::vector<unsigned char>> pixels, unsigned long long frame)
+{
+    if(!ok) return;
+
+    // Retire finished encodes, too many still pending means the disk or the encoders can't keep up
+    std::erase_if(encoding, [](const std::future<void>& task) { return task.wait_for(std::chrono::seconds(0)) == std::future_status::ready; });
+    if(encoding.size() >= WRITER_MAX_QUEUED)
+    {
+        stalls++;
+        encoding.front().wait();
+        encoding.erase(encoding.begin());
+    }
+
+    encoding.push_back(encoders.submit([this, pixels = std::move(pixels), frame]() { encode(pixels, frame); }));
+}
+
+void FrameWriter::write(const unsigned char* rgba, unsigned long long frame)
+{
+    std::shared_ptr<std::vector<unsigned char>> pixels = takeBuffer();
+    std::memcpy(pixels->data(), rgba, pixels->size());
+    submit(std::move(pixels), frame);
+}
+
+void FrameWriter::finish()
+{
+    for(std::future<void>& task : encoding)
+    {
+        task.wait();
+    }
+    encoding.clear();
+}
+
+void FrameWriter::encode(std::shared_ptr<std::vector<unsigned char>> pixels, unsigned long long frame)
+{
+    PROFILE_SCOPE("encode");
+    char name[64];
+    std::snprintf(name, sizeof(name), "frame_%06llu.%s", frame, GetFormatName(format));
+    const std::string path = (std::filesystem::path(directory) / name).string();
+
+    const bool success = (format == Format::PNG) ? WritePNG(path, width, height, pixels->data(), true) : WriteRaw(path, width, height, pixels->data(), true);
+    (success ? written : failed)++;
+
+    std::lock_guard<std::mutex> lock(bufferMutex);
+    freeBuffers.push_back(std::move(pixels));
+}
+
+int FrameWriter::getWidth() const
+{
+    return width;
+}
+
+int FrameWriter::getHeight() const
+{
+    return height;
+}
+
+unsigned long long FrameWriter::getWrittenFrames() const
+{
+    return written;
+}
+
+unsigned long long FrameWriter::getFailedFrames() const
+{
+    return failed;
+}
+
+unsigned long long FrameWriter::getStalls() const
+{
+    return stalls;
+}
+
+void FrameWriter::countFailure()
+{
+    failed++;
+}
+
+const char* FrameWriter::GetFormatName(Format format)
+{
+    switch(format)
+    {
+        case Format::PNG: return "png";
+        case Format::RAW: return "raw";
+        default:          return "unknown";
+    }
+}
+
+bool FrameWriter::ParseFormat(const std::string& name, Format& format)
+{
+    for(Format f : { Format::PNG, Format::RAW })
+    {
+        if(name == GetFormatName(f))
+        {
+            format = f;
+            return true;
+        }
+    }
+    std::cerr << "Unknown frame format '" << name << "', expected png or raw." << std::endl;
+    return false;
+}
+
+FrameRecorder::FrameRecorder(const std::string& directory, int width, int height, FrameWriter::Format format)
+    : writer(directory, width, height, format), width(width), height(height)
+{
+    if(!writer.isOK()) return;
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+
+    glGenRenderbuffers(1, &colorBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+
+    glGenRenderbuffers(1, &depthBuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+    if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        std::cerr << "Offscreen framebuffer of " << width << "x" << height << " is incomplete." << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    const GLsizeiptr bytes = static_cast<GLsizeiptr>(width) * height * 4;
+    for(Slot& slot : slots)
+    {
+        glGenBuffers(1, &slot.buffer);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    ok = true;
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    finish();
+
+    for(Slot& slot : slots)
+    {
+        if(slot.fence) glDeleteSync(slot.fence);
+        glDeleteBuffers(1, &slot.buffer);
+    }
+    glDeleteRenderbuffers(1, &depthBuffer);
+    glDeleteRenderbuffers(1, &colorBuffer);
+    glDeleteFramebuffers(1, &framebuffer);
+}
+
+bool FrameRecorder::isOK() const
+{
+    return ok;
+}
+
+void FrameRecorder::bind()
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, width, height);
+}
+
+void FrameRecorder::capture(unsigned long long frame)
+{
+    if(!ok) return;
+    PROFILE_SCOPE("capture");
+
+    // Every buffer is in flight, the oldest has to come back first
+    if(queued == slots.size())
+    {
+        stalls++;
+        collect(true);
+    }
+
+    Slot& slot = slots[head];
+    slot.frame = frame;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    head = (head + 1) % slots.size();
+    queued++;
+
+    // Hand over whatever already arrived without waiting on the rest
+    while(queued > 0 && collect(false));
+}
+
+void FrameRecorder::finish()
+{
+    if(!ok) return;
+
+    while(queued > 0)
+    {
+        collect(true);
+    }
+    writer.finish();
+}
+
+bool FrameRecorder::collect(bool block)
+{
+    Slot& slot = slots[(head + slots.size() - queued) % slots.size()];
+    const GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, block ? GL_TIMEOUT_IGNORED : 0);
+    if(status == GL_TIMEOUT_EXPIRED) return false;
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    queued--;
+
+    std::shared_ptr<std::vector<unsigned char>> pixels = writer.takeBuffer();
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels->size(), GL_MAP_READ_BIT);
+    if(mapped)
+    {
+        std::memcpy(pixels->data(), mapped, pixels->size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    if(!mapped)
+    {
+        std::cerr << "Failed to map the readback of frame " << slot.frame << "." << std::endl;
+        writer.countFailure();
+        return true;
+    }
+
+    writer.submit(std::move(pixels), slot.frame);
+    return true;
+}
+
+FrameWriter* FrameRecorder::getWriter()
+{
+    return &writer;
+}
+
+unsigned long long FrameRecorder::getStalls() const
+{
+    return stalls;
+}
+
+OffscreenRenderer::OffscreenRenderer(const std::string& directory, int width, int height, FrameWriter::Format format, Mode mode)
+    : camera(PRadians(90.0f), static_cast<float>(width) / std::max(height, 1), Camera::Type::LOOKAT)
+{
+    camera.set({0.0f, -20.0f, -500.0f}, {0.0f, 0.0f, 0.0f});
+
+    if(mode == Mode::SPLAT)
+    {
+        writer = std::make_unique<FrameWriter>(directory, width, height, format);
+        if(writer->isOK()) splatter = std::make_unique<DensitySplatter>();
+        return;
+    }
+
+    context = std::make_unique<OffscreenContext>();
+    if(!context->isOK()) return;
+    std::cout << "Offscreen rendering through " << context->getBackend() << " (" << glGetString(GL_RENDERER) << ")." << std::endl;
+
+    recorder = std::make_unique<FrameRecorder>(directory, width, height, format);
+    if(!recorder->isOK()) return;
+
+    shader = std::make_unique<GenShader>();
+    if(!shader->swap("classic"))
+    {
+        std::cerr << "Classic shader not found, shaders.glsl must be in the working directory." << std::endl;
+        return;
+    }
+    shader->load("sf", OFFSCREEN_PARTICLE_SCALE);
+    instances = std::make_unique<InstanceState>();
+}
+
+bool OffscreenRenderer::isOK() const
+{
+    return instances != nullptr || splatter != nullptr;
+}
+
+void OffscreenRenderer::render(const std::vector<PVector3>* positions, const std::vector<UVector4>* colors, unsigned long long frame)
+{
+    if(!isOK()) return;
+
+    if(splatter)
+    {
+        // The writer copies the image, the next splat can start right away
+        const std::size_t count = std::min(positions->size(), colors->size());
+        splatter->render(positions->data(), colors->data(), count, camera.getMatrix(), writer->getWidth(), writer->getHeight());
+        writer->write(reinterpret_cast<const unsigned char*>(splatter->getImage().data()), frame);
+        return;
+    }
+
+    {
+        PROFILE_SCOPE("offscreen draw");
+        recorder->bind();
+        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        instances->updatePositions(positions);
+        instances->updateColors(colors);
+        shader->swap("classic");
+        shader->load("MVP", camera.getMatrix());
+        shader->load("positionOrigin", instances->getPositionOrigin());
+        shader->load("positionScale", instances->getPositionScale());
+        instances->draw();
+    }
+    recorder->capture(frame);
+}
+
+void OffscreenRenderer::finish()
+{
+    if(recorder) recorder->finish();
+    if(writer) writer->finish();
+}
+
+FrameWriter* OffscreenRenderer::getWriter()
+{
+    return recorder ? recorder->getWriter() : writer.get();
+}
+
+unsigned long long OffscreenRenderer::getStalls() const
+{
+    if(recorder) return recorder->getStalls() + recorder->getWriter()->getStalls();
+    return writer ? writer->getStalls() : 0;
+}
+
+const char* OffscreenRenderer::GetModeName(Mode mode)
+{
+    switch(mode)
+    {
+        case Mode::BILLBOARDS: return "billboards";
+        case Mode::SPLAT:      return "splat";
+        default:               return "unknown";
+    }
+}
+
+bool OffscreenRenderer::ParseMode(const std::string& name, Mode& mode)
+{
+    for(Mode m : { Mode::BILLBOARDS, Mode::SPLAT })
+    {
+        if(name == GetModeName(m))
+        {
+            mode = m;
+            return true;
+        }
+    }
+    std::cerr << "Unknown renderer '" << name << "', expected billboards or splat." << std::endl;
+    return false;
+}
@@ -0,0 +1,232 @@
+#include "../include/profiler.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+static void PushHistory(std::vector<float>& history, float value, std::size_t size)
+{
+    history.push_back(value);
+    if(history.size() > size)
+    {
+        history.erase(history.begin());
+    }
+}
+
+static float Average(const std::vector<float>& history)
+{
+    if(history.empty()) return 0.0f;
+    double sum = 0.0;
+    for(float value : history) sum += value;
+    return static_cast<float>(sum / history.size());
+}
+
+// Scope names are plain literals, only quotes and backslashes need escaping
+static void WriteJSONString(std::ostream& out, const char* text)
+{
+    out << '"';
+    for(const char* c = text; *c; c++)
+    {
+        if(*c == '"' || *c == '\\') out << '\\';
+        out << *c;
+    }
+    out << '"';
+}
+
+Profiler::Profiler()
+{
+    lastFrameEnd = Now();
+}
+
+Profiler& Profiler::Global()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+std::int64_t Profiler::Now()
+{
+    static const auto epoch = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+Profiler::ThreadTrace* Profiler::getThreadTrace()
+{
+    thread_local ThreadTrace* local = nullptr;
+    if(local) return local;
+
+    // Traces are owned by the profiler so events of finished threads can still be exported
+    std::lock_guard<std::mutex> lock(mutex);
+    auto trace = std::make_unique<ThreadTrace>();
+    trace->id = static_cast<int>(threads.size()) + 1;
+    trace->name = "thread " + std::to_string(trace->id);
+    local = trace.get();
+    threads.push_back(std::move(trace));
+    return local;
+}
+
+void Profiler::record(const char* name, std::int64_t start, std::int64_t end)
+{
+    ThreadTrace* trace = getThreadTrace();
+
+    if(trace->frameThread)
+    {
+        auto total = std::find_if(trace->frameTotals.begin(), trace->frameTotals.end(), [name](const auto& entry) { return std::strcmp(entry.first, name) == 0; });
+        if(total == trace->frameTotals.end())
+        {
+            trace->frameTotals.emplace_back(name, end - start);
+        }
+        else
+        {
+            total->second += end - start;
+        }
+    }
+
+    if(capturing.load(std::memory_order_relaxed))
+    {
+        std::lock_guard<std::mutex> lock(trace->mutex);
+        if(trace->events.size() < PROFILER_MAX_EVENTS)
+        {
+            trace->events.push_back({ name, start, end - start });
+        }
+        else
+        {
+            trace->dropped++;
+        }
+    }
+}
+
+void Profiler::setThreadName(const std::string& name)
+{
+    ThreadTrace* trace = getThreadTrace();
+    std::lock_guard<std::mutex> lock(trace->mutex);
+    trace->name = name;
+}
+
+void Profiler::endFrame()
+{
+    ThreadTrace* trace = getThreadTrace();
+    trace->frameThread = true;
+
+    const std::int64_t now = Now();
+    const float frameMs = (now - lastFrameEnd) * 1E-6f;
+    lastFrameEnd = now;
+    PushHistory(frameHistory, frameMs, PROFILER_HISTORY_SIZE);
+    frameAverage = Average(frameHistory);
+
+    // Phases missing from this frame still get a sample so every history lines up with the frame one
+    for(const auto& [name, total] : trace->frameTotals)
+    {
+        auto phase = std::find_if(phases.begin(), phases.end(), [name](const ProfilePhase& p) { return std::strcmp(p.name, name) == 0; });
+        if(phase == phases.end())
+        {
+            ProfilePhase added;
+            added.name = name;
+            added.history.assign(frameHistory.size() - 1, 0.0f);
+            phases.push_back(std::move(added));
+        }
+    }
+
+    for(ProfilePhase& phase : phases)
+    {
+        auto total = std::find_if(trace->frameTotals.begin(), trace->frameTotals.end(), [&phase](const auto& entry) { return std::strcmp(entry.first, phase.name) == 0; });
+        phase.last = (total == trace->frameTotals.end()) ? 0.0f : total->second * 1E-6f;
+        PushHistory(phase.history, phase.last, PROFILER_HISTORY_SIZE);
+        phase.average = Average(phase.history);
+    }
+    trace->frameTotals.clear();
+}
+
+const std::vector<ProfilePhase>& Profiler::getPhases() const
+{
+    return phases;
+}
+
+const std::vector<float>& Profiler::getFrameHistory() const
+{
+    return frameHistory;
+}
+
+float Profiler::getFrameAverage() const
+{
+    return frameAverage;
+}
+
+void Profiler::startCapture()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& trace : threads)
+    {
+        std::lock_guard<std::mutex> traceLock(trace->mutex);
+        trace->events.clear();
+        trace->dropped = 0;
+    }
+    capturing = true;
+}
+
+void Profiler::stopCapture()
+{
+    capturing = false;
+}
+
+bool Profiler::isCapturing() const
+{
+    return capturing;
+}
+
+std::size_t Profiler::getCapturedEventCount()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    std::size_t count = 0;
+    for(auto& trace : threads)
+    {
+        std::lock_guard<std::mutex> traceLock(trace->mutex);
+        count += trace->events.size();
+    }
+    return count;
+}
+
+bool Profiler::exportTrace(const std::string& path)
+{
+    std::ofstream file(path);
+    if(!file)
+    {
+        std::cerr << "Failed to open trace file '" << path << "'." << std::endl;
+        return false;
+    }
+
+    // Chrome trace event format, complete events (ph X) with microsecond times, one track per thread
+    file << std::fixed << std::setprecision(3);
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+    bool first = true;
+    std::size_t dropped = 0;
+    std::lock_guard<std::mutex> lock(mutex);
+    for(auto& trace : threads)
+    {
+        std::lock_guard<std::mutex> traceLock(trace->mutex);
+        if(trace->events.empty()) continue;
+        dropped += trace->dropped;
+
+        file << (first ? "\n" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << trace->id << ",\"args\":{\"name\":";
+        WriteJSONString(file, trace->name.c_str());
+        file << "}}";
+        first = false;
+
+        for(const ProfileEvent& event : trace->events)
+        {
+            file << ",\n{\"name\":";
+            WriteJSONString(file, event.name);
+            file << ",\"cat\":\"starwell\",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace->id
+                 << ",\"ts\":" << event.start * 1E-3 << ",\"dur\":" << event.duration * 1E-3 << "}";
+        }
+    }
+    file << "\n]}\n";
+
+    if(dropped > 0)
+    {
+        std::cerr << "Trace is missing " << dropped << " events, the per thread limit was reached." << std::endl;
+    }
+    return static_cast<bool>(file);
+}
@@ -0,0 +1,145 @@
+#include <array>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <pybind11/embed.h>
+#include <pybind11/numpy.h>
+#include <pybind11/stl.h>
+
+#include "../include/body.h"
+#include "../include/bhtree.h"
+
+// Native helpers for scene and analysis scripts, available as 'import starwell'
+
+using FloatArray = pybind11::array_t<float, pybind11::array::c_style | pybind11::array::forcecast>;
+
+static std::vector<PVector3> ToPoints(const FloatArray& array, const char* name)
+{
+    if(array.ndim() != 2 || array.shape(1) != 3)
+    {
+        throw std::runtime_error(std::string(name) + " must be an (N, 3) array.");
+    }
+
+    std::vector<PVector3> points(static_cast<std::size_t>(array.shape(0)));
+    std::memcpy(points.data(), array.data(), points.size() * sizeof(PVector3));
+    return points;
+}
+
+static std::vector<PVector3> GetSources(const pybind11::object& bodies)
+{
+    if(bodies.is_none())
+    {
+        return *Body::GetLinearPositionPool();
+    }
+    return ToPoints(bodies.cast<FloatArray>(), "bodies");
+}
+
+static void EvaluateField(const std::vector<PVector3>& sources, const std::vector<PVector3>& points, float thr, std::vector<PVector3>& field, std::vector<float>& potential)
+{
+    // No sources is no field, the outputs stay zero rather than uninitialized
+    field.assign(points.size(), PVector3 { 0.0f, 0.0f, 0.0f });
+    potential.assign(points.size(), 0.0f);
+    if(sources.empty() || points.empty()) return;
+
+    pybind11::gil_scoped_release release;
+
+    // Bodies are created on a scratch thread so the caller's pools (the live simulation) are left untouched
+    std::thread worker([&]() {
+        // The pools must hold every source up front, bodies point into them
+        Body::ReservePools(sources.size());
+        std::vector<Body> bodies;
+        bodies.reserve(sources.size());
+        for(const auto& source : sources)
+        {
+            bodies.emplace_back(source);
+        }
+
+        BHTree tree;
+        tree.fitRoot(bodies);
+        for(const auto& body : bodies)
+        {
+            tree.insertBody(&body);
+        }
+        tree.calculateFieldOnPoints(points, thr, field, &potential);
+        Body::ResetPools();
+    });
+    worker.join();
+}
+
+static pybind11::tuple Field(const FloatArray& points, const pybind11::object& bodies, float thr)
+{
+    std::vector<PVector3> samples = ToPoints(points, "points");
+    std::vector<PVector3> sources = GetSources(bodies);
+    std::vector<PVector3> field;
+    std::vector<float> potential;
+
+    EvaluateField(sources, samples, thr, field, potential);
+
+    const pybind11::ssize_t n = static_cast<pybind11::ssize_t>(samples.size());
+    FloatArray fieldArray(std::vector<pybind11::ssize_t>{ n, 3 });
+    FloatArray potentialArray(std::vector<pybind11::ssize_t>{ n });
+    std::memcpy(fieldArray.mutable_data(), field.data(), field.size() * sizeof(PVector3));
+    std::memcpy(potentialArray.mutable_data(), potential.data(), potential.size() * sizeof(float));
+    return pybind11::make_tuple(fieldArray, potentialArray);
+}
+
+static pybind11::tuple FieldGrid(const std::array<float, 3>& lo, const std::array<float, 3>& hi, const std::array<int, 3>& shape, const pybind11::object& bodies, float thr)
+{
+    if(shape[0] < 1 || shape[1] < 1 || shape[2] < 1)
+    {
+        throw std::runtime_error("shape must be at least (1, 1, 1).");
+    }
+
+    // Cell centered samples so a (nx, ny, 1) shape gives a 2D slice at the middle of [lo.z, hi.z]
+    std::vector<PVector3> samples;
+    samples.reserve(static_cast<std::size_t>(shape[0]) * shape[1] * shape[2]);
+    for(int i = 0; i < shape[0]; i++)
+    {
+        for(int j = 0; j < shape[1]; j++)
+        {
+            for(int k = 0; k < shape[2]; k++)
+            {
+                samples.push_back({
+                    lo[0] + (hi[0] - lo[0]) * (i + 0.5f) / shape[0],
+                    lo[1] + (hi[1] - lo[1]) * (j + 0.5f) / shape[1],
+                    lo[2] + (hi[2] - lo[2]) * (k + 0.5f) / shape[2]
+                });
+            }
+        }
+    }
+
+    std::vector<PVector3> sources = GetSources(bodies);
+    std::vector<PVector3> field;
+    std::vector<float> potential;
+
+    EvaluateField(sources, samples, thr, field, potential);
+
+    FloatArray fieldArray(std::vector<pybind11::ssize_t>{ shape[0], shape[1], shape[2], 3 });
+    FloatArray potentialArray(std::vector<pybind11::ssize_t>{ shape[0], shape[1], shape[2] });
+    std::memcpy(fieldArray.mutable_data(), field.data(), field.size() * sizeof(PVector3));
+    std::memcpy(potentialArray.mutable_data(), potential.data(), potential.size() * sizeof(float));
+    return pybind11::make_tuple(fieldArray, potentialArray);
+}
+
+static FloatArray Positions()
+{
+    const std::vector<PVector3>* positions = Body::GetLinearPositionPool();
+    FloatArray array(std::vector<pybind11::ssize_t>{ static_cast<pybind11::ssize_t>(positions->size()), 3 });
+    std::memcpy(array.mutable_data(), positions->data(), positions->size() * sizeof(PVector3));
+    return array;
+}
+
+PYBIND11_EMBEDDED_MODULE(starwell, m)
+{
+    m.doc() = "starwell native helpers";
+
+    m.def("field", &Field,
+        pybind11::arg("points"), pybind11::arg("bodies") = pybind11::none(), pybind11::arg("thr") = 0.5f,
+        "Field (N, 3) and potential (N,) at every point. Sources are the live bodies unless 'bodies' (M, 3) is given.");
+
+    m.def("field_grid", &FieldGrid,
+        pybind11::arg("lo"), pybind11::arg("hi"), pybind11::arg("shape"), pybind11::arg("bodies") = pybind11::none(), pybind11::arg("thr") = 0.5f,
+        "Field (nx, ny, nz, 3) and potential (nx, ny, nz) on a regular grid of cell centers spanning [lo, hi].");
+
+    m.def("positions", &Positions, "Copy of the live body positions as an (N, 3) array.");
+}
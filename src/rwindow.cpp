@@ -1,6 +1,8 @@
 #include "../include/rwindow.h"
 #include "../include/windows/settings.h"
+#include "../include/profiler.h"
 #include "imgui.h"
+#include <array>
 #include <GLFW/glfw3.h>
 
 // #include <memory>
@@ -15,6 +17,18 @@ static void InternalScrollCalback(GLFWwindow* window, double xoff, double yoff)
     }
 }
 
+static void InternalMouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+    // Installed after ImGui's own, so hand the event over first
+    ImGui_ImplGlfw_MouseButtonCallback(window, button, action, mods);
+
+    RenderWindow* rwindow = reinterpret_cast<RenderWindow*>(glfwGetWindowUserPointer(window));
+    if(rwindow && button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && !ImGui::GetIO().WantCaptureMouse)
+    {
+        rwindow->requestPick();
+    }
+}
+
 RenderWindow::RenderWindow(const std::string& name, bool maximized)
     : glfwOK(false), window(nullptr), width(1920), height(1080)
 {
@@ -62,10 +76,14 @@ RenderWindow::RenderWindow(const std::string& name, bool maximized)
 
     glfwSetWindowUserPointer(window, this);
     glfwSetScrollCallback(window, InternalScrollCalback);
+    glfwSetMouseButtonCallback(window, InternalMouseButtonCallback);
 }
 
 RenderWindow::~RenderWindow()
 {
+    // GL objects must go while the context is still current
+    splatImage.reset();
+    costCells.reset();
     if(window)
     {
         ImGui_ImplOpenGL3_Shutdown();
@@ -94,19 +112,35 @@ void RenderWindow::render(Camera& camera, InstanceState& pstate, PythonScene& sc
 {
     glfwPollEvents();
 
+    double now = glfwGetTime();
+    float dt = static_cast<float>(now - lastFrameTime);
+    lastFrameTime = now;
+
     // Update
-    pstate.updatePositions(Body::GetLinearPositionPool());
-    pstate.updateColors(Body::GetColorPool());
+    uploadInstances(pstate, dt);
     shader.load("MVP", camera.getMatrix());
+    shader.load("positionOrigin", pstate.getPositionOrigin());
+    shader.load("positionScale", pstate.getPositionScale());
 
     // Draw
+    {
+        PROFILE_SCOPE("draw");
+        if(splatter.enabled)
+        {
+            drawSplat(camera, shader);
+        }
+        else
+        {
+            pstate.draw();
+        }
+        drawCostCells(camera, shader);
+    }
+
+    PROFILE_SCOPE("gui");
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplGlfw_NewFrame();
     ImGui::NewFrame();
 
-    // Render pstate first
-    pstate.draw();
-
     ImGui::ShowDemoWindow();
 
     // Render GUI windows here
@@ -119,6 +153,160 @@ void RenderWindow::render(Camera& camera, InstanceState& pstate, PythonScene& sc
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
+void RenderWindow::uploadInstances(InstanceState& pstate, float dt)
+{
+    PROFILE_SCOPE("upload");
+    if(splatter.enabled)
+    {
+        // Splats read the bodies on the CPU, the sources only move on
+        // The colours are uploaded again once billboards are back
+        if(replay.isOpen()) replay.update(dt);
+        else if(stream.isAttached()) stream.acquireLatest();
+        pstate.markColorsDirty();
+        return;
+    }
+
+    if(replay.isOpen())
+    {
+        // Stream straight from the mapped snapshot into the instance buffers
+        replay.update(dt);
+        pstate.updatePositions(replay.getFrame(replay.getCurrentFrame()), replay.getBodyCount());
+        pstate.updateColors(replay.getColors(), replay.getBodyCount());
+    }
+    else if(stream.isAttached())
+    {
+        // Always take the newest frame, the previous one stays on the GPU otherwise
+        if(stream.acquireLatest())
+        {
+            pstate.updatePositions(stream.getPositions());
+            if(stream.getColorVersion() != uploadedStreamColors)
+            {
+                uploadedStreamColors = stream.getColorVersion();
+                pstate.markColorsDirty();
+            }
+            pstate.updateColors(stream.getColors());
+        }
+    }
+    else if(lod.enabled && lod.hasResult())
+    {
+        // Sprites change with every selection, so do their colours
+        pstate.updatePositions(&lod.getPositions());
+        if(lod.getVersion() != uploadedLODColors)
+        {
+            uploadedLODColors = lod.getVersion();
+            pstate.markColorsDirty();
+        }
+        pstate.updateColors(&lod.getColors());
+    }
+    else
+    {
+        pstate.updatePositions(Body::GetLinearPositionPool());
+
+        // The cost colours only replace the scene ones while they match the bodies on screen
+        const bool costColors = costMap.enabled && costMap.colorBodies && costMap.hasResult() && costMap.getColors().size() == Body::GetColorPool()->size();
+        if(costColors && costMap.getVersion() != uploadedCostColors)
+        {
+            uploadedCostColors = costMap.getVersion();
+            pstate.markColorsDirty();
+        }
+        pstate.updateColors(costColors ? &costMap.getColors() : Body::GetColorPool());
+    }
+}
+
+void RenderWindow::drawCostCells(const Camera& camera, GenShader& shader)
+{
+    if(externalSourceActive() || !costMap.enabled || !costMap.showCells) return;
+    if(!costCells) costCells = std::make_unique<LineState>();
+
+    if(costMap.getVersion() != costCellsVersion)
+    {
+        // Cells are shaded against the most expensive cell of their level, every level splits the same bodies
+        const std::vector<BHCostCell>& cells = costMap.getCells();
+        std::vector<double> levelMax;
+        for(const BHCostCell& cell : cells)
+        {
+            if(cell.level >= static_cast<int>(levelMax.size())) levelMax.resize(cell.level + 1, 0.0);
+            levelMax[cell.level] = std::max(levelMax[cell.level], cell.cost);
+        }
+
+        static constexpr int edges[12][2] = {
+            {0, 1}, {2, 3}, {4, 5}, {6, 7},
+            {0, 2}, {1, 3}, {4, 6}, {5, 7},
+            {0, 4}, {1, 5}, {2, 6}, {3, 7}
+        };
+
+        costCellVertices.clear();
+        costCellVertices.reserve(cells.size() * 24);
+        for(const BHCostCell& cell : cells)
+        {
+            const float t = (levelMax[cell.level] > 0.0) ? static_cast<float>(cell.cost / levelMax[cell.level]) : 0.0f;
+            const UVector4 color = CostMap::HeatColor(t);
+
+            std::array<PVector3, 8> corners;
+            for(int c = 0; c < 8; c++)
+            {
+                corners[c] = {
+                    (c & 4) ? cell.boundsMax.x : cell.boundsMin.x,
+                    (c & 2) ? cell.boundsMax.y : cell.boundsMin.y,
+                    (c & 1) ? cell.boundsMax.z : cell.boundsMin.z
+                };
+            }
+            for(const auto& edge : edges)
+            {
+                costCellVertices.push_back({ corners[edge[0]], color });
+                costCellVertices.push_back({ corners[edge[1]], color });
+            }
+        }
+        costCells->update(costCellVertices);
+        costCellsVersion = costMap.getVersion();
+    }
+
+    const std::string previous = shader.getActive();
+    shader.swap("wire");
+    shader.load("MVP", camera.getMatrix());
+    costCells->draw();
+    shader.swap(previous);
+}
+
+void RenderWindow::drawSplat(const Camera& camera, GenShader& shader)
+{
+    if(!splatImage) splatImage = std::make_unique<ImageState>();
+
+    int w, h;
+    glfwGetFramebufferSize(window, &w, &h);
+    if(w <= 0 || h <= 0) return;
+
+    const PVector3* positions;
+    const UVector4* colors;
+    const std::size_t count = getSourceBodies(positions, colors);
+    splatter.render(positions, colors, count, camera.getMatrix(), w, h);
+    splatImage->update(splatter.getImage().data(), splatter.getWidth(), splatter.getHeight());
+
+    const std::string previous = shader.getActive();
+    shader.swap("image");
+    splatImage->draw();
+    shader.swap(previous);
+}
+
+std::size_t RenderWindow::getSourceBodies(const PVector3*& positions, const UVector4*& colors)
+{
+    if(replay.isOpen())
+    {
+        positions = replay.getFrame(replay.getCurrentFrame());
+        colors = replay.getColors();
+        return replay.getBodyCount();
+    }
+    if(stream.isAttached())
+    {
+        positions = stream.getPositions()->data();
+        colors = stream.getColors()->data();
+        return std::min(stream.getPositions()->size(), stream.getColors()->size());
+    }
+    positions = Body::GetLinearPositionPool()->data();
+    colors = Body::GetColorPool()->data();
+    return std::min(Body::GetLinearPositionPool()->size(), Body::GetColorPool()->size());
+}
+
 void RenderWindow::clearBuffer()
 {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -126,6 +314,8 @@ void RenderWindow::clearBuffer()
 
 void RenderWindow::swapBuffers()
 {
+    // Includes the vsync wait
+    PROFILE_SCOPE("swap");
     glfwSwapBuffers(window);
 }
 
@@ -151,6 +341,148 @@ void RenderWindow::runScrollCallbacks(double yoff)
     }
 }
 
+bool RenderWindow::openReplay(const std::string& path)
+{
+    return replay.open(path);
+}
+
+void RenderWindow::closeReplay()
+{
+    replay.close();
+}
+
+bool RenderWindow::replayActive() const
+{
+    return replay.isOpen();
+}
+
+SnapshotReplay* RenderWindow::getReplay()
+{
+    return &replay;
+}
+
+bool RenderWindow::attachStream(const std::string& name, const std::string& controlPath)
+{
+    if(!stream.attach(name)) return false;
+
+    if(!controlPath.empty())
+    {
+        control.connect(controlPath);
+    }
+    return true;
+}
+
+void RenderWindow::detachStream()
+{
+    stream.detach();
+    control.disconnect();
+}
+
+bool RenderWindow::streamActive() const
+{
+    return stream.isAttached();
+}
+
+StreamSubscriber* RenderWindow::getStream()
+{
+    return &stream;
+}
+
+ControlClient* RenderWindow::getControl()
+{
+    return &control;
+}
+
+AnalysisPipeline* RenderWindow::getAnalysis()
+{
+    return &analysis;
+}
+
+void RenderWindow::requestPick()
+{
+    // Only the local simulation has a tree to pick from
+    if(externalSourceActive()) return;
+
+    double x, y;
+    int w, h;
+    glfwGetCursorPos(window, &x, &y);
+    glfwGetWindowSize(window, &w, &h);
+    if(w <= 0 || h <= 0) return;
+
+    pendingPick = true;
+    pickX = static_cast<float>(2.0 * x / w - 1.0);
+    pickY = static_cast<float>(1.0 - 2.0 * y / h);
+}
+
+bool RenderWindow::hasPendingPick() const
+{
+    return pendingPick;
+}
+
+void RenderWindow::resolvePick(const Camera& camera, const BHTree& tree, float radius)
+{
+    if(!pendingPick) return;
+    pendingPick = false;
+    PROFILE_SCOPE("pick");
+
+    PVector3 origin, direction;
+    camera.getRay(pickX, pickY, origin, direction);
+    const Body* body = tree.pickRay(origin, direction, radius);
+    if(body)
+    {
+        pickedBody = static_cast<int>(body->getIndex());
+    }
+}
+
+std::optional<int> RenderWindow::takePickedBody()
+{
+    std::optional<int> picked = pickedBody;
+    pickedBody.reset();
+    return picked;
+}
+
+bool RenderWindow::lodActive() const
+{
+    return lod.enabled && !externalSourceActive();
+}
+
+void RenderWindow::selectLOD(const Camera& camera, const BHTree& tree, float spriteRadius)
+{
+    int w, h;
+    glfwGetFramebufferSize(window, &w, &h);
+    lod.select(tree, camera, h, spriteRadius);
+}
+
+ConservationMonitor* RenderWindow::getConservation()
+{
+    return &conservation;
+}
+
+BHTreeStats* RenderWindow::getTreeStats()
+{
+    return &treeStats;
+}
+
+CostMap* RenderWindow::getCostMap()
+{
+    return &costMap;
+}
+
+LevelOfDetail* RenderWindow::getLevelOfDetail()
+{
+    return &lod;
+}
+
+DensitySplatter* RenderWindow::getSplatter()
+{
+    return &splatter;
+}
+
+bool RenderWindow::externalSourceActive() const
+{
+    return replayActive() || streamActive();
+}
+
 void RenderWindow::registerWindows()
 {
     windows.push_back(std::make_unique<SettingsWindow>(this));
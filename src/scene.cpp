@@ -8,9 +8,11 @@
 // Unless we are planning on using python out of this class
 static pybind11::scoped_interpreter interp{};
 
-PythonScene::PythonScene(const std::string& name) : name(name), module(pybind11::module_::import(name.c_str()))
+PythonScene::PythonScene(const std::string& name, const std::map<std::string, double>& parameters)
+    : name(name), parameters(parameters), module(pybind11::module_::import(name.c_str()))
 {
-    reload();
+    // import is cached, so scenes sharing a module (ensemble runs) run it once and differ only by the main arguments
+    populateBodiesFromScript();
 }
 
 void PythonScene::reload()
@@ -74,7 +76,14 @@ void PythonScene::populateBodiesFromScript()
 {
     Body::ResetPools();
     bodies.clear();
-    pybind11::tuple data = module.attr("main")();
+
+    // Parameters are forwarded as keyword arguments to the script main
+    pybind11::dict kwargs;
+    for(const auto& [key, value] : parameters)
+    {
+        kwargs[key.c_str()] = value;
+    }
+    pybind11::tuple data = module.attr("main")(**kwargs);
 
     auto nativeData = parsePythonBodyPos(data);
     if(nativeData)
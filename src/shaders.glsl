@@ -3,6 +3,8 @@
 
 uniform mat4 MVP;
 uniform float sf;
+uniform vec3 positionOrigin; // Dequantizes the compact instance formats
+uniform vec3 positionScale;
 layout(location = 0) in vec3 meshPos;
 layout(location = 1) in vec3 partPos;
 layout(location = 2) in vec4 partCol;
@@ -11,7 +13,7 @@ out vec4 color;
 
 void main()
 {
-    gl_Position = MVP * vec4(sf * meshPos + partPos, 1.0);
+    gl_Position = MVP * vec4(sf * meshPos + positionOrigin + positionScale * partPos, 1.0);
     // gl_Position = MVP * vec4(sf * meshPos + partPos, 1.0);
     color = partCol;
 }
@@ -27,3 +29,55 @@ void main()
     fcolor = color;
 }
 ---
+
+--- wire:VTX
+#version 450
+
+uniform mat4 MVP;
+layout(location = 0) in vec3 linePos;
+layout(location = 1) in vec4 lineCol;
+
+out vec4 color;
+
+void main()
+{
+    gl_Position = MVP * vec4(linePos, 1.0);
+    color = lineCol;
+}
+---
+
+--- wire:FRG
+#version 450
+in vec4 color;
+out vec4 fcolor;
+
+void main()
+{
+    fcolor = color;
+}
+---
+
+--- image:VTX
+#version 450
+
+out vec2 uv;
+
+void main()
+{
+    // One triangle covering the screen
+    uv = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    gl_Position = vec4(2.0 * uv - 1.0, 0.0, 1.0);
+}
+---
+
+--- image:FRG
+#version 450
+uniform sampler2D image;
+in vec2 uv;
+out vec4 fcolor;
+
+void main()
+{
+    fcolor = texture(image, uv);
+}
+---
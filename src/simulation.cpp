@@ -0,0 +1,370 @@
+#include "../include/simulation.h"
+#include "../include/profiler.h"
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+
+Simulation::Simulation(std::vector<Body>* bodies) : bodies(bodies)
+{
+
+}
+
+void Simulation::buildTree()
+{
+    // The direct engine has no use for the tree, getTree still builds it on demand
+    if(getActiveEngine() == Engine::DIRECT) return;
+    ensureTree();
+}
+
+void Simulation::integrate(float thr)
+{
+    const bool diagnostics = monitor && monitor->due(stepCount);
+    const bool direct = getActiveEngine() == Engine::DIRECT;
+
+    // Building the tree can remove escapers, so the sample and the field must only see the bodies left after it
+    if(!direct) ensureTree();
+
+    // Kinetic terms must be taken before anything moves
+    ConservationSample sample;
+    if(diagnostics)
+    {
+        sample.step = stepCount;
+        ConservationMonitor::Reduce(bodies, sample);
+    }
+
+    // Every field is taken from the same positions before anyone moves
+    field.resize(bodies->size());
+    double potential = 0.0;
+    if(direct)
+    {
+        potential = walkDirect(diagnostics);
+    }
+    else
+    {
+        potential = walkTree(thr, diagnostics);
+    }
+
+    {
+        PROFILE_SCOPE("integrate");
+        Body::MoveAll(bodies, field);
+    }
+
+    if(diagnostics)
+    {
+        sample.potential = potential;
+        monitor->record(sample);
+    }
+    resetTree();
+    stepCount++;
+}
+
+double Simulation::walkTree(float thr, bool diagnostics)
+{
+    PROFILE_SCOPE("walk");
+
+    // a = BODY_FIELD_GAIN * m * field and field = -grad(phi), so each pair holds gain * m^2 * phi
+    // Counting every pair from both ends needs the 1/2 (exact while all masses are equal)
+    BHWalkStats* costs = (costMap && costMap->enabled) ? costMap->begin(bodies->size()) : nullptr;
+
+    // The law is picked here once, everything below is compiled for it
+    const double potential = DispatchForceLaw(forceLaw, [&](const auto& law) {
+        // Escapers are far from the whole tree, so their pull is the same all over it and is taken once at its center of mass
+        PVector3 escaperField = {0.0f, 0.0f, 0.0f};
+        float escaperPhi = 0.0f;
+        for(std::size_t i : escapers)
+        {
+            const Body& body = (*bodies)[i];
+            escaperField += BHTree::CalculatePointField(law, tree.getCenterOfMass(), body.getPosition(), body.getMass(), &escaperPhi);
+        }
+
+        double sum = 0.0;
+        for(std::size_t i = 0; i < bodies->size(); i++)
+        {
+            const Body& body = (*bodies)[i];
+            float phi = 0.0f;
+            if(!escaping.empty() && escaping[i])
+            {
+                field[i] = tree.calculateMonopoleField(law, body.getPosition(), diagnostics ? &phi : nullptr);
+            }
+            else
+            {
+                field[i] = tree.calculateFieldOnPoint(law, body.getPosition(), thr, diagnostics ? &phi : nullptr, costs ? &costs[body.getIndex()] : nullptr);
+                field[i] += escaperField;
+                phi += escaperPhi;
+            }
+            if(diagnostics)
+            {
+                const float m = body.getMass();
+                sum += 0.5 * Body::BODY_FIELD_GAIN * m * m * phi;
+            }
+        }
+        return sum;
+    });
+
+    if(costs)
+    {
+        PROFILE_SCOPE("cost map");
+        costMap->finish(tree);
+    }
+    return potential;
+}
+
+double Simulation::walkDirect(bool diagnostics)
+{
+    PROFILE_SCOPE("direct");
+
+    direct.setSources(bodies);
+    directPoints.resize(bodies->size());
+    for(std::size_t i = 0; i < bodies->size(); i++)
+    {
+        directPoints[i] = (*bodies)[i].getPosition();
+    }
+    DispatchForceLaw(forceLaw, [&](const auto& law) {
+        direct.calculateFieldOnPoints(law, directPoints, field, diagnostics ? &directPotential : nullptr);
+    });
+
+    double potential = 0.0;
+    if(diagnostics)
+    {
+        for(std::size_t i = 0; i < bodies->size(); i++)
+        {
+            const float m = (*bodies)[i].getMass();
+            potential += 0.5 * Body::BODY_FIELD_GAIN * m * m * directPotential[i];
+        }
+    }
+    return potential;
+}
+
+void Simulation::step(float thr)
+{
+    buildTree();
+    integrate(thr);
+}
+
+void Simulation::setMonitor(ConservationMonitor* monitor)
+{
+    this->monitor = monitor;
+}
+
+void Simulation::setTreeStats(BHTreeStats* treeStats)
+{
+    this->treeStats = treeStats;
+}
+
+void Simulation::setCostMap(CostMap* costMap)
+{
+    this->costMap = costMap;
+}
+
+void Simulation::setEscaperPolicy(EscaperPolicy policy, float escapeFactor)
+{
+    escaperPolicy = policy;
+    this->escapeFactor = std::max(escapeFactor, 1.0f);
+}
+
+Simulation::EscaperPolicy Simulation::getEscaperPolicy() const
+{
+    return escaperPolicy;
+}
+
+std::size_t Simulation::getEscaperCount() const
+{
+    return escapers.size();
+}
+
+unsigned long long Simulation::getRemovedBodies() const
+{
+    return removedBodies;
+}
+
+const char* Simulation::GetEscaperPolicyName(EscaperPolicy policy)
+{
+    switch(policy)
+    {
+        case EscaperPolicy::KEEP:     return "keep";
+        case EscaperPolicy::MONOPOLE: return "monopole";
+        case EscaperPolicy::REMOVE:   return "remove";
+        default:                      return "unknown";
+    }
+}
+
+bool Simulation::ParseEscaperPolicy(const std::string& name, EscaperPolicy& policy)
+{
+    for(EscaperPolicy p : { EscaperPolicy::KEEP, EscaperPolicy::MONOPOLE, EscaperPolicy::REMOVE })
+    {
+        if(name == GetEscaperPolicyName(p))
+        {
+            policy = p;
+            return true;
+        }
+    }
+    std::cerr << "Unknown escaper policy '" << name << "', expected keep, monopole or remove." << std::endl;
+    return false;
+}
+
+void Simulation::setForceLaw(const ForceLaw& law)
+{
+    forceLaw = law;
+}
+
+const ForceLaw& Simulation::getForceLaw() const
+{
+    return forceLaw;
+}
+
+void Simulation::setEngine(Engine engine)
+{
+    this->engine = engine;
+}
+
+Simulation::Engine Simulation::getEngine() const
+{
+    return engine;
+}
+
+Simulation::Engine Simulation::getActiveEngine() const
+{
+    if(engine != Engine::AUTO) return engine;
+    return (bodies->size() < SIMULATION_DIRECT_THRESHOLD) ? Engine::DIRECT : Engine::TREE;
+}
+
+const char* Simulation::GetEngineName(Engine engine)
+{
+    switch(engine)
+    {
+        case Engine::AUTO:   return "auto";
+        case Engine::TREE:   return "tree";
+        case Engine::DIRECT: return "direct";
+        default:             return "unknown";
+    }
+}
+
+bool Simulation::ParseEngine(const std::string& name, Engine& engine)
+{
+    for(Engine e : { Engine::AUTO, Engine::TREE, Engine::DIRECT })
+    {
+        if(name == GetEngineName(e))
+        {
+            engine = e;
+            return true;
+        }
+    }
+    std::cerr << "Unknown engine '" << name << "', expected auto, tree or direct." << std::endl;
+    return false;
+}
+
+BHTree* Simulation::getTree()
+{
+    ensureTree();
+    return &tree;
+}
+
+void Simulation::resetTree()
+{
+    if(!treeBuilt) return;
+    PROFILE_SCOPE("tree reset");
+    if(treeStats)
+    {
+        *treeStats = tree.getStats();
+        treeStats->escapers = escapers.size();
+        treeStats->removedBodies = removedBodies;
+    }
+    tree.reset();
+    treeBuilt = false;
+}
+
+unsigned long long Simulation::getStep() const
+{
+    return stepCount;
+}
+
+void Simulation::ensureTree()
+{
+    if(treeBuilt) return;
+    PROFILE_SCOPE("tree build");
+    findEscapers();
+    tree.fitRoot(*bodies, escaping.empty() ? nullptr : &escaping);
+    for(std::size_t i = 0; i < bodies->size(); i++)
+    {
+        if(escaping.empty() || !escaping[i]) tree.insertBody(&(*bodies)[i]);
+    }
+    treeBuilt = true;
+}
+
+void Simulation::findEscapers()
+{
+    escaping.clear();
+    escapers.clear();
+    if(escaperPolicy == EscaperPolicy::KEEP || bodies->empty()) return;
+
+    PROFILE_SCOPE("escapers");
+    ThreadPool& pool = ThreadPool::Global();
+    constexpr std::size_t grain = 16384;
+
+    // Center of mass, summed in double so it holds up at millions of bodies
+    std::mutex mergeMutex;
+    double mass = 0.0;
+    double weighted[3] = {0.0, 0.0, 0.0};
+    pool.parallelFor(0, bodies->size(), [&](std::size_t begin, std::size_t end) {
+        double m = 0.0;
+        double w[3] = {0.0, 0.0, 0.0};
+        for(std::size_t i = begin; i < end; i++)
+        {
+            const Body& body = (*bodies)[i];
+            const PVector3 position = body.getPosition();
+            m += body.getMass();
+            for(int c = 0; c < 3; c++) w[c] += body.getMass() * position.data[c];
+        }
+
+        std::lock_guard<std::mutex> lock(mergeMutex);
+        mass += m;
+        for(int c = 0; c < 3; c++) weighted[c] += w[c];
+    }, grain);
+    if(mass <= 0.0) return;
+    const PVector3 center = { static_cast<float>(weighted[0] / mass), static_cast<float>(weighted[1] / mass), static_cast<float>(weighted[2] / mass) };
+
+    // The quantile radius follows the bulk of the bodies, a few outliers can't move it
+    distances.resize(bodies->size());
+    pool.parallelFor(0, bodies->size(), [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; i++)
+        {
+            distances[i] = PVector3::DistanceSqr((*bodies)[i].getPosition(), center);
+        }
+    }, grain);
+    const std::size_t quantile = static_cast<std::size_t>(SIMULATION_ESCAPER_QUANTILE * (distances.size() - 1));
+    std::nth_element(distances.begin(), distances.begin() + quantile, distances.end());
+    const float limitSqr = escapeFactor * escapeFactor * distances[quantile];
+
+    escaping.assign(bodies->size(), 0);
+    pool.parallelFor(0, bodies->size(), [&](std::size_t begin, std::size_t end) {
+        for(std::size_t i = begin; i < end; i++)
+        {
+            escaping[i] = PVector3::DistanceSqr((*bodies)[i].getPosition(), center) > limitSqr;
+        }
+    }, grain);
+
+    for(std::size_t i = 0; i < escaping.size(); i++)
+    {
+        if(escaping[i]) escapers.push_back(i);
+    }
+    if(escapers.empty())
+    {
+        escaping.clear();
+        return;
+    }
+
+    if(escaperPolicy == EscaperPolicy::REMOVE)
+    {
+        const std::size_t removed = Body::RemoveBodies(bodies, escaping);
+        if(removed == 0)
+        {
+            // These bodies share their pools, keep them as monopoles from now on
+            escaperPolicy = EscaperPolicy::MONOPOLE;
+            return;
+        }
+        removedBodies += removed;
+        std::cout << "Removed " << removed << " escaped bodies (" << bodies->size() << " left)." << std::endl;
+        escaping.clear();
+        escapers.clear();
+    }
+}
@@ -0,0 +1,353 @@
+#include "../include/snapshot.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SnapshotWriter::SnapshotWriter(const std::string& path, const std::vector<UVector4>* colors)
+    : path(path), output(path, std::ios::binary | std::ios::trunc)
+{
+    std::memcpy(header.magic, SnapshotHeader::SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SnapshotHeader::SNAPSHOT_VERSION;
+    header.bodyCount = colors->size();
+    header.frameCount = 0;
+
+    if(!output)
+    {
+        std::cerr << "Failed to open snapshot file '" << path << "' for writing." << std::endl;
+        return;
+    }
+
+    output.write(reinterpret_cast<const char*>(&header), sizeof(SnapshotHeader));
+    output.write(reinterpret_cast<const char*>(colors->data()), colors->size() * sizeof(UVector4));
+}
+
+SnapshotWriter::~SnapshotWriter()
+{
+    if(output)
+    {
+        output.close();
+        std::cout << "Snapshot '" << path << "' closed with " << header.frameCount << " frames." << std::endl;
+    }
+}
+
+bool SnapshotWriter::isOpen() const
+{
+    return output.is_open() && output.good();
+}
+
+void SnapshotWriter::write(const std::vector<PVector3>* positions)
+{
+    if(!isOpen()) return;
+
+    if(positions->size() != header.bodyCount)
+    {
+        std::cerr << "Snapshot frame has " << positions->size() << " bodies, expected " << header.bodyCount << ". Skipping." << std::endl;
+        return;
+    }
+
+    output.write(reinterpret_cast<const char*>(positions->data()), positions->size() * sizeof(PVector3));
+    header.frameCount++;
+
+    // Keep the header up to date so an interrupted run is still readable
+    std::streampos end = output.tellp();
+    output.seekp(0);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(SnapshotHeader));
+    output.seekp(end);
+    output.flush();
+}
+
+unsigned long long SnapshotWriter::getFrameCount() const
+{
+    return header.frameCount;
+}
+
+const std::string& SnapshotWriter::getPath() const
+{
+    return path;
+}
+
+
+SnapshotReplay::SnapshotReplay()
+{
+    prefetchThread = std::thread(&SnapshotReplay::prefetchWorker, this);
+}
+
+SnapshotReplay::~SnapshotReplay()
+{
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        prefetchStop = true;
+    }
+    prefetchCv.notify_one();
+    prefetchThread.join();
+    close();
+}
+
+bool SnapshotReplay::open(const std::string& path)
+{
+    // The prefetcher reads the mappings, hold it off while we rebuild them
+    std::lock_guard<std::mutex> mlock(mapMutex);
+    unmapAll();
+
+    std::vector<std::string> inputs;
+    std::error_code ec;
+    if(std::filesystem::is_directory(path, ec))
+    {
+        for(const auto& entry : std::filesystem::directory_iterator(path, ec))
+        {
+            if(entry.is_regular_file() && entry.path().extension() == SnapshotHeader::SNAPSHOT_EXTENSION)
+            {
+                inputs.push_back(entry.path().string());
+            }
+        }
+        std::sort(inputs.begin(), inputs.end());
+    }
+    else
+    {
+        inputs.push_back(path);
+    }
+
+    if(inputs.empty())
+    {
+        std::cerr << "No snapshots found at '" << path << "'." << std::endl;
+        return false;
+    }
+
+    for(const auto& file : inputs)
+    {
+        if(!mapFile(file))
+        {
+            unmapAll();
+            return false;
+        }
+    }
+
+    std::cout << "Replay opened with " << frames.size() << " frames of " << bodyCount << " bodies." << std::endl;
+
+    std::lock_guard<std::mutex> lock(prefetchMutex);
+    prefetchDone = prefetchTarget = std::numeric_limits<std::size_t>::max();
+    return !frames.empty();
+}
+
+void SnapshotReplay::close()
+{
+    std::lock_guard<std::mutex> mlock(mapMutex);
+    unmapAll();
+}
+
+void SnapshotReplay::unmapAll()
+{
+    for(auto& file : files)
+    {
+        munmap(file.data, file.size);
+    }
+    files.clear();
+    frames.clear();
+    colors = nullptr;
+    bodyCount = 0;
+    currentFrame = 0;
+    frameAccumulator = 0.0f;
+    playing = false;
+}
+
+bool SnapshotReplay::isOpen() const
+{
+    return !frames.empty();
+}
+
+void SnapshotReplay::update(float dt)
+{
+    if(!isOpen()) return;
+
+    if(playing)
+    {
+        frameAccumulator += dt * framesPerSecond;
+        std::size_t advance = static_cast<std::size_t>(frameAccumulator);
+        frameAccumulator -= static_cast<float>(advance);
+
+        std::size_t next = currentFrame + advance;
+        if(next >= frames.size())
+        {
+            if(loop)
+            {
+                next %= frames.size();
+            }
+            else
+            {
+                next = frames.size() - 1;
+                playing = false;
+            }
+        }
+        currentFrame = next;
+    }
+
+    requestPrefetch(currentFrame);
+}
+
+void SnapshotReplay::seek(std::size_t frame)
+{
+    if(!isOpen()) return;
+    currentFrame = std::min(frame, frames.size() - 1);
+    frameAccumulator = 0.0f;
+    requestPrefetch(currentFrame);
+}
+
+const PVector3* SnapshotReplay::getFrame(std::size_t frame) const
+{
+    return frames.at(frame);
+}
+
+const UVector4* SnapshotReplay::getColors() const
+{
+    return colors;
+}
+
+std::size_t SnapshotReplay::getFrameCount() const
+{
+    return frames.size();
+}
+
+std::size_t SnapshotReplay::getBodyCount() const
+{
+    return bodyCount;
+}
+
+std::size_t SnapshotReplay::getCurrentFrame() const
+{
+    return currentFrame;
+}
+
+bool SnapshotReplay::mapFile(const std::string& file)
+{
+    int fd = ::open(file.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        std::cerr << "Failed to open snapshot '" << file << "'." << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(SnapshotHeader))
+    {
+        std::cerr << "Snapshot '" << file << "' is too small." << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    std::size_t size = static_cast<std::size_t>(st.st_size);
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if(data == MAP_FAILED)
+    {
+        std::cerr << "Failed to mmap snapshot '" << file << "'." << std::endl;
+        return false;
+    }
+
+    files.push_back({ data, size });
+
+    const SnapshotHeader* header = static_cast<const SnapshotHeader*>(data);
+    if(std::memcmp(header->magic, SnapshotHeader::SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SnapshotHeader::SNAPSHOT_VERSION)
+    {
+        std::cerr << "Snapshot '" << file << "' has an invalid header." << std::endl;
+        return false;
+    }
+
+    if(!colors)
+    {
+        bodyCount = header->bodyCount;
+    }
+    else if(header->bodyCount != bodyCount)
+    {
+        std::cerr << "Snapshot '" << file << "' has " << header->bodyCount << " bodies, expected " << bodyCount << "." << std::endl;
+        return false;
+    }
+
+    const char* base = static_cast<const char*>(data);
+    const char* colorData = base + sizeof(SnapshotHeader);
+    const char* frameData = colorData + bodyCount * sizeof(UVector4);
+    const std::size_t frameSize = bodyCount * sizeof(PVector3);
+
+    if(static_cast<std::size_t>(frameData - base) > size)
+    {
+        std::cerr << "Snapshot '" << file << "' is truncated." << std::endl;
+        return false;
+    }
+
+    // Clamp to what is actually on disk in case the writer was interrupted
+    std::size_t available = (size - (frameData - base)) / std::max<std::size_t>(frameSize, 1);
+    std::size_t frameCount = std::min<std::size_t>(header->frameCount, available);
+
+    if(!colors)
+    {
+        colors = reinterpret_cast<const UVector4*>(colorData);
+    }
+
+    for(std::size_t i = 0; i < frameCount; i++)
+    {
+        frames.push_back(reinterpret_cast<const PVector3*>(frameData + i * frameSize));
+    }
+
+    madvise(data, size, MADV_SEQUENTIAL);
+    return true;
+}
+
+void SnapshotReplay::requestPrefetch(std::size_t frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        prefetchTarget = frame;
+    }
+    prefetchCv.notify_one();
+}
+
+void SnapshotReplay::prefetchWorker()
+{
+    std::unique_lock<std::mutex> lock(prefetchMutex);
+    while(true)
+    {
+        prefetchCv.wait(lock, [this]() { return prefetchStop || prefetchTarget != prefetchDone; });
+        if(prefetchStop) return;
+
+        std::size_t target = prefetchTarget;
+        lock.unlock();
+
+        // Fault in the frames ahead of the playhead, the map lock
+        // guarantees the mappings cannot go away underneath us
+        {
+            std::lock_guard<std::mutex> mlock(mapMutex);
+            for(std::size_t i = 1; i <= PREFETCH_FRAMES && !frames.empty(); i++)
+            {
+                touchFrame((target + i) % frames.size());
+            }
+        }
+
+        lock.lock();
+        prefetchDone = target;
+    }
+}
+
+void SnapshotReplay::touchFrame(std::size_t frame) const
+{
+    static const std::size_t pageSize = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+    const char* begin = reinterpret_cast<const char*>(frames[frame]);
+    const char* end = begin + bodyCount * sizeof(PVector3);
+    const char* alignedBegin = reinterpret_cast<const char*>(reinterpret_cast<std::uintptr_t>(begin) & ~(pageSize - 1));
+
+    madvise(const_cast<char*>(alignedBegin), end - alignedBegin, MADV_WILLNEED);
+
+    volatile char sink = 0;
+    for(const char* page = alignedBegin; page < end; page += pageSize)
+    {
+        sink = sink + *page;
+    }
+    (void)sink;
+}
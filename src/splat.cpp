@@ -0,0 +1,205 @@
+#include "../include/splat.h"
+#include "../include/cpudispatch.h"
+#include "../include/profiler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <mutex>
+
+// Stretch of the tone curves at exposure 1, a pixel at 1% of the peak lands around a fifth of full brightness
+static constexpr float SPLAT_CURVE_STRETCH = 100.0f;
+
+// Pixel coordinates of a block of bodies, bodies behind the camera get an infinite or NaN one
+// Kept apart from the scatter so the compiler can vectorize it, once for every CPU path
+STARWELL_KERNEL_INLINE void ProjectBlockBody(const PVector3* positions, std::size_t count, const PVector4& r0, const PVector4& r1, const PVector4& r3, float width, float height, float* px, float* py)
+{
+    for(std::size_t i = 0; i < count; i++)
+    {
+        const PVector3& p = positions[i];
+        const float x = r0.x * p.x + r0.y * p.y + r0.z * p.z + r0.w;
+        const float y = r1.x * p.x + r1.y * p.y + r1.z * p.z + r1.w;
+        const float w = r3.x * p.x + r3.y * p.y + r3.z * p.z + r3.w;
+        // Clamped instead of compared, a float compare may trap and keeps the vectorizer off without AVX-512 masks
+        const float inverse = 1.0f / std::max(w, 0.0f);
+
+        // Pixel centers sit on integer coordinates
+        px[i] = (0.5f * x * inverse + 0.5f) * width - 0.5f;
+        py[i] = (0.5f * y * inverse + 0.5f) * height - 0.5f;
+    }
+}
+
+STARWELL_KERNEL_VARIANTS(, ProjectBlock,
+    (const PVector3* positions, std::size_t count, const PVector4& r0, const PVector4& r1, const PVector4& r3, float width, float height, float* px, float* py),
+    (positions, count, r0, r1, r3, width, height, px, py))
+
+using ProjectBlockFunction = void(const PVector3*, std::size_t, const PVector4&, const PVector4&, const PVector4&, float, float, float*, float*);
+
+static const CpuKernel SplatKernel("splat");
+static ProjectBlockFunction* const ProjectBlockVariants[CPU_PATH_COUNT] = STARWELL_KERNEL_TABLE(ProjectBlock);
+
+void DensitySplatter::accumulate(const PVector3* positions, const UVector4* colors, std::size_t count, const PMatrix4& viewProjection, float* grid) const
+{
+    const PVector4 r0 = viewProjection.getRow(0);
+    const PVector4 r1 = viewProjection.getRow(1);
+    const PVector4 r3 = viewProjection.getRow(3);
+    ProjectBlockFunction* projectBlock = SplatKernel.pick(ProjectBlockVariants);
+    float px[SPLAT_BLOCK];
+    float py[SPLAT_BLOCK];
+
+    for(std::size_t block = 0; block < count; block += SPLAT_BLOCK)
+    {
+        const std::size_t n = std::min(SPLAT_BLOCK, count - block);
+        projectBlock(positions + block, n, r0, r1, r3, static_cast<float>(width), static_cast<float>(height), px, py);
+
+        for(std::size_t i = 0; i < n; i++)
+        {
+            // Also rejects NaN and the infinities of bodies behind the camera
+            if(!(px[i] > -1.0f && px[i] < width && py[i] > -1.0f && py[i] < height)) continue;
+
+            const UVector4& color = colors[block + i];
+            const float weight = color.a * (1.0f / (255.0f * 255.0f));
+            const float rgb[3] = { color.r * weight, color.g * weight, color.b * weight };
+
+            // Bilinear, the four pixels around the projected point share it
+            // Coordinates are above -1 here, so shifting by one makes truncation a floor
+            const int x0 = static_cast<int>(px[i] + 1.0f) - 1;
+            const int y0 = static_cast<int>(py[i] + 1.0f) - 1;
+            const float fx = px[i] - x0;
+            const float fy = py[i] - y0;
+            const float weights[4] = { (1.0f - fx) * (1.0f - fy), fx * (1.0f - fy), (1.0f - fx) * fy, fx * fy };
+            for(int corner = 0; corner < 4; corner++)
+            {
+                const int x = x0 + (corner & 1);
+                const int y = y0 + (corner >> 1);
+                if(x < 0 || x >= width || y < 0 || y >= height) continue;
+
+                float* pixel = grid + 3 * (static_cast<std::size_t>(y) * width + x);
+                pixel[0] += weights[corner] * rgb[0];
+                pixel[1] += weights[corner] * rgb[1];
+                pixel[2] += weights[corner] * rgb[2];
+            }
+        }
+    }
+}
+
+void DensitySplatter::render(const PVector3* positions, const UVector4* colors, std::size_t count, const PMatrix4& viewProjection, int width, int height, ThreadPool* pool)
+{
+    PROFILE_SCOPE("splat");
+    this->width = std::max(width, 1);
+    this->height = std::max(height, 1);
+    const std::size_t pixels = static_cast<std::size_t>(this->width) * this->height;
+    const std::size_t threads = pool ? pool->getThreadCount() + 1 : 1;
+
+    // One private grid per worker, as long as the memory budget allows and there are enough bodies to pay for it
+    const std::size_t gridBytes = 3 * sizeof(float) * pixels;
+    gridCount = std::min({ threads, std::max<std::size_t>(SPLAT_GRID_BUDGET / gridBytes, 1), std::max<std::size_t>(count / SPLAT_MIN_BODIES_PER_GRID, 1) });
+    if(grids.size() < gridCount) grids.resize(gridCount);
+
+    auto splat = [&](std::size_t begin, std::size_t end) {
+        for(std::size_t g = begin; g < end; g++)
+        {
+            std::vector<float>& grid = grids[g];
+            grid.assign(3 * pixels, 0.0f);
+            const std::size_t first = count * g / gridCount;
+            const std::size_t last = count * (g + 1) / gridCount;
+            accumulate(positions + first, colors + first, last - first, viewProjection, grid.data());
+        }
+    };
+    if(pool) pool->parallelFor(0, gridCount, splat, 1);
+    else     splat(0, gridCount);
+
+    // Sum into the first grid, rows are split so every pixel is merged by one worker
+    std::mutex peakMutex;
+    peak = 0.0f;
+    const std::size_t rowGrain = std::max<std::size_t>(1, 4096 / this->width);
+    auto merge = [&](std::size_t begin, std::size_t end) {
+        float* target = grids[0].data();
+        float localPeak = 0.0f;
+        for(std::size_t i = begin * this->width; i < end * this->width; i++)
+        {
+            for(std::size_t g = 1; g < gridCount; g++)
+            {
+                const float* source = grids[g].data();
+                target[3 * i + 0] += source[3 * i + 0];
+                target[3 * i + 1] += source[3 * i + 1];
+                target[3 * i + 2] += source[3 * i + 2];
+            }
+            localPeak = std::max(localPeak, target[3 * i] + target[3 * i + 1] + target[3 * i + 2]);
+        }
+
+        std::lock_guard<std::mutex> lock(peakMutex);
+        peak = std::max(peak, localPeak / 3.0f);
+    };
+    if(pool) pool->parallelFor(0, this->height, merge, rowGrain);
+    else     merge(0, this->height);
+
+    // Tone curves act on the mean of the channels and scale all three alike, so hues survive the compression
+    image.resize(pixels);
+    const float stretch = SPLAT_CURVE_STRETCH * std::max(exposure, 1E-3f);
+    const float inversePeak = (peak > 0.0f) ? 1.0f / peak : 0.0f;
+    const float normalization = 1.0f / ((toneMap == ToneMap::ASINH) ? std::asinh(stretch) : std::log1p(stretch));
+    auto tonemap = [&](std::size_t begin, std::size_t end) {
+        const float* source = grids[0].data();
+        for(std::size_t i = begin * this->width; i < end * this->width; i++)
+        {
+            const float intensity = (source[3 * i] + source[3 * i + 1] + source[3 * i + 2]) * (1.0f / 3.0f);
+            float scale = 0.0f;
+            if(intensity > 0.0f)
+            {
+                const float x = stretch * intensity * inversePeak;
+                const float mapped = ((toneMap == ToneMap::ASINH) ? std::asinh(x) : std::log1p(x)) * normalization;
+                scale = 255.0f * mapped / intensity;
+            }
+
+            UVector4& pixel = image[i];
+            pixel.r = static_cast<unsigned char>(std::min(source[3 * i + 0] * scale, 255.0f));
+            pixel.g = static_cast<unsigned char>(std::min(source[3 * i + 1] * scale, 255.0f));
+            pixel.b = static_cast<unsigned char>(std::min(source[3 * i + 2] * scale, 255.0f));
+            pixel.a = 255;
+        }
+    };
+    if(pool) pool->parallelFor(0, this->height, tonemap, rowGrain);
+    else     tonemap(0, this->height);
+
+    version++;
+}
+
+const std::vector<UVector4>& DensitySplatter::getImage() const
+{
+    return image;
+}
+
+int DensitySplatter::getWidth() const
+{
+    return width;
+}
+
+int DensitySplatter::getHeight() const
+{
+    return height;
+}
+
+unsigned long long DensitySplatter::getVersion() const
+{
+    return version;
+}
+
+std::size_t DensitySplatter::getGridCount() const
+{
+    return gridCount;
+}
+
+float DensitySplatter::getPeak() const
+{
+    return peak;
+}
+
+const char* DensitySplatter::GetToneMapName(ToneMap toneMap)
+{
+    switch(toneMap)
+    {
+        case ToneMap::ASINH: return "asinh";
+        case ToneMap::LOG:   return "log";
+        default:             return "unknown";
+    }
+}
@@ -0,0 +1,420 @@
+#include "../include/stream.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <new>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static constexpr std::size_t STREAM_ALIGNMENT = 64;
+
+static std::size_t AlignUp(std::size_t value)
+{
+    return (value + STREAM_ALIGNMENT - 1) & ~(STREAM_ALIGNMENT - 1);
+}
+
+static std::size_t ColorsOffset()
+{
+    return AlignUp(sizeof(StreamHeader));
+}
+
+static std::size_t SlotsOffset(std::size_t maxBodies)
+{
+    return ColorsOffset() + AlignUp(maxBodies * sizeof(UVector4));
+}
+
+static std::size_t SlotStride(std::size_t maxBodies)
+{
+    return AlignUp(sizeof(StreamSlot) + maxBodies * sizeof(PVector3));
+}
+
+static StreamSlot* GetSlot(void* data, std::size_t maxBodies, std::size_t index)
+{
+    return reinterpret_cast<StreamSlot*>(static_cast<char*>(data) + SlotsOffset(maxBodies) + index * SlotStride(maxBodies));
+}
+
+static PVector3* GetSlotPositions(StreamSlot* slot)
+{
+    return reinterpret_cast<PVector3*>(reinterpret_cast<char*>(slot) + sizeof(StreamSlot));
+}
+
+static UVector4* GetColors(void* data)
+{
+    return reinterpret_cast<UVector4*>(static_cast<char*>(data) + ColorsOffset());
+}
+
+StreamPublisher::StreamPublisher(const std::string& name, std::size_t maxBodies, std::size_t slotCount)
+    : name(name), data(nullptr), size(0)
+{
+    slotCount = std::max<std::size_t>(slotCount, 2);
+    size = SlotsOffset(maxBodies) + slotCount * SlotStride(maxBodies);
+
+    // Start from a clean segment, a stale one might have a different layout
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+    if(fd < 0)
+    {
+        std::cerr << "Failed to create shared memory stream '" << name << "'." << std::endl;
+        return;
+    }
+
+    if(ftruncate(fd, static_cast<off_t>(size)) != 0)
+    {
+        std::cerr << "Failed to size shared memory stream '" << name << "' to " << size << " bytes." << std::endl;
+        ::close(fd);
+        shm_unlink(name.c_str());
+        return;
+    }
+
+    data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if(data == MAP_FAILED)
+    {
+        std::cerr << "Failed to map shared memory stream '" << name << "'." << std::endl;
+        data = nullptr;
+        shm_unlink(name.c_str());
+        return;
+    }
+
+    StreamHeader* header = new (data) StreamHeader;
+    header->maxBodies = maxBodies;
+    header->slotCount = slotCount;
+    header->latest.store(0, std::memory_order_relaxed);
+    header->colorVersion.store(0, std::memory_order_relaxed);
+
+    for(std::size_t i = 0; i < slotCount; i++)
+    {
+        StreamSlot* slot = new (GetSlot(data, maxBodies, i)) StreamSlot;
+        slot->sequence.store(0, std::memory_order_relaxed);
+        slot->bodyCount = 0;
+        slot->step = 0;
+    }
+
+    // Publish the magic last so readers never see a half initialized header
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(header->magic, StreamHeader::STREAM_MAGIC, sizeof(header->magic));
+
+    std::cout << "Streaming to '" << name << "' (" << slotCount << " slots of " << maxBodies << " bodies)." << std::endl;
+}
+
+StreamPublisher::~StreamPublisher()
+{
+    if(data)
+    {
+        munmap(data, size);
+        shm_unlink(name.c_str());
+    }
+}
+
+bool StreamPublisher::isOpen() const
+{
+    return data != nullptr;
+}
+
+void StreamPublisher::publish(const std::vector<PVector3>* positions, unsigned long long step)
+{
+    if(!data) return;
+
+    StreamHeader* header = static_cast<StreamHeader*>(data);
+    const std::size_t count = std::min<std::size_t>(positions->size(), header->maxBodies);
+
+    // We are the only writer so a relaxed load is enough here
+    const unsigned long long frame = header->latest.load(std::memory_order_relaxed);
+    StreamSlot* slot = GetSlot(data, header->maxBodies, frame % header->slotCount);
+
+    slot->sequence.store(2 * frame + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    std::memcpy(GetSlotPositions(slot), positions->data(), count * sizeof(PVector3));
+    slot->bodyCount = count;
+    slot->step = step;
+
+    slot->sequence.store(2 * frame + 2, std::memory_order_release);
+    header->latest.store(frame + 1, std::memory_order_release);
+}
+
+void StreamPublisher::publishColors(const std::vector<UVector4>* colors)
+{
+    if(!data) return;
+
+    StreamHeader* header = static_cast<StreamHeader*>(data);
+    const std::size_t count = std::min<std::size_t>(colors->size(), header->maxBodies);
+
+    // Odd while writing, same protocol as the frame slots
+    const unsigned long long version = header->colorVersion.load(std::memory_order_relaxed);
+    header->colorVersion.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(GetColors(data), colors->data(), count * sizeof(UVector4));
+    header->colorVersion.store(version + 2, std::memory_order_release);
+}
+
+
+StreamSubscriber::StreamSubscriber()
+    : data(nullptr), size(0), lastFrame(0), lastColorVersion(0), step(0)
+{
+
+}
+
+StreamSubscriber::~StreamSubscriber()
+{
+    detach();
+}
+
+bool StreamSubscriber::attach(const std::string& name)
+{
+    detach();
+
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if(fd < 0)
+    {
+        std::cerr << "Shared memory stream '" << name << "' not found." << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || static_cast<std::size_t>(st.st_size) < sizeof(StreamHeader))
+    {
+        std::cerr << "Shared memory stream '" << name << "' is not initialized." << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    size = static_cast<std::size_t>(st.st_size);
+    data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+
+    if(data == MAP_FAILED)
+    {
+        std::cerr << "Failed to map shared memory stream '" << name << "'." << std::endl;
+        data = nullptr;
+        return false;
+    }
+
+    const StreamHeader* header = static_cast<const StreamHeader*>(data);
+    if(std::memcmp(header->magic, StreamHeader::STREAM_MAGIC, sizeof(header->magic)) != 0 || size < SlotsOffset(header->maxBodies) + header->slotCount * SlotStride(header->maxBodies))
+    {
+        std::cerr << "Shared memory stream '" << name << "' has an invalid header." << std::endl;
+        detach();
+        return false;
+    }
+
+    positions.reserve(header->maxBodies);
+    std::cout << "Attached to stream '" << name << "'." << std::endl;
+    return true;
+}
+
+void StreamSubscriber::detach()
+{
+    if(data)
+    {
+        munmap(data, size);
+    }
+    data = nullptr;
+    size = 0;
+    lastFrame = 0;
+    lastColorVersion = 0;
+    positions.clear();
+    colors.clear();
+}
+
+bool StreamSubscriber::isAttached() const
+{
+    return data != nullptr;
+}
+
+bool StreamSubscriber::acquireLatest()
+{
+    if(!data) return false;
+
+    StreamHeader* header = static_cast<StreamHeader*>(data);
+
+    for(int i = 0; i < STREAM_MAX_RETRIES; i++)
+    {
+        const unsigned long long latest = header->latest.load(std::memory_order_acquire);
+        if(latest == 0 || latest == lastFrame) return false;
+
+        const unsigned long long frame = latest - 1;
+        StreamSlot* slot = GetSlot(data, header->maxBodies, frame % header->slotCount);
+
+        const unsigned long long before = slot->sequence.load(std::memory_order_acquire);
+        if(before != 2 * frame + 2) continue; // Already being overwritten, grab the newer one
+
+        const std::size_t count = std::min<std::size_t>(slot->bodyCount, header->maxBodies);
+        const unsigned long long slotStep = slot->step;
+        positions.resize(count);
+        std::memcpy(positions.data(), GetSlotPositions(slot), count * sizeof(PVector3));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(slot->sequence.load(std::memory_order_relaxed) != before) continue;
+
+        lastFrame = latest;
+        step = slotStep;
+
+        const unsigned long long colorVersion = header->colorVersion.load(std::memory_order_acquire);
+        if(colorVersion != lastColorVersion && (colorVersion & 1ULL) == 0)
+        {
+            colors.resize(count);
+            std::memcpy(colors.data(), GetColors(data), count * sizeof(UVector4));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(header->colorVersion.load(std::memory_order_relaxed) == colorVersion)
+            {
+                lastColorVersion = colorVersion;
+            }
+        }
+
+        // Until the publisher sends colors draw everything white
+        if(colors.size() != count)
+        {
+            colors.resize(count, UVector4{ 255, 255, 255, 255 });
+        }
+        return true;
+    }
+    return false;
+}
+
+const std::vector<PVector3>* StreamSubscriber::getPositions() const
+{
+    return &positions;
+}
+
+const std::vector<UVector4>* StreamSubscriber::getColors() const
+{
+    return &colors;
+}
+
+unsigned long long StreamSubscriber::getColorVersion() const
+{
+    return lastColorVersion;
+}
+
+unsigned long long StreamSubscriber::getStep() const
+{
+    return step;
+}
+
+
+static bool MakeSocketAddress(const std::string& path, sockaddr_un& addr)
+{
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(path.size() >= sizeof(addr.sun_path))
+    {
+        std::cerr << "Control socket path '" << path << "' is too long." << std::endl;
+        return false;
+    }
+    std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+    return true;
+}
+
+ControlServer::ControlServer(const std::string& path) : path(path), fd(-1)
+{
+    sockaddr_un addr;
+    if(!MakeSocketAddress(path, addr)) return;
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if(fd < 0)
+    {
+        std::cerr << "Failed to create control socket." << std::endl;
+        return;
+    }
+
+    unlink(path.c_str());
+    if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        std::cerr << "Failed to bind control socket '" << path << "'." << std::endl;
+        ::close(fd);
+        fd = -1;
+        return;
+    }
+
+    std::cout << "Listening for control messages on '" << path << "'." << std::endl;
+}
+
+ControlServer::~ControlServer()
+{
+    if(fd >= 0)
+    {
+        ::close(fd);
+        unlink(path.c_str());
+    }
+}
+
+bool ControlServer::isOpen() const
+{
+    return fd >= 0;
+}
+
+std::vector<ControlMessage> ControlServer::poll()
+{
+    std::vector<ControlMessage> messages;
+    if(fd < 0) return messages;
+
+    ControlMessage message;
+    while(recv(fd, &message, sizeof(message), 0) == static_cast<ssize_t>(sizeof(message)))
+    {
+        message.parameter[sizeof(message.parameter) - 1] = '\0';
+        messages.push_back(message);
+    }
+    return messages;
+}
+
+
+ControlClient::ControlClient() : fd(-1)
+{
+
+}
+
+ControlClient::~ControlClient()
+{
+    disconnect();
+}
+
+bool ControlClient::connect(const std::string& path)
+{
+    disconnect();
+
+    sockaddr_un addr;
+    if(!MakeSocketAddress(path, addr)) return false;
+
+    fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if(fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+    {
+        std::cerr << "Failed to connect to control socket '" << path << "'." << std::endl;
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+void ControlClient::disconnect()
+{
+    if(fd >= 0)
+    {
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+bool ControlClient::isConnected() const
+{
+    return fd >= 0;
+}
+
+bool ControlClient::send(ControlMessage::Type type, const std::string& parameter, double value)
+{
+    if(fd < 0) return false;
+
+    ControlMessage message;
+    std::memset(&message, 0, sizeof(message));
+    message.type = type;
+    std::strncpy(message.parameter, parameter.c_str(), sizeof(message.parameter) - 1);
+    message.value = value;
+
+    // Never stall the viewer on a busy simulation, a dropped message is fine
+    return ::send(fd, &message, sizeof(message), 0) == static_cast<ssize_t>(sizeof(message));
+}
@@ -0,0 +1,132 @@
+#include "../include/threadpool.h"
+#include "../include/profiler.h"
+#include <algorithm>
+#include <memory>
+
+ThreadPool::ThreadPool(std::size_t threads)
+{
+    threads = std::max<std::size_t>(threads, 1);
+    this->threads.reserve(threads);
+    for(std::size_t i = 0; i < threads; i++)
+    {
+        this->threads.emplace_back(&ThreadPool::worker, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    cv.notify_all();
+
+    for(auto& thread : threads)
+    {
+        thread.join();
+    }
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task)
+{
+    auto packaged = std::make_shared<std::packaged_task<void()>>(std::move(task));
+    std::future<void> future = packaged->get_future();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push([packaged]() { (*packaged)(); });
+    }
+    cv.notify_one();
+    return future;
+}
+
+void ThreadPool::parallelFor(std::size_t begin, std::size_t end, const std::function<void(std::size_t, std::size_t)>& body, std::size_t grain)
+{
+    if(end <= begin) return;
+
+    const std::size_t count = end - begin;
+    grain = std::max<std::size_t>(grain, 1);
+
+    // Aim for a few chunks per thread so uneven chunks even out
+    const std::size_t chunkSize = std::max(grain, count / (4 * (threads.size() + 1)) + 1);
+    const std::size_t chunks = (count + chunkSize - 1) / chunkSize;
+
+    if(chunks == 1)
+    {
+        body(begin, end);
+        return;
+    }
+
+    struct State
+    {
+        std::atomic<std::size_t> next = 0;
+        std::atomic<std::size_t> done = 0;
+        std::mutex mutex;
+        std::condition_variable cv;
+    };
+    auto state = std::make_shared<State>();
+
+    // Helpers never touch body once every chunk is taken, so the reference outlives them where it matters
+    auto run = [state, &body, begin, end, chunkSize, chunks]() {
+        std::size_t chunk;
+        while((chunk = state->next.fetch_add(1, std::memory_order_relaxed)) < chunks)
+        {
+            const std::size_t cbegin = begin + chunk * chunkSize;
+            body(cbegin, std::min(cbegin + chunkSize, end));
+
+            if(state->done.fetch_add(1, std::memory_order_acq_rel) + 1 == chunks)
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->cv.notify_all();
+            }
+        }
+    };
+
+    const std::size_t helpers = std::min(threads.size(), chunks - 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for(std::size_t i = 0; i < helpers; i++)
+        {
+            tasks.push(run);
+        }
+    }
+    cv.notify_all();
+
+    run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [&state, chunks]() { return state->done.load(std::memory_order_acquire) == chunks; });
+}
+
+std::size_t ThreadPool::getThreadCount() const
+{
+    return threads.size();
+}
+
+ThreadPool& ThreadPool::Global()
+{
+    static ThreadPool pool(GlobalThreadCount > 0 ? GlobalThreadCount : std::thread::hardware_concurrency());
+    return pool;
+}
+
+void ThreadPool::ConfigureGlobal(std::size_t threads)
+{
+    GlobalThreadCount = threads;
+}
+
+void ThreadPool::worker(std::size_t index)
+{
+    PROFILE_THREAD("worker " + std::to_string(index));
+    while(true)
+    {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [this]() { return stop || !tasks.empty(); });
+            if(stop && tasks.empty()) return;
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        PROFILE_SCOPE("pool task");
+        task();
+    }
+}
@@ -0,0 +1,215 @@
+// Accuracy versus cost of the Barnes-Hut walk
+// Every scene is walked at every opening threshold and compared with an exact direct sum on a random sample of bodies
+// Results go to a CSV file so two builds can be diffed
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../../include/bhtree.h"
+#include "../../include/direct.h"
+#include "../../include/distributions.h"
+
+struct AccuracyOptions
+{
+    std::size_t bodies = 100'000;
+    std::size_t samples = 1000;
+    unsigned int seed = 1234;
+    std::vector<DistributionType> scenes = { DistributionType::UNIFORM, DistributionType::PLUMMER, DistributionType::TWO_DISK };
+    std::vector<float> thresholds = { 0.25f, 0.5f, 0.75f, 1.0f };
+    std::string output = "accuracy.csv";
+};
+
+struct AccuracyResult
+{
+    float rms = 0.0f;
+    float p99 = 0.0f;
+    float max = 0.0f;
+    BHWalkStats stats;
+    double walkMs = 0.0;
+};
+
+static void PrintUsage(const char* exe)
+{
+    std::cout << "Usage: " << exe << " [options]" << std::endl;
+    std::cout << "  --bodies <n>          Bodies per scene (default 100000)" << std::endl;
+    std::cout << "  --samples <n>         Bodies compared against the exact sum (default 1000)" << std::endl;
+    std::cout << "  --seed <n>            Seed for scenes and samples (default 1234)" << std::endl;
+    std::cout << "  --scenes <a,b>        Any of uniform, plummer, twodisk (default all)" << std::endl;
+    std::cout << "  --thr <a,b>           Opening thresholds (default 0.25,0.5,0.75,1.0)" << std::endl;
+    std::cout << "  --output <file>       CSV output, - for stdout (default accuracy.csv)" << std::endl;
+}
+
+static std::vector<std::string> SplitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    for(std::string item; std::getline(stream, item, ',');)
+    {
+        if(!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+static bool ParseOptions(int argc, char* argv[], AccuracyOptions& options)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = (i + 1 < argc);
+
+        if(arg == "--bodies" && hasValue)
+        {
+            options.bodies = std::stoull(argv[++i]);
+        }
+        else if(arg == "--samples" && hasValue)
+        {
+            options.samples = std::max(std::stoull(argv[++i]), 1ULL);
+        }
+        else if(arg == "--seed" && hasValue)
+        {
+            options.seed = static_cast<unsigned int>(std::stoul(argv[++i]));
+        }
+        else if(arg == "--scenes" && hasValue)
+        {
+            options.scenes.clear();
+            for(const std::string& name : SplitList(argv[++i]))
+            {
+                DistributionType type;
+                if(!ParseDistribution(name, type)) return false;
+                options.scenes.push_back(type);
+            }
+        }
+        else if(arg == "--thr" && hasValue)
+        {
+            options.thresholds.clear();
+            for(const std::string& value : SplitList(argv[++i]))
+            {
+                options.thresholds.push_back(std::stof(value));
+            }
+        }
+        else if(arg == "--output" && hasValue)
+        {
+            options.output = argv[++i];
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static AccuracyResult MeasureThreshold(BHTree& tree, const std::vector<Body>& bodies, const std::vector<std::size_t>& sample, const std::vector<PVector3>& reference, float thr)
+{
+    AccuracyResult result;
+
+    // Walk every body like Simulation::integrate does, so the cost is the real per-step cost
+    std::vector<PVector3> field(bodies.size());
+    auto start = std::chrono::steady_clock::now();
+    for(std::size_t i = 0; i < bodies.size(); i++)
+    {
+        field[i] = tree.calculateFieldOnPoint(bodies[i].getPosition(), thr, nullptr, &result.stats);
+    }
+    result.walkMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<float> errors(sample.size());
+    double sumSqr = 0.0;
+    for(std::size_t i = 0; i < sample.size(); i++)
+    {
+        const float exact = PVector3::Magnitude(reference[i]);
+        const float error = PVector3::Magnitude(field[sample[i]] - reference[i]);
+        errors[i] = (exact > 0.0f) ? error / exact : error;
+        sumSqr += static_cast<double>(errors[i]) * errors[i];
+    }
+
+    result.rms = static_cast<float>(std::sqrt(sumSqr / errors.size()));
+    result.max = *std::max_element(errors.begin(), errors.end());
+    const std::size_t p99 = std::min(errors.size() - 1, static_cast<std::size_t>(0.99 * errors.size()));
+    std::nth_element(errors.begin(), errors.begin() + p99, errors.end());
+    result.p99 = errors[p99];
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    AccuracyOptions options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+
+    std::ofstream file;
+    if(options.output != "-")
+    {
+        file.open(options.output);
+        if(!file)
+        {
+            std::cerr << "Failed to open '" << options.output << "'." << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& output = (options.output == "-") ? std::cout : file;
+
+    output << "scene,bodies,thr,samples,rms_error,p99_error,max_error,node_visits,interactions,visits_per_body,interactions_per_body,build_ms,walk_ms" << std::endl;
+    output << std::setprecision(6);
+
+    for(DistributionType scene : options.scenes)
+    {
+        Body::ResetPools();
+        const std::vector<Body> bodies = CreateBodies(GenerateDistribution(scene, options.bodies, options.seed));
+        if(bodies.empty()) continue;
+
+        auto start = std::chrono::steady_clock::now();
+        BHTree tree;
+        tree.fitRoot(bodies);
+        for(const Body& body : bodies)
+        {
+            tree.insertBody(&body);
+        }
+        const double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        // Same sample for every threshold, so rows of one scene compare like for like
+        std::mt19937 rng(options.seed);
+        std::vector<std::size_t> sample(bodies.size());
+        for(std::size_t i = 0; i < sample.size(); i++) sample[i] = i;
+        std::shuffle(sample.begin(), sample.end(), rng);
+        sample.resize(std::min(options.samples, bodies.size()));
+
+        std::vector<PVector3> points;
+        for(std::size_t index : sample)
+        {
+            points.push_back(bodies[index].getPosition());
+        }
+
+        DirectSummation direct;
+        std::vector<PVector3> reference;
+        direct.setSources(&bodies);
+        direct.calculateFieldOnPoints(points, reference);
+
+        for(float thr : options.thresholds)
+        {
+            const AccuracyResult result = MeasureThreshold(tree, bodies, sample, reference, thr);
+            const double n = static_cast<double>(bodies.size());
+
+            output << GetDistributionName(scene) << "," << bodies.size() << "," << thr << "," << sample.size() << ","
+                   << result.rms << "," << result.p99 << "," << result.max << ","
+                   << result.stats.nodeVisits << "," << result.stats.interactions << ","
+                   << result.stats.nodeVisits / n << "," << result.stats.interactions / n << ","
+                   << buildMs << "," << result.walkMs << std::endl;
+
+            std::cerr << GetDistributionName(scene) << " thr " << thr << ": rms " << result.rms << ", p99 " << result.p99
+                      << ", " << result.stats.interactions / n << " interactions/body, " << result.walkMs << " ms" << std::endl;
+        }
+        tree.reset();
+    }
+    return 0;
+}
@@ -0,0 +1,332 @@
+// Microbenchmarks for the phases of one step: tree build, moments, force walk, integration and instance upload
+// Every phase is timed on its own, on seeded synthetic scenes, for each thread count
+// Results go to a CSV file so two builds can be diffed
+
+#include <glad/gl.h>
+#include <glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../../include/bhtree.h"
+#include "../../include/cpudispatch.h"
+#include "../../include/distributions.h"
+#include "../../include/draw.h"
+#include "../../include/threadpool.h"
+
+struct BenchOptions
+{
+    std::vector<std::size_t> bodies = { 10'000, 100'000, 1'000'000 };
+    std::vector<std::size_t> threads;
+    std::vector<DistributionType> scenes = { DistributionType::UNIFORM, DistributionType::PLUMMER, DistributionType::TWO_DISK };
+    float thr = 0.5f;
+    int repeat = 3;
+    unsigned int seed = 1234;
+    bool gl = true;
+    std::string output = "bench.csv";
+    CpuPath cpuPath = CpuPath::AVX512;
+};
+
+struct BenchTiming
+{
+    double ms = 0.0;
+    unsigned long long interactions = 0;
+};
+
+static void PrintUsage(const char* exe)
+{
+    std::cout << "Usage: " << exe << " [options]" << std::endl;
+    std::cout << "  --bodies <a,b>        Body counts (default 10000,100000,1000000, up to 10000000)" << std::endl;
+    std::cout << "  --threads <a,b>       Thread counts (default 1, 2, 4, ... up to all cores)" << std::endl;
+    std::cout << "  --scenes <a,b>        Any of uniform, plummer, twodisk (default all)" << std::endl;
+    std::cout << "  --thr <value>         Opening threshold for the walk (default 0.5)" << std::endl;
+    std::cout << "  --repeat <n>          Runs per phase, the median is reported (default 3)" << std::endl;
+    std::cout << "  --seed <n>            Scene seed (default 1234)" << std::endl;
+    std::cout << "  --no-gl               Skip the instance upload phase" << std::endl;
+    std::cout << "  --output <file>       CSV output, - for stdout (default bench.csv)" << std::endl;
+    std::cout << "  --cpu-path <path>     Highest kernel path: auto, scalar, sse4, avx2 or avx512 (default auto)" << std::endl;
+}
+
+static std::vector<std::string> SplitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    for(std::string item; std::getline(stream, item, ',');)
+    {
+        if(!item.empty()) items.push_back(item);
+    }
+    return items;
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions& options)
+{
+    for(int i = 1; i < argc; i++)
+    {
+        const std::string arg = argv[i];
+        const bool hasValue = (i + 1 < argc);
+
+        if(arg == "--bodies" && hasValue)
+        {
+            options.bodies.clear();
+            for(const std::string& value : SplitList(argv[++i])) options.bodies.push_back(std::stoull(value));
+        }
+        else if(arg == "--threads" && hasValue)
+        {
+            options.threads.clear();
+            for(const std::string& value : SplitList(argv[++i])) options.threads.push_back(std::max(std::stoull(value), 1ULL));
+        }
+        else if(arg == "--scenes" && hasValue)
+        {
+            options.scenes.clear();
+            for(const std::string& name : SplitList(argv[++i]))
+            {
+                DistributionType type;
+                if(!ParseDistribution(name, type)) return false;
+                options.scenes.push_back(type);
+            }
+        }
+        else if(arg == "--thr" && hasValue)
+        {
+            options.thr = std::stof(argv[++i]);
+        }
+        else if(arg == "--repeat" && hasValue)
+        {
+            options.repeat = std::max(std::stoi(argv[++i]), 1);
+        }
+        else if(arg == "--seed" && hasValue)
+        {
+            options.seed = static_cast<unsigned int>(std::stoul(argv[++i]));
+        }
+        else if(arg == "--no-gl")
+        {
+            options.gl = false;
+        }
+        else if(arg == "--output" && hasValue)
+        {
+            options.output = argv[++i];
+        }
+        else if(arg == "--cpu-path" && hasValue)
+        {
+            if(!CpuDispatch::ParsePath(argv[++i], options.cpuPath)) return false;
+        }
+        else
+        {
+            PrintUsage(argv[0]);
+            return false;
+        }
+    }
+
+    if(options.threads.empty())
+    {
+        const std::size_t cores = std::max(std::thread::hardware_concurrency(), 1U);
+        for(std::size_t t = 1; t < cores; t *= 2) options.threads.push_back(t);
+        options.threads.push_back(cores);
+    }
+    return true;
+}
+
+// Median of repeat runs of phase, setup runs untimed before each one
+static BenchTiming Measure(int repeat, const std::function<void()>& setup, const std::function<unsigned long long()>& phase)
+{
+    std::vector<BenchTiming> runs;
+    for(int r = 0; r < repeat; r++)
+    {
+        if(setup) setup();
+        auto start = std::chrono::steady_clock::now();
+        unsigned long long interactions = phase();
+        runs.push_back({ std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(), interactions });
+    }
+    std::sort(runs.begin(), runs.end(), [](const BenchTiming& a, const BenchTiming& b) { return a.ms < b.ms; });
+    return runs[runs.size() / 2];
+}
+
+// The caller takes part in parallelFor, so t threads are t - 1 workers plus the caller
+static void ParallelFor(ThreadPool* pool, std::size_t count, const std::function<void(std::size_t, std::size_t)>& body)
+{
+    if(pool)
+    {
+        pool->parallelFor(0, count, body, 256);
+    }
+    else
+    {
+        body(0, count);
+    }
+}
+
+// Hidden window, only there to own a GL context for InstanceState
+class BenchContext
+{
+public:
+    BenchContext()
+    {
+        if(!glfwInit())
+        {
+            std::cerr << "Failed to init glfw, skipping the upload phase." << std::endl;
+            return;
+        }
+        glfwOK = true;
+
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(64, 64, "starwell_bench", nullptr, nullptr);
+        if(!window)
+        {
+            std::cerr << "Failed to create a GL context, skipping the upload phase." << std::endl;
+            return;
+        }
+        glfwMakeContextCurrent(window);
+        gladLoadGL(glfwGetProcAddress);
+    }
+
+    ~BenchContext()
+    {
+        if(window) glfwDestroyWindow(window);
+        if(glfwOK) glfwTerminate();
+    }
+
+    bool isOK() const
+    {
+        return window != nullptr;
+    }
+
+private:
+    bool glfwOK = false;
+    GLFWwindow* window = nullptr;
+};
+
+static void WriteRow(std::ostream& output, DistributionType scene, std::size_t bodies, std::size_t threads, const char* phase, const BenchTiming& timing)
+{
+    const double seconds = timing.ms / 1000.0;
+    output << GetDistributionName(scene) << "," << bodies << "," << threads << "," << phase << ","
+           << timing.ms << "," << (seconds > 0.0 ? bodies / seconds : 0.0) << ","
+           << (seconds > 0.0 ? timing.interactions / seconds : 0.0) << std::endl;
+
+    std::cerr << std::setw(8) << GetDistributionName(scene) << " N=" << std::setw(8) << bodies << " t=" << std::setw(2) << threads
+              << " " << std::setw(10) << phase << " " << std::setw(10) << timing.ms << " ms" << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    if(!ParseOptions(argc, argv, options))
+    {
+        return 1;
+    }
+    CpuDispatch::SetLimit(options.cpuPath);
+    std::cerr << "CPU path: " << CpuDispatch::Describe() << std::endl;
+
+    std::ofstream file;
+    if(options.output != "-")
+    {
+        file.open(options.output);
+        if(!file)
+        {
+            std::cerr << "Failed to open '" << options.output << "'." << std::endl;
+            return 1;
+        }
+    }
+    std::ostream& output = (options.output == "-") ? std::cout : file;
+    output << "scene,bodies,threads,phase,ms,bodies_per_s,interactions_per_s" << std::endl;
+    output << std::setprecision(6);
+
+    std::unique_ptr<BenchContext> context;
+    std::unique_ptr<InstanceState> instances;
+    if(options.gl)
+    {
+        context = std::make_unique<BenchContext>();
+        if(context->isOK()) instances = std::make_unique<InstanceState>();
+    }
+
+    for(DistributionType scene : options.scenes)
+    {
+        for(std::size_t count : options.bodies)
+        {
+            Body::ResetPools();
+            Body::ReservePools(count);
+            const Distribution distribution = GenerateDistribution(scene, count, options.seed);
+            std::vector<Body> bodies = CreateBodies(distribution);
+            std::vector<PVector3> field(bodies.size());
+            BHTree tree;
+
+            // Insertion is serial, measure it once per scene and size
+            const BenchTiming build = Measure(options.repeat, [&]() { tree.reset(); }, [&]() {
+                tree.fitRoot(bodies);
+                for(const Body& body : bodies) tree.insertBody(&body);
+                return 0ULL;
+            });
+            WriteRow(output, scene, count, 1, "build", build);
+
+            for(std::size_t threads : options.threads)
+            {
+                std::unique_ptr<ThreadPool> pool = (threads > 1) ? std::make_unique<ThreadPool>(threads - 1) : nullptr;
+
+                const BenchTiming moments = Measure(options.repeat, nullptr, [&]() {
+                    tree.computeMoments(pool.get());
+                    return 0ULL;
+                });
+                WriteRow(output, scene, count, threads, "moments", moments);
+
+                const BenchTiming walk = Measure(options.repeat, nullptr, [&]() {
+                    std::mutex mergeMutex;
+                    unsigned long long interactions = 0;
+                    ParallelFor(pool.get(), bodies.size(), [&](std::size_t begin, std::size_t end) {
+                        BHWalkStats stats;
+                        for(std::size_t i = begin; i < end; i++)
+                        {
+                            field[i] = tree.calculateFieldOnPoint(bodies[i].getPosition(), options.thr, nullptr, &stats);
+                        }
+                        std::lock_guard<std::mutex> lock(mergeMutex);
+                        interactions += stats.interactions;
+                    });
+                    return interactions;
+                });
+                WriteRow(output, scene, count, threads, "walk", walk);
+
+                // Moves the bodies, the tree is rebuilt below so later rows still see a consistent tree
+                // The batched pool kernel the simulation runs, serial so it doesn't depend on threads
+                const BenchTiming integrate = Measure(options.repeat, nullptr, [&]() {
+                    Body::MoveAll(&bodies, field);
+                    return 0ULL;
+                });
+                WriteRow(output, scene, count, threads, "integrate", integrate);
+
+                // Baseline, the per body move MoveAll replaced, split over the threads
+                const BenchTiming integrateBody = Measure(options.repeat, nullptr, [&]() {
+                    ParallelFor(pool.get(), bodies.size(), [&](std::size_t begin, std::size_t end) {
+                        for(std::size_t i = begin; i < end; i++) bodies[i].move(field[i]);
+                    });
+                    return 0ULL;
+                });
+                WriteRow(output, scene, count, threads, "integrate_body", integrateBody);
+
+                tree.reset();
+                tree.fitRoot(bodies);
+                for(const Body& body : bodies) tree.insertBody(&body);
+            }
+
+            // Upload goes through the same path the viewer uses every frame, glFinish so the copy is counted
+            if(instances)
+            {
+                const BenchTiming upload = Measure(options.repeat, nullptr, [&]() {
+                    instances->updatePositions(Body::GetLinearPositionPool());
+                    instances->updateColors(Body::GetColorPool());
+                    glFinish();
+                    return 0ULL;
+                });
+                WriteRow(output, scene, count, 1, "upload", upload);
+            }
+            tree.reset();
+        }
+    }
+    return 0;
+}
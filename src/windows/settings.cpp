@@ -1,6 +1,11 @@
 #include "../../include/windows/settings.h"
 #include "../../include/rwindow.h"
+#include "../../include/heapstats.h"
+#include "../../include/profiler.h"
+#include "../../include/cpudispatch.h"
 #include "imgui.h"
+#include <algorithm>
+#include <array>
 #include <cmath>
 #include <mutex>
 #include <stdio.h>
@@ -26,9 +31,30 @@ void SettingsWindow::internalDraw(Camera& camera, InstanceState& pstate, PythonS
     (void)pstate;
     (void)shader;
 
+    // Clicked in the viewport
+    if(std::optional<int> picked = parent->takePickedBody())
+    {
+        particleFocus = *picked;
+    }
+
     if(ImGui::CollapsingHeader("Metrics"))
     {
-        drawMetrics(camera);
+        drawMetrics(camera, pstate);
+    }
+
+    if(ImGui::CollapsingHeader("Walk Cost"))
+    {
+        drawCost();
+    }
+
+    if(ImGui::CollapsingHeader("Level of Detail"))
+    {
+        drawLevelOfDetail();
+    }
+
+    if(ImGui::CollapsingHeader("Density Splat"))
+    {
+        drawSplat();
     }
 
     if(ImGui::CollapsingHeader("Particle Analysis"))
@@ -36,13 +62,28 @@ void SettingsWindow::internalDraw(Camera& camera, InstanceState& pstate, PythonS
         drawAnalysis(camera, pstate);
     }
 
+    if(ImGui::CollapsingHeader("Profiles"))
+    {
+        drawProfiles();
+    }
+
     if(ImGui::CollapsingHeader("Scene"))
     {
-        drawSceneControl(scene);
+        drawSceneControl(scene, pstate);
+    }
+
+    if(ImGui::CollapsingHeader("Replay"))
+    {
+        drawReplayControl();
+    }
+
+    if(parent->streamActive() && ImGui::CollapsingHeader("Stream"))
+    {
+        drawStreamControl();
     }
 }
 
-void SettingsWindow::drawMetrics(Camera& camera)
+void SettingsWindow::drawMetrics(Camera& camera, InstanceState& pstate)
 {
     ImGui::BeginDisabled();
     float delta = ImGui::GetIO().DeltaTime * 1000.0f;
@@ -56,13 +97,382 @@ void SettingsWindow::drawMetrics(Camera& camera)
     ImGui::DragFloat3("Cam Position", cameraPos.data);
     ImGui::DragFloat3("Cam Rotation", cameraRot.data);
     ImGui::EndDisabled();
+
+    // The compact formats halve the per frame upload, quantized to the bounds of the frame
+    static const char* formats[] = { "float32", "unorm16", "half16" };
+    int format = static_cast<int>(pstate.getPositionFormat());
+    if(ImGui::Combo("Upload format", &format, formats, 3))
+    {
+        pstate.setPositionFormat(static_cast<InstanceState::PositionFormat>(format));
+    }
+    ImGui::Text("Positions %.2f MB/frame", pstate.getPositionBytes() / (1024.0 * 1024.0));
+
+    drawProfiler();
+    drawTreeStats();
+    drawMemory();
+    drawCpuPath();
+
+    ConservationMonitor* conservation = parent->getConservation();
+    ImGui::SeparatorText("Conservation");
+    ImGui::Checkbox("Track", &conservation->enabled);
+    ImGui::SameLine();
+    if(ImGui::Button("Reset baseline"))
+    {
+        conservation->reset();
+    }
+    ImGui::DragInt("Every N steps##conservation", &conservation->every, 1.0f, 1, 10000);
+
+    if(!conservation->hasSample()) return;
+
+    const ConservationSample& sample = conservation->getLatest();
+    const ImVec2 plotSize(0.0f, 40.0f);
+    ImGui::Text("Step %llu, E %.6g (K %.4g, W %.4g)", sample.step, sample.getEnergy(), sample.kinetic, sample.potential);
+    ImGui::Text("dE/K0 %+.3e  dP %.3e  dL/L %.3e", conservation->getEnergyDrift(), conservation->getMomentumDrift(), conservation->getAngularMomentumDrift());
+
+    const std::vector<float>& energy = conservation->getEnergyHistory();
+    const std::vector<float>& momentum = conservation->getMomentumHistory();
+    const std::vector<float>& angular = conservation->getAngularMomentumHistory();
+    ImGui::PlotLines("dE/K0", energy.data(), static_cast<int>(energy.size()), 0, nullptr, 3.4e38f, 3.4e38f, plotSize);
+    ImGui::PlotLines("dP", momentum.data(), static_cast<int>(momentum.size()), 0, nullptr, 0.0f, 3.4e38f, plotSize);
+    ImGui::PlotLines("dL/L", angular.data(), static_cast<int>(angular.size()), 0, nullptr, 0.0f, 3.4e38f, plotSize);
+}
+
+void SettingsWindow::drawProfiler()
+{
+    ImGui::SeparatorText("Profiler");
+    if(!Profiler::PROFILER_ENABLED)
+    {
+        ImGui::TextDisabled("Compiled out, configure with -DSTARWELL_PROFILING=ON");
+        return;
+    }
+
+    Profiler& profiler = Profiler::Global();
+    const std::vector<float>& frames = profiler.getFrameHistory();
+    const ImVec2 plotSize(0.0f, 40.0f);
+    ImGui::PlotLines("Frame ms", frames.data(), static_cast<int>(frames.size()), 0, nullptr, 0.0f, 3.4e38f, plotSize);
+
+    // Averages over the history, the remainder is whatever no scope covers (mostly driver and event handling)
+    if(ImGui::BeginTable("Phases", 3))
+    {
+        ImGui::TableSetupColumn("Phase");
+        ImGui::TableSetupColumn("Avg ms");
+        ImGui::TableSetupColumn("Share");
+        ImGui::TableHeadersRow();
+
+        const float frame = std::max(profiler.getFrameAverage(), 1E-6f);
+        float covered = 0.0f;
+        for(const ProfilePhase& phase : profiler.getPhases())
+        {
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::TextUnformatted(phase.name);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", phase.average);
+            ImGui::TableNextColumn();
+            ImGui::ProgressBar(phase.average / frame, ImVec2(-1.0f, 0.0f));
+            covered += phase.average;
+        }
+
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::TextDisabled("other");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", std::max(frame - covered, 0.0f));
+        ImGui::EndTable();
+    }
+
+    ImGui::InputText("Trace path", tracePath, sizeof(tracePath));
+    if(!profiler.isCapturing())
+    {
+        if(ImGui::Button("Start capture"))
+        {
+            profiler.startCapture();
+        }
+    }
+    else
+    {
+        if(ImGui::Button("Stop and export"))
+        {
+            profiler.stopCapture();
+            profiler.exportTrace(tracePath);
+        }
+        ImGui::SameLine();
+        ImGui::Text("%zu events", profiler.getCapturedEventCount());
+    }
+}
+
+void SettingsWindow::drawTreeStats()
+{
+    ImGui::SeparatorText("Tree");
+    const BHTreeStats* stats = parent->getTreeStats();
+    if(stats->nodes == 0)
+    {
+        ImGui::TextDisabled("No tree built yet (the direct engine skips it)");
+        return;
+    }
+
+    const double bodies = std::max(static_cast<double>(stats->bodies), 1.0);
+    ImGui::Text("%llu nodes, %llu leaves, %llu bodies", stats->nodes, stats->leaves, stats->bodies);
+    ImGui::Text("Depth: mean leaf %.1f, max %d", stats->getMeanLeafDepth(), stats->maxDepth);
+    ImGui::Text("Root %.4g, %llu escapers, %llu removed", stats->rootSize, stats->escapers, stats->removedBodies);
+    ImGui::Text("%.1f MB (%zu B/node, %.0f B/body)", stats->getBytes() / 1048576.0, sizeof(BHNode), stats->getBytes() / bodies);
+    ImGui::Text("Body lists: %.1f per body, %.1f MB", stats->bodyReferences / bodies, stats->listBytes / 1048576.0);
+    ImGui::Text("Peak: %llu nodes, %.1f MB", stats->peakNodes, stats->peakBytes / 1048576.0);
+
+    // Histograms stop at the last non empty bin
+    const ImVec2 plotSize(0.0f, 40.0f);
+    std::array<float, BHTreeStats::BHTREE_DEPTH_BINS> depths;
+    const int depthBins = std::min(stats->maxDepth + 1, static_cast<int>(depths.size()));
+    for(int i = 0; i < depthBins; i++) depths[i] = static_cast<float>(stats->leafDepths[i]);
+    ImGui::PlotHistogram("Leaf depth", depths.data(), depthBins, 0, nullptr, 0.0f, 3.4e38f, plotSize);
+
+    std::array<float, BHTreeStats::BHTREE_OCCUPANCY_BINS> occupancy;
+    int occupancyBins = 0;
+    for(int i = 0; i < static_cast<int>(occupancy.size()); i++)
+    {
+        occupancy[i] = static_cast<float>(stats->occupancy[i]);
+        if(stats->occupancy[i] > 0) occupancyBins = i + 1;
+    }
+    ImGui::PlotHistogram("Bodies/node (log2)", occupancy.data(), occupancyBins, 0, nullptr, 0.0f, 3.4e38f, plotSize);
+}
+
+void SettingsWindow::drawMemory()
+{
+    ImGui::SeparatorText("Memory");
+    if(!HeapStats::HEAPSTATS_ENABLED)
+    {
+        ImGui::TextDisabled("Heap counters compiled out, configure with -DSTARWELL_HEAP_STATS=ON");
+        return;
+    }
+
+    const HeapSnapshot heap = HeapStats::Get();
+    ImGui::Text("Heap: %.1f MB live, %.1f MB peak", heap.liveBytes / 1048576.0, heap.peakBytes / 1048576.0);
+    ImGui::SameLine();
+    if(ImGui::Button("Reset peak"))
+    {
+        HeapStats::ResetPeak();
+    }
+    ImGui::Text("%llu allocations last frame, %llu live blocks", HeapStats::GetFrameAllocations(), heap.allocations - heap.frees);
+
+    const std::vector<float>& history = HeapStats::GetFrameAllocationHistory();
+    ImGui::PlotLines("Allocs/frame", history.data(), static_cast<int>(history.size()), 0, nullptr, 0.0f, 3.4e38f, ImVec2(0.0f, 40.0f));
+}
+
+void SettingsWindow::drawCpuPath()
+{
+    ImGui::SeparatorText("CPU Path");
+    ImGui::Text("Running %s, detected %s", CpuDispatch::GetPathName(CpuDispatch::GetPath()), CpuDispatch::GetPathName(CpuDispatch::Detect()));
+    for(const CpuKernel* kernel : CpuKernel::GetKernels())
+    {
+        ImGui::BulletText("%s: %s", kernel->getName(), CpuDispatch::GetPathName(kernel->getPath()));
+    }
+
+    // Kernels look their variant up on every call, so the cap can change while running
+    static const char* paths[] = { "scalar", "sse4", "avx2", "avx512" };
+    int limit = static_cast<int>(CpuDispatch::GetLimit());
+    if(ImGui::Combo("Highest path", &limit, paths, CPU_PATH_COUNT))
+    {
+        CpuDispatch::SetLimit(static_cast<CpuPath>(limit));
+    }
+}
+
+void SettingsWindow::drawCost()
+{
+    CostMap* cost = parent->getCostMap();
+
+    ImGui::Checkbox("Record", &cost->enabled);
+    ImGui::SameLine();
+    ImGui::Checkbox("Colour bodies", &cost->colorBodies);
+    ImGui::SameLine();
+    ImGui::Checkbox("Cells", &cost->showCells);
+
+    static const char* metrics[] = { "Interactions", "Node visits" };
+    int metric = static_cast<int>(cost->metric);
+    if(ImGui::Combo("Metric", &metric, metrics, 2))
+    {
+        cost->metric = static_cast<CostMap::Metric>(metric);
+    }
+    ImGui::SliderInt("Cell levels", &cost->maxCellLevel, 0, 16);
+
+    if(!cost->enabled || !cost->hasResult())
+    {
+        ImGui::TextDisabled("Recorded on tree steps only");
+        return;
+    }
+
+    // Max over mean is the imbalance a static split of bodies over threads would suffer
+    ImGui::Text("Per body: mean %.0f, p99 %.0f, max %.0f", cost->getMeanCost(), cost->getPercentileCost(), cost->getMaxCost());
+    ImGui::Text("Imbalance (max/mean) %.2f", cost->getMaxCost() / std::max(cost->getMeanCost(), 1.0f));
+    ImGui::Text("%zu cells", cost->getCells().size());
+}
+
+void SettingsWindow::drawLevelOfDetail()
+{
+    LevelOfDetail* lod = parent->getLevelOfDetail();
+
+    ImGui::Checkbox("Enabled##lod", &lod->enabled);
+    ImGui::SliderFloat("Min pixels", &lod->minPixels, 0.25f, 32.0f, "%.2f");
+    ImGui::DragInt("Budget", &lod->budget, 10000.0f, 1, LevelOfDetail::LOD_MAX_BUDGET);
+
+    if(!parent->lodActive() || !lod->hasResult())
+    {
+        ImGui::TextDisabled("Selected from the tree of the local simulation only");
+        return;
+    }
+
+    const BHLODStats& stats = lod->getStats();
+    ImGui::Text("%zu sprites for %zu bodies", lod->getPositions().size(), lod->getRepresentedBodies());
+    ImGui::Text("%llu aggregates, %llu cells culled", stats.aggregated, stats.culled);
+    ImGui::Text("%llu cells visited, %llu held back by the budget", stats.visited, stats.budgetLimited);
 }
 
-void SettingsWindow::drawSceneControl(PythonScene& scene)
+void SettingsWindow::drawSplat()
+{
+    DensitySplatter* splatter = parent->getSplatter();
+
+    ImGui::Checkbox("Enabled##splat", &splatter->enabled);
+    static const char* toneMaps[] = { "asinh", "log" };
+    int toneMap = static_cast<int>(splatter->toneMap);
+    if(ImGui::Combo("Tone map", &toneMap, toneMaps, 2))
+    {
+        splatter->toneMap = static_cast<DensitySplatter::ToneMap>(toneMap);
+    }
+    ImGui::SliderFloat("Exposure", &splatter->exposure, 0.01f, 100.0f, "%.2f");
+
+    if(!splatter->enabled || splatter->getVersion() == 0)
+    {
+        ImGui::TextDisabled("Replaces the billboards while enabled");
+        return;
+    }
+
+    ImGui::Text("%dx%d, %zu accumulation grids", splatter->getWidth(), splatter->getHeight(), splatter->getGridCount());
+    ImGui::Text("Peak %.3g", splatter->getPeak());
+}
+
+void SettingsWindow::drawSceneControl(PythonScene& scene, InstanceState& pstate)
 {
     if(ImGui::Button("Reload"))
     {
         scene.reload();
+        pstate.markColorsDirty();
+        parent->getConservation()->reset();
+    }
+}
+
+void SettingsWindow::drawReplayControl()
+{
+    SnapshotReplay* replay = parent->getReplay();
+
+    ImGui::InputText("Path", replayPath, sizeof(replayPath));
+    if(ImGui::Button("Open"))
+    {
+        parent->openReplay(replayPath);
+    }
+    ImGui::SameLine();
+    ImGui::BeginDisabled(!replay->isOpen());
+    if(ImGui::Button("Close"))
+    {
+        parent->closeReplay();
+    }
+
+    ImGui::Checkbox("Play", &replay->playing);
+    ImGui::SameLine();
+    ImGui::Checkbox("Loop", &replay->loop);
+    ImGui::DragFloat("Frames/s", &replay->framesPerSecond, 0.5f, 0.0f, 1000.0f);
+
+    int frame = static_cast<int>(replay->getCurrentFrame());
+    int lastFrame = std::max(static_cast<int>(replay->getFrameCount()) - 1, 0);
+    if(ImGui::SliderInt("Timeline", &frame, 0, lastFrame))
+    {
+        replay->seek(static_cast<std::size_t>(frame));
+    }
+    ImGui::EndDisabled();
+}
+
+void SettingsWindow::drawStreamControl()
+{
+    StreamSubscriber* stream = parent->getStream();
+    ControlClient* control = parent->getControl();
+
+    ImGui::BeginDisabled();
+    int step = static_cast<int>(stream->getStep());
+    ImGui::DragInt("Step", &step);
+    ImGui::EndDisabled();
+
+    ImGui::BeginDisabled(!control->isConnected());
+    if(ImGui::Button("Pause"))
+    {
+        control->send(ControlMessage::Type::PAUSE);
+    }
+    ImGui::SameLine();
+    if(ImGui::Button("Resume"))
+    {
+        control->send(ControlMessage::Type::RESUME);
+    }
+    ImGui::SameLine();
+    if(ImGui::Button("Step"))
+    {
+        control->send(ControlMessage::Type::STEP);
+    }
+
+    if(ImGui::SliderFloat("Threshold", &streamThreshold, 0.0f, 2.0f))
+    {
+        control->send(ControlMessage::Type::SET_PARAMETER, "thr", streamThreshold);
+    }
+    ImGui::EndDisabled();
+
+    if(ImGui::Button("Detach"))
+    {
+        parent->detachStream();
+    }
+}
+
+void SettingsWindow::drawProfiles()
+{
+    AnalysisPipeline* analysis = parent->getAnalysis();
+
+    ImGui::Checkbox("Enabled", &analysis->enabled);
+    ImGui::DragInt("Every N steps", &analysis->every, 1.0f, 1, 10000);
+    ImGui::DragInt("Bins", &analysis->bins, 1.0f, 1, 512);
+    ImGui::DragFloat("Max radius", &analysis->maxRadius, 1.0f, 1.0f, 1E6f);
+
+    static const char* centerModes[] = { "Origin", "Center of mass", "Focused particle" };
+    int mode = static_cast<int>(analysis->centerMode);
+    if(ImGui::Combo("Center", &mode, centerModes, 3))
+    {
+        analysis->centerMode = static_cast<AnalysisPipeline::CenterMode>(mode);
+    }
+    analysis->centerBody = std::max(particleFocus, 0);
+
+    if(!analysis->hasResult()) return;
+
+    const AnalysisResult result = analysis->getLatest();
+    const int n = static_cast<int>(result.radii.size());
+    const ImVec2 plotSize(0.0f, 60.0f);
+
+    ImGui::Text("Step %llu, r_max %.1f", result.step, result.radii.empty() ? 0.0f : result.radii.back());
+    ImGui::PlotLines("Density", result.density.data(), n, 0, nullptr, 0.0f, 3.4e38f, plotSize);
+    ImGui::PlotLines("v_r", result.radialVelocity.data(), n, 0, nullptr, 3.4e38f, 3.4e38f, plotSize);
+    ImGui::PlotLines("v_t", result.tangentialVelocity.data(), n, 0, nullptr, 0.0f, 3.4e38f, plotSize);
+    ImGui::PlotLines("M(<r)", result.enclosedMass.data(), n, 0, nullptr, 0.0f, 3.4e38f, plotSize);
+
+    ImGui::BeginDisabled();
+    float dispersion = result.velocityDispersion;
+    PVector3 angularMomentum = result.angularMomentum;
+    ImGui::InputFloat("Dispersion", &dispersion);
+    ImGui::InputFloat3("Angular momentum", angularMomentum.data);
+    ImGui::EndDisabled();
+
+    std::vector<float> dispersionHistory;
+    std::vector<float> angularMomentumHistory;
+    analysis->getHistory(dispersionHistory, angularMomentumHistory);
+    ImGui::PlotLines("Dispersion(t)", dispersionHistory.data(), static_cast<int>(dispersionHistory.size()), 0, nullptr, 3.4e38f, 3.4e38f, plotSize);
+    ImGui::PlotLines("|L|(t)", angularMomentumHistory.data(), static_cast<int>(angularMomentumHistory.size()), 0, nullptr, 3.4e38f, 3.4e38f, plotSize);
+
+    ImGui::InputText("Export path", analysisExportPath, sizeof(analysisExportPath));
+    if(ImGui::Button("Export CSV"))
+    {
+        analysis->exportCSV(analysisExportPath);
     }
 }
 